@@ -0,0 +1,324 @@
+/*
+ * This file is part of the Gopherus project.
+ * Copyright (C) 2013-2022 Mateusz Viste
+ */
+
+#include <stdio.h>
+#include <stdlib.h>  /* malloc(), free() */
+#include <string.h>  /* strcpy(), strlen(), strcspn() */
+#include <strings.h> /* strcasecmp() */
+
+#include "config.h"
+#include "net/net.h"
+#include "parseurl.h"
+#include "timer.h"
+#include "xfer.h"
+
+#include "batch.h" /* include self for control */
+
+/* how many lines of the list are read ahead, so a transfer can be started
+ * for another host while the next one in the list is at its per-host limit */
+#define BATCH_QUEUE 64
+
+/* max length of a line of the list */
+#define BATCH_MAXLINE (MAXURLLEN + 256)
+
+/* a resource of the list, queued or being fetched */
+struct batch_item {
+  struct batch_item *next;
+  struct xfer *x;      /* NULL while queued */
+  char *buff;          /* receive buffer of x */
+  long lineno;
+  int events;
+  char *url;
+  char *fname;
+  char *selector;
+  unsigned short port;
+  unsigned char protocol;
+  char host[MAXHOSTLEN];
+  char storage[1];     /* url, fname and selector */
+};
+
+
+/* outputs s as a JSON string */
+static void batch_jsonstr(const char *s) {
+  putchar('"');
+  for (; *s != 0; s++) {
+    unsigned char c = *s;
+    if ((c == '"') || (c == '\\')) {
+      putchar('\\');
+      putchar(c);
+    } else if (c < 0x20) {
+      printf("\\u%04x", c);
+    } else {
+      putchar(c);
+    }
+  }
+  putchar('"');
+}
+
+
+static void batch_jsonms(const char *name, unsigned long us) {
+  printf(",\"%s\":%lu.%03lu", name, us / 1000, us % 1000);
+}
+
+
+/* reports the outcome of resource it on a line of its own. err is NULL if
+ * it has been fetched successfully. */
+static void batch_report(const struct batch_item *it, const char *err) {
+  const struct xfer *x = it->x;
+  printf("{\"line\":%ld,\"url\":", it->lineno);
+  batch_jsonstr(it->url);
+  printf(",\"file\":");
+  batch_jsonstr(it->fname);
+  if (err != NULL) {
+    if (err[0] == '!') err++;
+    printf(",\"status\":\"error\",\"error\":");
+    batch_jsonstr(err);
+    if (x != NULL) batch_jsonms("total_ms", x->timing.end - x->timing.start);
+  } else {
+    printf(",\"status\":\"ok\",\"bytes\":%ld", x->totlen);
+    batch_jsonms("dns_ms", x->timing.resolved - x->timing.start);
+    batch_jsonms("connect_ms", x->timing.connected - x->timing.resolved);
+    if (x->protocol == PARSEURL_PROTO_GOPHERS) batch_jsonms("tls_ms", x->timing.secured - x->timing.connected);
+    batch_jsonms("ttfb_ms", x->timing.firstbyte - x->timing.secured);
+    batch_jsonms("transfer_ms", x->timing.end - x->timing.firstbyte);
+    batch_jsonms("total_ms", x->timing.end - x->timing.start);
+    printf(",\"reused\":%d", x->reused);
+    if (x->protocol == PARSEURL_PROTO_GOPHERS) printf(",\"resumed\":%d", x->tlsresumed);
+  }
+  printf("}\n");
+  fflush(stdout); /* whoever reads it may want to act on it right away */
+}
+
+
+static void batch_free(struct batch_item *it) {
+  xfer_free(it->x);
+  free(it->buff);
+  free(it);
+}
+
+
+/* reads the next resource from list. returns NULL at the end of the list,
+ * or with *err set if the line is invalid (or out of memory) */
+static struct batch_item *batch_read(FILE *list, long *lineno, char *line, const char **err) {
+  struct batch_item *it;
+  char *url, *fname, *end;
+  char host[MAXHOSTLEN], selector[MAXSELLEN], tmpurl[MAXURLLEN], itemtype;
+  unsigned short port;
+  unsigned char protocol;
+  size_t len;
+
+  *err = NULL;
+  for (;;) {
+    if (fgets(line, BATCH_MAXLINE, list) == NULL) return(NULL);
+    (*lineno)++;
+    len = strlen(line);
+    if ((len > 0) && (line[len - 1] != '\n') && (feof(list) == 0)) {
+      int c;
+      while (((c = fgetc(list)) != EOF) && (c != '\n')); /* skip the rest */
+      line[0] = 0;
+      *err = "line too long";
+      break;
+    }
+    line[strcspn(line, "\r\n")] = 0;
+    url = line + strspn(line, " \t");
+    if ((url[0] != 0) && (url[0] != '#')) break;
+  }
+
+  /* split the line in "url outfile" */
+  if (*err == NULL) {
+    end = url + strcspn(url, " \t");
+    fname = end + strspn(end, " \t");
+    *end = 0;
+    for (end = fname + strlen(fname); (end > fname) && ((end[-1] == ' ') || (end[-1] == '\t')); end--) end[-1] = 0;
+  } else {
+    url = line;
+    fname = line;
+  }
+
+  it = calloc(1, sizeof(struct batch_item) + strlen(url) + strlen(fname) + 2 + MAXSELLEN);
+  if (it == NULL) {
+    *err = "!Out of memory";
+    return(NULL);
+  }
+  it->lineno = *lineno;
+  it->url = it->storage;
+  strcpy(it->url, url);
+  it->fname = it->url + strlen(url) + 1;
+  strcpy(it->fname, fname);
+  it->selector = it->fname + strlen(fname) + 1;
+  if (*err != NULL) return(it);
+
+  if (fname[0] == 0) {
+    *err = "no output file";
+    return(it);
+  }
+  if (strcmp(fname, "-") == 0) {
+    *err = "stdout is reserved for the results";
+    return(it);
+  }
+  if (strlen(url) >= sizeof(tmpurl)) {
+    *err = "invalid URL";
+    return(it);
+  }
+  strcpy(tmpurl, url); /* parsegopherurl() alters it */
+  protocol = parsegopherurl(tmpurl, host, sizeof(host), &port, &itemtype, selector, sizeof(selector));
+  if (protocol == PARSEURL_ERROR) {
+    *err = "invalid URL";
+    return(it);
+  }
+  if (((protocol != PARSEURL_PROTO_GOPHER) && (protocol != PARSEURL_PROTO_GOPHERS) && (protocol != PARSEURL_PROTO_HTTP)) || (host[0] == '#')) {
+    *err = "unsupported protocol";
+    return(it);
+  }
+  /* same rule as -o: never overwrite a file */
+  {
+    FILE *fd = fopen(fname, "rb");
+    if (fd != NULL) {
+      fclose(fd);
+      *err = "file already exists";
+      return(it);
+    }
+  }
+  strcpy(it->host, host);
+  strcpy(it->selector, selector);
+  it->port = port;
+  it->protocol = protocol;
+  return(it);
+}
+
+
+/* tells whether fname is the output file of a transfer that is queued or
+ * running already: batch_read() refuses existing files, but those are not
+ * created yet */
+static int batch_fnamebusy(const char *fname, const struct batch_item *queue, struct batch_item * const *slot, int active) {
+  int i;
+  for (; queue != NULL; queue = queue->next) {
+    if (strcmp(queue->fname, fname) == 0) return(1);
+  }
+  for (i = 0; i < active; i++) {
+    if (strcmp(slot[i]->fname, fname) == 0) return(1);
+  }
+  return(0);
+}
+
+
+long batch_run(FILE *list, int parallel, int perhost) {
+  struct batch_item *slot[DL_MAXPARALLEL];
+  struct net_pollevent ev[DL_MAXPARALLEL];
+  struct batch_item *queue = NULL, **queuetail = &queue;
+  struct net_pollset *ps;
+  char *line;
+  long lineno = 0, failcount = 0;
+  int queued = 0, active = 0, eof = 0, i, evcount;
+
+  if (parallel > DL_MAXPARALLEL) parallel = DL_MAXPARALLEL;
+  ps = net_pollset_new();
+  line = malloc(BATCH_MAXLINE);
+  if ((ps == NULL) || (line == NULL)) {
+    net_pollset_free(ps);
+    free(line);
+    return(-1);
+  }
+
+  for (;;) {
+    struct batch_item *it, **p;
+    long timeout = -1;
+
+    /* read the list ahead */
+    while ((eof == 0) && (queued < BATCH_QUEUE)) {
+      const char *err;
+      it = batch_read(list, &lineno, line, &err);
+      if (err != NULL) {
+        if (it == NULL) goto OOM;
+        batch_report(it, err);
+        batch_free(it);
+        failcount++;
+        continue;
+      }
+      if (it == NULL) {
+        eof = 1;
+        break;
+      }
+      if (batch_fnamebusy(it->fname, queue, slot, active)) {
+        batch_report(it, "file already used by an earlier line");
+        batch_free(it);
+        failcount++;
+        continue;
+      }
+      *queuetail = it;
+      queuetail = &(it->next);
+      queued++;
+    }
+
+    /* start the first queued transfers that fit within the limits */
+    for (p = &queue; (*p != NULL) && (active < parallel);) {
+      int samehost = 0;
+      it = *p;
+      for (i = 0; i < active; i++) {
+        if (strcasecmp(slot[i]->host, it->host) == 0) samehost++;
+      }
+      if (samehost >= perhost) {
+        p = &(it->next);
+        continue;
+      }
+      /* dequeue it */
+      *p = it->next;
+      if (queuetail == &(it->next)) queuetail = p;
+      queued--;
+      it->next = NULL;
+      it->buff = malloc(DL_BUFSZ);
+      if (it->buff != NULL) it->x = xfer_new(it->protocol, it->host, it->port, it->selector, it->buff, DL_BUFSZ, it->fname, ps);
+      if (it->x == NULL) {
+        batch_free(it);
+        goto OOM;
+      }
+      slot[active++] = it;
+    }
+
+    /* nothing running, nothing left to start: all done */
+    if (active == 0) break;
+
+    /* wait for network events (or until a transfer needs to be stepped
+     * anyway), then make all transfers progress */
+    for (i = 0; i < active; i++) {
+      long t = xfer_timeout(slot[i]->x);
+      if ((timeout < 0) || ((t >= 0) && (t < timeout))) timeout = t;
+    }
+    evcount = net_pollset_wait(ps, ev, DL_MAXPARALLEL, timeout);
+    for (; evcount > 0; evcount--) {
+      for (i = 0; i < active; i++) {
+        if (slot[i]->x == ev[evcount - 1].userdata) slot[i]->events |= ev[evcount - 1].events;
+      }
+    }
+    for (i = 0; i < active; i++) {
+      int state = xfer_step(slot[i]->x, slot[i]->events);
+      slot[i]->events = 0;
+      if ((state != XFER_DONE) && (state != XFER_FAIL)) continue;
+      if (state == XFER_DONE) {
+        batch_report(slot[i], NULL);
+      } else {
+        batch_report(slot[i], slot[i]->x->errmsg);
+        failcount++;
+      }
+      batch_free(slot[i]);
+      slot[i--] = slot[--active];
+    }
+  }
+
+  net_pollset_free(ps);
+  free(line);
+  return(failcount);
+
+  OOM:
+  for (i = 0; i < active; i++) batch_free(slot[i]);
+  while (queue != NULL) {
+    struct batch_item *it = queue;
+    queue = it->next;
+    batch_free(it);
+  }
+  net_pollset_free(ps);
+  free(line);
+  return(-1);
+}
@@ -0,0 +1,23 @@
+/*
+ * This file is part of the Gopherus project.
+ * Copyright (C) 2013-2022 Mateusz Viste
+ *
+ * Batch mode: fetches a list of resources to files, many at a time, and
+ * reports the outcome of each of them as a line of JSON on stdout. All the
+ * transfers run within a single process, so they share the DNS cache, the
+ * pool of idle http connections and the TLS sessions.
+ */
+
+#ifndef batch_h_sentinel
+#define batch_h_sentinel
+
+#include <stdio.h>
+
+/* fetches the resources listed in list, one "url outfile" pair per line
+ * (blank lines and lines starting with '#' are ignored). at most parallel
+ * transfers run at the same time, and no more than perhost of them to a
+ * single host. existing files are never overwritten. returns the amount of
+ * resources that could not be fetched, or -1 on out of memory. */
+long batch_run(FILE *list, int parallel, int perhost);
+
+#endif
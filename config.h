@@ -8,13 +8,34 @@
  * MAXSELLEN       - max length (bytes) of a selector string
  * MAXURLLEN       - max length (bytes) of a URL
  * MAXQUERYLEN     - max length (bytes) of a type 7 query
- * DNS_MAXENTRIES  - max amount of DNS entries to keep in cache
- * DNS_MAXHOSTLEN  - max hostname's length (bytes) for DNS cache
- * DNS_CACHETIME   - how long (seconds) to keep the DNS entries in cache
- * MAXALLOWEDCACHE - history cache size (must be at least PAGEBUFSZ bytes)
+ * DNS_MAXENTRIES  - default max amount of hosts to keep in DNS cache
+ * DNS_MAXADDR     - max amount of addresses kept for a single host
+ * DNS_CACHETIME   - default time (seconds) to keep the DNS entries in cache
+ * DNS_NEGCACHE    - how long (seconds) to remember that a host does not exist
+ * DNS_RESOLVERS   - max amount of resolver threads running concurrently
+ * MAXALLOWEDCACHE - memory cache size, counted in compressed bytes (must be
+ *                   at least PAGEBUFSZ bytes)
  * PAGEBUFSZ       - page buffer size (max size of a single page, bytes)
  * MAXMENULINES    - max amount of lines in a gopher menu page
  * MAXALLOWEDCACHE - max size of cacheable page (bytes)
+ * DL_PARALLEL     - default amount of concurrent "download all" transfers
+ * DL_PERHOST      - default max amount of concurrent transfers to one host
+ * DL_MAXPARALLEL  - hard limit of concurrent "download all" transfers
+ * DL_BUFSZ        - receive buffer size of a "download all" transfer
+ * HTTP_POOLSIZE   - max amount of idle http connections kept for reuse
+ * HTTP_IDLETIME   - how long (seconds) an idle http connection is kept
+ * HTTP_HDRSZ      - room (bytes) for the headers of an http answer
+ * PREFETCH_BYTES  - default byte budget of the prefetcher (0 disables it)
+ * PREFETCH_CONNS  - default max amount of prefetches while browsing a menu
+ * PRECONN_SOCKS   - default max amount of speculative connections
+ * PRECONN_MAXSOCKS - hard limit of speculative connections kept open
+ * PRECONN_IDLE    - how long (seconds) an unused speculative connection lives
+ * CRAWL_DEPTH     - default depth of links followed when mirroring
+ * CRAWL_DELAY     - default pause (ms) between two requests to a mirrored host
+ * PACK_COMPRESS   - deflate the files of packs being built (needs HAVE_ZLIB)
+ * DISKCACHE_SIZE  - default size (KiB) of the disk cache (0 disables it)
+ * DISKCACHE_MENUTTL - default time (seconds) a menu stays fresh in disk cache
+ * DISKCACHE_TTL   - default time (seconds) other pages stay fresh in disk cache
  * NOLFN           - environment is assumed to be 8+3
  */
 
@@ -41,18 +62,31 @@
 #define MAXQUERYLEN 256
 #endif
 
-/* size of the DNS cache, in entries */
+/* default size of the DNS cache, in entries */
 #ifndef DNS_MAXENTRIES
-#define DNS_MAXENTRIES 16l
+#define DNS_MAXENTRIES 64
 #endif
 
-/* maximum host len handled by the DNS cache */
-#ifndef DNS_MAXHOSTLEN
-#define DNS_MAXHOSTLEN 31l
+/* max amount of addresses remembered for a single host */
+#ifndef DNS_MAXADDR
+#define DNS_MAXADDR 8
 #endif
 
+/* default time (seconds) the addresses of a host are kept in cache. the
+ * resolver does not tell the TTL of records, and the cache is kept on disk
+ * from one session to the next, hence something longer than a session.
+ * a cached address that stops answering is resolved again anyway */
 #ifndef DNS_CACHETIME
-#define DNS_CACHETIME 120l
+#define DNS_CACHETIME 3600l
+#endif
+
+/* how long (seconds) to remember that a host does not exist */
+#ifndef DNS_NEGCACHE
+#define DNS_NEGCACHE 30l
+#endif
+/* max amount of hostnames resolved concurrently (where threads exist) */
+#ifndef DNS_RESOLVERS
+#define DNS_RESOLVERS 4
 #endif
 
 /* max size of a displayed resource (in bytes) */
@@ -70,4 +104,101 @@
 #define MAXALLOWEDCACHE 1024l*1024*2
 #endif
 
+/* default amount of concurrent transfers performed by "download all" */
+#ifndef DL_PARALLEL
+#define DL_PARALLEL 4
+#endif
+
+/* default max amount of concurrent "download all" transfers per host */
+#ifndef DL_PERHOST
+#define DL_PERHOST 2
+#endif
+
+/* hard limit of concurrent "download all" transfers */
+#ifndef DL_MAXPARALLEL
+#define DL_MAXPARALLEL 16
+#endif
+
+/* receive buffer of each "download all" transfer (bytes) */
+#ifndef DL_BUFSZ
+#define DL_BUFSZ 4096
+#endif
+
+/* max amount of idle http connections kept open for later reuse */
+#ifndef HTTP_POOLSIZE
+#define HTTP_POOLSIZE 4
+#endif
+
+/* how long (seconds) an idle http connection is kept open */
+#ifndef HTTP_IDLETIME
+#define HTTP_IDLETIME 15
+#endif
+
+/* room (bytes) for the headers of an http answer, those that do not fit are
+ * still looked at for framing but cannot be queried afterwards */
+#ifndef HTTP_HDRSZ
+#define HTTP_HDRSZ 1024
+#endif
+
+/* default max size (bytes) of a prefetched resource (prefetched resources are
+ * kept in the page cache). 0 disables prefetching */
+#ifndef PREFETCH_BYTES
+#define PREFETCH_BYTES 131072l
+#endif
+
+/* default max amount of items prefetched while browsing a single menu */
+#ifndef PREFETCH_CONNS
+#define PREFETCH_CONNS 8
+#endif
+
+/* default max amount of speculative connections to the servers of selected
+ * menu items. 0 disables them */
+#ifndef PRECONN_SOCKS
+#define PRECONN_SOCKS 2
+#endif
+
+/* hard limit of speculative connections */
+#ifndef PRECONN_MAXSOCKS
+#define PRECONN_MAXSOCKS 8
+#endif
+
+/* default time (seconds) an unused speculative connection is kept open */
+#ifndef PRECONN_IDLE
+#define PRECONN_IDLE 15
+#endif
+
+/* default amount of menu levels followed from the starting url of a mirror */
+#ifndef CRAWL_DEPTH
+#define CRAWL_DEPTH 3
+#endif
+
+/* default time (ms) between the starts of two requests to the same host
+ * while mirroring */
+#ifndef CRAWL_DELAY
+#define CRAWL_DELAY 100
+#endif
+
+/* set to 1 to deflate the files stored in packs where this makes them
+ * smaller. such packs can only be read by builds that have zlib, the
+ * default keeps them readable by every platform */
+#ifndef PACK_COMPRESS
+#define PACK_COMPRESS 0
+#endif
+
+/* default size (KiB) of the disk cache of pages */
+#ifndef DISKCACHE_SIZE
+#define DISKCACHE_SIZE 4096
+#endif
+
+/* default time (seconds) a menu read from the disk cache is fresh enough */
+#ifndef DISKCACHE_MENUTTL
+#define DISKCACHE_MENUTTL 3600
+#endif
+
+/* default time (seconds) a text or html page read from the disk cache is
+ * fresh enough */
+#ifndef DISKCACHE_TTL
+#define DISKCACHE_TTL 86400
+#endif
+
 #endif
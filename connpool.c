@@ -0,0 +1,96 @@
+/*
+ * This file is part of the Gopherus project.
+ * Copyright (C) 2013-2022 Mateusz Viste
+ */
+
+#include <stdlib.h>  /* malloc(), free() */
+#include <string.h>  /* strcpy(), strlen() */
+#include <strings.h> /* strcasecmp() */
+#include <time.h>
+
+#include "config.h"
+#include "net/net.h"
+
+#include "connpool.h" /* include self for control */
+
+struct connpool_t {
+  struct net_tcpsocket *sock;
+  time_t idlesince;
+  unsigned short port;
+  char host[1];
+};
+
+static struct connpool_t *connpool[HTTP_POOLSIZE];
+
+
+static void connpool_drop(int i) {
+  net_close(&(connpool[i]->sock));
+  free(connpool[i]);
+  connpool[i] = NULL;
+}
+
+
+/* closes connections that have been idle for too long: servers tend to
+ * close them on their side anyway */
+static void connpool_expire(void) {
+  time_t limit = time(NULL) - HTTP_IDLETIME;
+  int i;
+  for (i = 0; i < HTTP_POOLSIZE; i++) {
+    if ((connpool[i] != NULL) && (connpool[i]->idlesince < limit)) connpool_drop(i);
+  }
+}
+
+
+void connpool_put(struct net_tcpsocket *s, const char *host, unsigned short port) {
+  struct connpool_t *c;
+  int i, slot = 0;
+
+  connpool_expire();
+
+  /* find a free slot, or else the one that's been idle the longest */
+  for (i = 0; i < HTTP_POOLSIZE; i++) {
+    if (connpool[i] == NULL) {
+      slot = i;
+      break;
+    }
+    if (connpool[i]->idlesince < connpool[slot]->idlesince) slot = i;
+  }
+  if (connpool[slot] != NULL) connpool_drop(slot);
+
+  c = malloc(sizeof(struct connpool_t) + strlen(host));
+  if (c == NULL) {
+    net_close(&s);
+    return;
+  }
+  c->sock = s;
+  c->idlesince = time(NULL);
+  c->port = port;
+  strcpy(c->host, host);
+  connpool[slot] = c;
+}
+
+
+struct net_tcpsocket *connpool_get(const char *host, unsigned short port) {
+  struct net_tcpsocket *s;
+  int i;
+
+  connpool_expire();
+
+  for (i = 0; i < HTTP_POOLSIZE; i++) {
+    if (connpool[i] == NULL) continue;
+    if ((connpool[i]->port != port) || (strcasecmp(connpool[i]->host, host) != 0)) continue;
+    s = connpool[i]->sock;
+    free(connpool[i]);
+    connpool[i] = NULL;
+    return(s);
+  }
+  return(NULL);
+}
+
+
+void connpool_flush(void) {
+  int i;
+  for (i = 0; i < HTTP_POOLSIZE; i++) {
+    if (connpool[i] != NULL) connpool_drop(i);
+  }
+}
@@ -0,0 +1,26 @@
+/*
+ * This file is part of the Gopherus project.
+ * Copyright (C) 2013-2022 Mateusz Viste
+ *
+ * Pool of idle http connections, kept open so consecutive requests to the
+ * same server do not have to pay a new TCP handshake each time.
+ */
+
+#ifndef connpool_h_sentinel
+#define connpool_h_sentinel
+
+#include "net/net.h"
+
+/* hands over the idle connection s to host:port. the pool takes ownership
+ * of s (it may close it right away if the pool is full) */
+void connpool_put(struct net_tcpsocket *s, const char *host, unsigned short port);
+
+/* takes an idle connection to host:port out of the pool, or returns NULL if
+ * there is none. the caller owns the returned socket. note that the server
+ * may have closed it in the meantime, without us noticing yet. */
+struct net_tcpsocket *connpool_get(const char *host, unsigned short port);
+
+/* closes all pooled connections */
+void connpool_flush(void);
+
+#endif
@@ -0,0 +1,647 @@
+/*
+ * This file is part of the Gopherus project.
+ * Copyright (C) 2013-2022 Mateusz Viste
+ */
+
+#include <ctype.h>   /* tolower() */
+#include <stdio.h>
+#include <stdlib.h>  /* malloc(), free(), atol() */
+#include <string.h>  /* strcpy(), strlen(), strcspn() */
+#include <strings.h> /* strcasecmp() */
+
+#include "config.h"
+#include "dnscache.h"
+#include "fs/fs.h"
+#include "menuline.h"
+#include "net/net.h"
+#include "parseurl.h"
+#include "timer.h"
+#include "xfer.h"
+
+#include "crawl.h" /* include self for control */
+
+/* how many resources at the head of the frontier are looked at to find one
+ * that can be started while the first ones wait for their host */
+#define CRAWL_LOOKAHEAD 64
+
+/* name of the index file, within the mirror directory */
+#define CRAWL_INDEX "index.txt"
+
+/* name of the file a menu is stored as, within its own directory */
+#define CRAWL_MENUFILE "gophermap"
+
+/* max length of the local path of a resource */
+#define CRAWL_MAXPATH 512
+
+/* max length of a menu (or index) line, longer ones are skipped */
+#define CRAWL_MAXLINE (1024 + MAXHOSTLEN + MAXSELLEN)
+
+/* max length of a dedupe key: "host:port/selector" */
+#define CRAWL_MAXKEY (MAXHOSTLEN + MAXSELLEN + 8)
+
+/* a resource of the frontier, queued or being fetched */
+struct crawl_item {
+  struct crawl_item *next;
+  struct xfer *x;      /* NULL while queued */
+  char *buff;          /* receive buffer of x */
+  char *path;          /* local file, known once started */
+  int hostid;          /* entry in the table of hosts */
+  int events;
+  int depth;
+  unsigned short port;
+  unsigned char protocol;
+  char itemtype;
+  char host[MAXHOSTLEN];
+  char selector[1];
+};
+
+/* politeness bookkeeping of a host */
+struct crawl_host {
+  unsigned long laststart; /* timer_ms() of the latest request */
+  int active;              /* transfers running */
+  int started;             /* laststart is set */
+  char name[MAXHOSTLEN];
+};
+
+/* state of a mirror in progress */
+struct crawl {
+  const struct crawl_opts *opts;
+  char **seen;             /* open addressing hash set of dedupe keys */
+  unsigned long seensz;    /* always a power of 2 */
+  unsigned long seencount;
+  struct crawl_host *host;
+  int hostcount;
+  struct crawl_item *queue; /* FIFO, so the hole is walked breadth-first */
+  struct crawl_item **queuetail;
+  FILE *index;
+  long fetched;
+  long failed;
+  char starthost[MAXHOSTLEN];
+};
+
+
+/* FNV-1a */
+static unsigned long crawl_hash(const char *s) {
+  unsigned long h = 2166136261ul;
+  for (; *s != 0; s++) {
+    h ^= (unsigned char)*s;
+    h = (h * 16777619ul) & 0xfffffffful;
+  }
+  return(h);
+}
+
+
+/* adds key to the set of known resources. returns 0 if it was not known yet,
+ * 1 if it was, or -1 on out of memory */
+static int crawl_seenadd(struct crawl *c, const char *key) {
+  unsigned long i;
+  char *k;
+
+  /* keep the set at most half full, so lookups stay short */
+  if ((c->seencount + 1) * 2 > c->seensz) {
+    unsigned long newsz = (c->seensz == 0) ? 256 : c->seensz * 2;
+    char **newset = calloc(newsz, sizeof(char *));
+    if (newset == NULL) return(-1);
+    for (i = 0; i < c->seensz; i++) {
+      unsigned long j;
+      if (c->seen[i] == NULL) continue;
+      for (j = crawl_hash(c->seen[i]) & (newsz - 1); newset[j] != NULL; j = (j + 1) & (newsz - 1));
+      newset[j] = c->seen[i];
+    }
+    free(c->seen);
+    c->seen = newset;
+    c->seensz = newsz;
+  }
+
+  for (i = crawl_hash(key) & (c->seensz - 1); c->seen[i] != NULL; i = (i + 1) & (c->seensz - 1)) {
+    if (strcmp(c->seen[i], key) == 0) return(1);
+  }
+  k = malloc(strlen(key) + 1);
+  if (k == NULL) return(-1);
+  strcpy(k, key);
+  c->seen[i] = k;
+  c->seencount++;
+  return(0);
+}
+
+
+/* matches s against pattern pat, where '*' stands for any amount of any
+ * characters and '?' for any single one. returns non-zero on match. */
+static int crawl_glob(const char *pat, const char *s, int nocase) {
+  for (; *pat != 0; pat++, s++) {
+    if (*pat == '*') {
+      for (;; s++) {
+        if (crawl_glob(pat + 1, s, nocase)) return(1);
+        if (*s == 0) return(0);
+      }
+    }
+    if (*s == 0) return(0);
+    if (*pat == '?') continue;
+    if (nocase) {
+      if (tolower((unsigned char)*pat) != tolower((unsigned char)*s)) return(0);
+    } else if (*pat != *s) {
+      return(0);
+    }
+  }
+  return(*s == 0);
+}
+
+
+/* returns the index of host name in the table of hosts (adding it if needed),
+ * or -1 on out of memory */
+static int crawl_gethost(struct crawl *c, const char *name) {
+  struct crawl_host *h;
+  int i;
+  for (i = 0; i < c->hostcount; i++) {
+    if (strcasecmp(c->host[i].name, name) == 0) return(i);
+  }
+  h = realloc(c->host, (c->hostcount + 1) * sizeof(struct crawl_host));
+  if (h == NULL) return(-1);
+  c->host = h;
+  memset(&(h[i]), 0, sizeof(struct crawl_host));
+  strcpy(h[i].name, name);
+  c->hostcount++;
+  return(i);
+}
+
+
+/* copies src (srclen bytes) to dst as a file name, up to len bytes
+ * (terminator included). anything that might not be valid or safe in a file
+ * name is written as %XX, and so are '%' and '~' (see crawl_path), as well as
+ * the first character of a name the mirror uses for itself. this way two
+ * distinct components never end up with the same name. returns the length
+ * of the name, or -1 if it does not fit. */
+static long crawl_pathcomp(char *dst, const char *src, size_t srclen, size_t len) {
+  size_t i, l = 0;
+  int dotsonly = 1, reserved = 0;
+  for (i = 0; i < srclen; i++) {
+    if (src[i] != '.') dotsonly = 0;
+  }
+  if ((srclen == strlen(CRAWL_MENUFILE)) && (memcmp(src, CRAWL_MENUFILE, srclen) == 0)) reserved = 1;
+  if ((srclen == strlen(CRAWL_INDEX)) && (memcmp(src, CRAWL_INDEX, srclen) == 0)) reserved = 1;
+  for (i = 0; i < srclen; i++) {
+    unsigned char ch = src[i];
+    int keep = 0;
+    if (((ch >= 'a') && (ch <= 'z')) || ((ch >= 'A') && (ch <= 'Z')) || ((ch >= '0') && (ch <= '9'))) {
+      keep = 1;
+    } else if ((ch == '.') || (ch == '-') || (ch == '_') || (ch == '+') || (ch == ',') || (ch == '=')) {
+      keep = 1;
+    }
+    /* "." and ".." must not lead anywhere else than into the mirror */
+    if (dotsonly || (reserved && (i == 0))) keep = 0;
+    if (keep) {
+      if (l + 1 >= len) return(-1);
+      dst[l++] = ch;
+    } else {
+      if (l + 3 >= len) return(-1);
+      sprintf(dst + l, "%%%02X", ch);
+      l += 3;
+    }
+  }
+  dst[l] = 0;
+  return(l);
+}
+
+
+/* computes the local path of a resource: outdir/host[~port]/selector. every
+ * component of the selector is a directory, but the last one of a resource
+ * that is not a menu: that is the file, its name starting with '~' so it
+ * never clashes with a directory ("~" alone for an empty selector). a menu
+ * is stored as the CRAWL_MENUFILE of its own directory. returns non-zero if
+ * the result does not fit in path. */
+static int crawl_path(char *path, const char *outdir, const struct crawl_item *it) {
+  size_t l;
+  long n;
+  const char *s;
+
+  l = strlen(outdir);
+  if (l + 1 >= CRAWL_MAXPATH) return(-1);
+  strcpy(path, outdir);
+  path[l++] = '/';
+  n = crawl_pathcomp(path + l, it->host, strlen(it->host), CRAWL_MAXPATH - l);
+  if (n < 0) return(-1);
+  l += n;
+  if (it->port != 70) {
+    if (l + 7 >= CRAWL_MAXPATH) return(-1);
+    l += sprintf(path + l, "~%u", it->port);
+  }
+
+  for (s = it->selector + strspn(it->selector, "/\\"); *s != 0; s += strspn(s, "/\\")) {
+    size_t complen = strcspn(s, "/\\");
+    int leaf = (it->itemtype != '1') && (s[complen + strspn(s + complen, "/\\")] == 0);
+    if (l + 2 >= CRAWL_MAXPATH) return(-1);
+    path[l++] = '/';
+    if (leaf) path[l++] = '~';
+    n = crawl_pathcomp(path + l, s, complen, CRAWL_MAXPATH - l);
+    if (n < 0) return(-1);
+    if (leaf) return(0);
+    l += n;
+    s += complen;
+  }
+
+  s = (it->itemtype == '1') ? "/" CRAWL_MENUFILE : "/~";
+  if (l + strlen(s) >= CRAWL_MAXPATH) return(-1);
+  strcpy(path + l, s);
+  return(0);
+}
+
+
+/* creates the directories leading to file path, that do not exist yet */
+static int crawl_mkparents(char *path) {
+  char *p;
+  for (p = path + 1; *p != 0; p++) {
+    int r;
+    if (*p != '/') continue;
+    *p = 0;
+    r = filemkdir(path);
+    *p = '/';
+    if (r != 0) return(-1);
+  }
+  return(0);
+}
+
+
+static void crawl_free(struct crawl_item *it) {
+  xfer_free(it->x);
+  free(it->buff);
+  free(it->path);
+  free(it);
+}
+
+
+/* adds a resource to the frontier, unless it is known already. returns -1 on
+ * out of memory, 0 otherwise. */
+static int crawl_enqueue(struct crawl *c, int depth, unsigned char protocol, char itemtype, const char *host, unsigned short port, const char *selector) {
+  struct crawl_item *it;
+  char key[CRAWL_MAXKEY];
+  int r;
+
+  buildurlkey(key, host, port, selector);
+  r = crawl_seenadd(c, key);
+  if (r != 0) return((r < 0) ? -1 : 0);
+
+  it = calloc(1, sizeof(struct crawl_item) + strlen(selector));
+  if (it == NULL) return(-1);
+  it->hostid = crawl_gethost(c, host);
+  if (it->hostid < 0) {
+    free(it);
+    return(-1);
+  }
+  it->depth = depth;
+  it->protocol = protocol;
+  it->itemtype = itemtype;
+  it->port = port;
+  strcpy(it->host, host);
+  strcpy(it->selector, selector);
+  *(c->queuetail) = it;
+  c->queuetail = &(it->next);
+  return(0);
+}
+
+
+/* tells whether a link found in a menu is to be followed */
+static int crawl_wanted(const struct crawl *c, char itemtype, const char *selector, const char *host) {
+  switch (itemtype) {
+    case 'i': /* inline text */
+    case '3': /* error */
+    case '7': /* search: needs a query */
+    case '8': /* telnet */
+    case 'T': /* tn3270 */
+    case '2': /* CSO phone-book */
+    case '+': /* redundant server */
+    case '.': /* end of menu */
+      return(0);
+    case 'h': /* hURL pointing out of gopherspace */
+      if ((strncmp(selector, "URL:", 4) == 0) || (strncmp(selector, "/URL:", 5) == 0)) return(0);
+      break;
+  }
+  if ((host[0] == 0) || (strlen(host) >= MAXHOSTLEN) || (strlen(selector) >= MAXSELLEN)) return(0);
+  if (c->opts->hostglob == NULL) {
+    if (strcasecmp(host, c->starthost) != 0) return(0);
+  } else if (crawl_glob(c->opts->hostglob, host, 1) == 0) {
+    return(0);
+  }
+  if ((c->opts->selglob != NULL) && (crawl_glob(c->opts->selglob, selector, 0) == 0)) return(0);
+  return(1);
+}
+
+
+/* reads the menu stored at path and queues the resources it links to. host,
+ * port and protocol are those of the menu: links to the same server inherit
+ * its protocol. returns -1 on out of memory, 0 otherwise. */
+static int crawl_follow(struct crawl *c, const char *path, int depth, unsigned char protocol, const char *host, unsigned short port) {
+  FILE *fd;
+  char *line;
+  int res = 0;
+
+  fd = fopen(path, "rb");
+  if (fd == NULL) return(0);
+  line = malloc(CRAWL_MAXLINE);
+  if (line == NULL) {
+    fclose(fd);
+    return(-1);
+  }
+
+  while (fgets(line, CRAWL_MAXLINE, fd) != NULL) {
+    char itemtype, *sel, *lhost, *lport, url[MAXURLLEN];
+    unsigned char lproto = PARSEURL_PROTO_GOPHER;
+    long iport = 70;
+    size_t len = strlen(line);
+    if ((len > 0) && (line[len - 1] != '\n') && (feof(fd) == 0)) {
+      int ch;
+      while (((ch = fgetc(fd)) != EOF) && (ch != '\n')); /* skip the rest */
+      continue;
+    }
+    menuline_explode(line, len, &itemtype, NULL, &sel, &lhost, &lport);
+    if ((sel == NULL) || (lhost == NULL)) continue;
+    if (lport != NULL) iport = atol(lport);
+    if ((iport < 1) || (iport > 65535)) continue;
+    if (crawl_wanted(c, itemtype, sel, lhost) == 0) continue;
+    /* resources whose url would not fit are skipped, an index line could
+     * not name them */
+    if (buildgopherurl(url, sizeof(url), PARSEURL_PROTO_GOPHERS, lhost, (unsigned short)iport, itemtype, sel) >= (int)sizeof(url) - 1) continue;
+    if ((protocol == PARSEURL_PROTO_GOPHERS) && (iport == port) && (strcasecmp(lhost, host) == 0)) lproto = PARSEURL_PROTO_GOPHERS;
+    if (crawl_enqueue(c, depth + 1, lproto, itemtype, lhost, (unsigned short)iport, sel) != 0) {
+      res = -1;
+      break;
+    }
+  }
+
+  free(line);
+  fclose(fd);
+  return(res);
+}
+
+
+/* loads the index of an earlier run from indexfile: all resources it lists
+ * are known already, and the menus among them are read again so the
+ * frontier is what it was. returns the amount of resources found in the
+ * index, or -1 on out of memory. */
+static long crawl_resume(struct crawl *c, const char *indexfile) {
+  FILE *fd;
+  char *line;
+  long count = 0;
+  int pass;
+
+  fd = fopen(indexfile, "rb");
+  if (fd == NULL) return(0);
+  line = malloc(CRAWL_MAXLINE + CRAWL_MAXPATH);
+  if (line == NULL) {
+    fclose(fd);
+    return(-1);
+  }
+
+  /* first everything gets known, then menus are followed: this way nothing
+   * listed in the index may be queued again */
+  for (pass = 0; pass < 2; pass++) {
+    rewind(fd);
+    while (fgets(line, CRAWL_MAXLINE + CRAWL_MAXPATH, fd) != NULL) {
+      char host[MAXHOSTLEN], selector[MAXSELLEN], key[CRAWL_MAXKEY], path[CRAWL_MAXPATH];
+      char *f[4], itemtype;
+      unsigned short port;
+      unsigned char protocol;
+      int i, depth;
+
+      line[strcspn(line, "\r\n")] = 0;
+      f[0] = line;
+      for (i = 1; i < 4; i++) {
+        f[i] = strchr(f[i - 1], '\t');
+        if (f[i] == NULL) break;
+        *(f[i]++) = 0;
+      }
+      if (i < 4) continue;
+      depth = atoi(f[0]);
+      protocol = parsegopherurl(f[2], host, sizeof(host), &port, &itemtype, selector, sizeof(selector));
+      if ((protocol != PARSEURL_PROTO_GOPHER) && (protocol != PARSEURL_PROTO_GOPHERS)) continue;
+
+      if (pass == 0) {
+        buildurlkey(key, host, port, selector);
+        i = crawl_seenadd(c, key);
+        if (i < 0) goto OOM;
+        if (i == 0) count++;
+        continue;
+      }
+
+      if ((itemtype != '1') || (depth >= c->opts->maxdepth)) continue;
+      i = strlen(c->opts->outdir);
+      if (i + strlen(f[3]) + 2 > sizeof(path)) continue;
+      memcpy(path, c->opts->outdir, i);
+      path[i] = '/';
+      strcpy(path + i + 1, f[3]);
+      if (crawl_follow(c, path, depth, protocol, host, port) != 0) goto OOM;
+    }
+  }
+
+  free(line);
+  fclose(fd);
+  return(count);
+
+  OOM:
+  free(line);
+  fclose(fd);
+  return(-1);
+}
+
+
+/* starts fetching resource it. returns 0 on success, 1 if it could not be
+ * started (which is reported) or -1 on out of memory. */
+static int crawl_start(struct crawl *c, struct crawl_item *it, struct net_pollset *ps) {
+  char path[CRAWL_MAXPATH];
+  const char *err = NULL;
+
+  if (crawl_path(path, c->opts->outdir, it) != 0) {
+    err = "local path too long";
+  } else if (crawl_mkparents(path) != 0) {
+    err = "failed to create directory";
+  }
+  if (err != NULL) {
+    char url[MAXURLLEN];
+    buildgopherurl(url, sizeof(url), it->protocol, it->host, it->port, it->itemtype, it->selector);
+    printf("FAIL %s: %s\n", url, err);
+    fflush(stdout);
+    return(1);
+  }
+
+  it->path = malloc(strlen(path) + 1);
+  it->buff = malloc(DL_BUFSZ);
+  if ((it->path == NULL) || (it->buff == NULL)) return(-1);
+  strcpy(it->path, path);
+  it->x = xfer_new(it->protocol, it->host, it->port, it->selector, it->buff, DL_BUFSZ, it->path, ps);
+  if (it->x == NULL) return(-1);
+  return(0);
+}
+
+
+/* records the outcome of resource it, and queues what it links to if it is a
+ * menu. returns -1 on out of memory, 0 otherwise. */
+static int crawl_done(struct crawl *c, const struct crawl_item *it) {
+  char url[MAXURLLEN];
+
+  buildgopherurl(url, sizeof(url), it->protocol, it->host, it->port, it->itemtype, it->selector);
+  if (it->x->state != XFER_DONE) {
+    const char *err = it->x->errmsg;
+    if (err[0] == '!') err++;
+    printf("FAIL %s: %s\n", url, err);
+    fflush(stdout);
+    c->failed++;
+    return(0);
+  }
+
+  c->fetched++;
+  printf("OK   %s (%ld bytes)\n", url, it->x->totlen);
+  fflush(stdout);
+  /* the index holds paths relative to the mirror, so it can be moved */
+  fprintf(c->index, "%d\t%c\t%s\t%s\n", it->depth, it->itemtype, url, it->path + strlen(c->opts->outdir) + 1);
+  fflush(c->index);
+
+  if ((it->itemtype != '1') || (it->depth >= c->opts->maxdepth)) return(0);
+  return(crawl_follow(c, it->path, it->depth, it->protocol, it->host, it->port));
+}
+
+
+long crawl_run(const char *url, const struct crawl_opts *opts) {
+  struct crawl c;
+  struct crawl_item *slot[DL_MAXPARALLEL];
+  struct net_pollevent ev[DL_MAXPARALLEL];
+  struct net_pollset *ps = NULL;
+  char host[MAXHOSTLEN], selector[MAXSELLEN], tmpurl[MAXURLLEN], indexfile[CRAWL_MAXPATH], itemtype;
+  unsigned short port;
+  unsigned char protocol;
+  int parallel = opts->parallel, active = 0, i, evcount;
+  long known, res = -1;
+
+  memset(&c, 0, sizeof(c));
+  c.opts = opts;
+  c.queuetail = &(c.queue);
+  if (parallel > DL_MAXPARALLEL) parallel = DL_MAXPARALLEL;
+
+  if (strlen(url) >= sizeof(tmpurl)) {
+    puts("Invalid URL");
+    return(-1);
+  }
+  strcpy(tmpurl, url); /* parsegopherurl() alters it */
+  protocol = parsegopherurl(tmpurl, host, sizeof(host), &port, &itemtype, selector, sizeof(selector));
+  if (protocol == PARSEURL_ERROR) {
+    puts("Invalid URL");
+    return(-1);
+  }
+  if (((protocol != PARSEURL_PROTO_GOPHER) && (protocol != PARSEURL_PROTO_GOPHERS)) || (host[0] == '#')) {
+    puts("Only gopher and gophers URLs can be mirrored");
+    return(-1);
+  }
+  strcpy(c.starthost, host);
+
+  if ((strlen(opts->outdir) + strlen(CRAWL_INDEX) + 2 > sizeof(indexfile)) || (filemkdir(opts->outdir) != 0)) {
+    printf("Failed to create directory %s\n", opts->outdir);
+    return(-1);
+  }
+  sprintf(indexfile, "%s/%s", opts->outdir, CRAWL_INDEX);
+
+  /* pick up where an earlier run stopped */
+  known = crawl_resume(&c, indexfile);
+  if (known < 0) goto OOM;
+  if (known > 0) {
+    printf("Resuming: %ld resources fetched already\n", known);
+    fflush(stdout);
+  }
+  c.index = fopen(indexfile, "ab");
+  if (c.index == NULL) {
+    printf("Failed to open %s\n", indexfile);
+    goto DONE;
+  }
+
+  if (crawl_enqueue(&c, 0, protocol, itemtype, host, port, selector) != 0) goto OOM;
+  ps = net_pollset_new();
+  if (ps == NULL) goto OOM;
+
+  for (;;) {
+    struct crawl_item *it, **p;
+    unsigned long now = timer_ms();
+    long timeout = -1;
+    int scanned;
+
+    /* start whatever the per-host limits allow among the first queued
+     * resources, keeping track of when the next delay elapses */
+    for (p = &(c.queue), scanned = 0; (*p != NULL) && (active < parallel) && (scanned < CRAWL_LOOKAHEAD); scanned++) {
+      struct crawl_host *h;
+      it = *p;
+      h = &(c.host[it->hostid]);
+      if (h->active >= opts->perhost) {
+        p = &(it->next);
+        continue;
+      }
+      if (h->started && (now - h->laststart < (unsigned long)opts->delay)) {
+        long wait = opts->delay - (long)(now - h->laststart);
+        if ((timeout < 0) || (wait < timeout)) timeout = wait;
+        p = &(it->next);
+        continue;
+      }
+      /* dequeue it */
+      *p = it->next;
+      if (c.queuetail == &(it->next)) c.queuetail = p;
+      it->next = NULL;
+      i = crawl_start(&c, it, ps);
+      if (i != 0) {
+        crawl_free(it);
+        if (i < 0) goto OOM;
+        c.failed++;
+        continue;
+      }
+      h->active++;
+      h->started = 1;
+      h->laststart = now;
+      slot[active++] = it;
+    }
+
+    /* nothing running, nothing left to start: all done */
+    if ((active == 0) && (c.queue == NULL)) break;
+    /* resources failed to start, have another look at the frontier */
+    if ((active == 0) && (timeout < 0)) continue;
+
+    for (i = 0; i < active; i++) {
+      long t = xfer_timeout(slot[i]->x);
+      if ((timeout < 0) || ((t >= 0) && (t < timeout))) timeout = t;
+    }
+    evcount = net_pollset_wait(ps, ev, DL_MAXPARALLEL, timeout);
+    for (; evcount > 0; evcount--) {
+      for (i = 0; i < active; i++) {
+        if (slot[i]->x == ev[evcount - 1].userdata) slot[i]->events |= ev[evcount - 1].events;
+      }
+    }
+    for (i = 0; i < active; i++) {
+      int state = xfer_step(slot[i]->x, slot[i]->events);
+      slot[i]->events = 0;
+      if ((state != XFER_DONE) && (state != XFER_FAIL)) continue;
+      c.host[slot[i]->hostid].active--;
+      if (crawl_done(&c, slot[i]) != 0) goto OOM;
+      crawl_free(slot[i]);
+      slot[i--] = slot[--active];
+    }
+  }
+
+  {
+    unsigned long hits, misses;
+    dnscache_stats(&hits, &misses);
+    printf("Done: %ld fetched, %ld failed (dns cache: %lu hits, %lu misses)\n", c.fetched, c.failed, hits, misses);
+  }
+  res = c.failed;
+  goto DONE;
+
+  OOM:
+  puts("Out of memory");
+  res = -1;
+
+  DONE:
+  for (i = 0; i < active; i++) crawl_free(slot[i]);
+  while (c.queue != NULL) {
+    struct crawl_item *it = c.queue;
+    c.queue = it->next;
+    crawl_free(it);
+  }
+  while (c.seensz > 0) free(c.seen[--c.seensz]);
+  free(c.seen);
+  free(c.host);
+  if (c.index != NULL) fclose(c.index);
+  net_pollset_free(ps);
+  return(res);
+}
@@ -0,0 +1,33 @@
+/*
+ * This file is part of the Gopherus project.
+ * Copyright (C) 2013-2022 Mateusz Viste
+ *
+ * Mirroring of gopher holes: starting from a url, menus are fetched and the
+ * links they contain followed, down to a given depth. Resources are stored
+ * in a directory tree (outdir/host/selector, menus being stored as the
+ * "gophermap" file of their own directory, the name of other files starting
+ * with '~') and listed in outdir/index.txt once complete. The index is what allows an interrupted mirror to resume:
+ * running it again skips whatever is listed there already.
+ */
+
+#ifndef crawl_h_sentinel
+#define crawl_h_sentinel
+
+/* parameters of a mirror */
+struct crawl_opts {
+  const char *outdir;   /* root of the mirror */
+  const char *hostglob; /* hosts links may lead to (* and ? wildcards), NULL
+                           stands for the host of the starting url only */
+  const char *selglob;  /* selectors that may be fetched, NULL for all */
+  int maxdepth;         /* menu levels followed from the starting url */
+  int parallel;         /* max amount of transfers running at once */
+  int perhost;          /* max amount of transfers to a single host */
+  long delay;           /* min time (ms) between two requests to a host */
+};
+
+/* mirrors url as configured by opts, reporting progress on stdout. returns
+ * the amount of resources that could not be fetched, or -1 if the mirror
+ * could not be done at all (the reason is printed). */
+long crawl_run(const char *url, const struct crawl_opts *opts);
+
+#endif
@@ -0,0 +1,291 @@
+/*
+ * This file is part of the Gopherus project.
+ * Copyright (C) 2013-2022 Mateusz Viste
+ */
+
+#include <ctype.h>   /* tolower() */
+#include <stdio.h>
+#include <stdlib.h>  /* malloc(), free() */
+#include <string.h>  /* memcmp(), strlen() */
+#include <time.h>    /* time() */
+
+#include "config.h"
+#include "fs/fs.h"
+#include "parseurl.h"
+
+#include "diskcache.h" /* include self for control */
+
+/* the index of the cache is an array of DISKCACHE_RECSZ records, each of
+ * them made of four little endian u32: hash of the url, size of the page
+ * file, time the page has been fetched, time it has been used last. records
+ * with size and fetch time at zero are free. the page file itself starts
+ * with the url of the page on a line of its own, its data follows. */
+#define DISKCACHE_RECSZ 16
+#define DISKCACHE_INDEX "index.dat"
+
+static char diskcache_dir[256];
+static long diskcache_max;
+static long diskcache_menuttl;
+static long diskcache_ttl;
+
+/* the index, loaded in memory while it is locked */
+struct diskcache_idx {
+  FILE *fd;
+  unsigned char *rec;
+  long count;
+};
+
+
+static unsigned long diskcache_get32(const unsigned char *b) {
+  return((unsigned long)b[0] | ((unsigned long)b[1] << 8) | ((unsigned long)b[2] << 16) | ((unsigned long)b[3] << 24));
+}
+
+
+static void diskcache_put32(unsigned char *b, unsigned long v) {
+  b[0] = v & 0xff;
+  b[1] = (v >> 8) & 0xff;
+  b[2] = (v >> 16) & 0xff;
+  b[3] = (v >> 24) & 0xff;
+}
+
+
+/* FNV-1a */
+static unsigned long diskcache_hash(const char *s) {
+  unsigned long h = 2166136261ul;
+  for (; *s != 0; s++) {
+    h ^= (unsigned char)*s;
+    h = (h * 16777619ul) & 0xfffffffful;
+  }
+  return(h);
+}
+
+
+void diskcache_setup(const char *dir, long maxbytes, long menuttl, long ttl) {
+  diskcache_max = 0;
+  if ((dir == NULL) || (strlen(dir) + 16 > sizeof(diskcache_dir))) return;
+  if ((maxbytes > 0) && (filemkdir(dir) != 0)) return;
+  strcpy(diskcache_dir, dir);
+  diskcache_max = maxbytes;
+  diskcache_menuttl = menuttl;
+  diskcache_ttl = ttl;
+}
+
+
+/* computes the url the page is keyed by. returns non-zero if the page is
+ * not to be cached. */
+static int diskcache_url(char *url, unsigned char protocol, const char *host, unsigned short port, char itemtype, const char *selector) {
+  char lhost[MAXHOSTLEN];
+  int i;
+  if ((diskcache_max <= 0) || (itemtype == '7') || (host[0] == '#')) return(-1);
+  if (strlen(host) >= sizeof(lhost)) return(-1);
+  for (i = 0; host[i] != 0; i++) lhost[i] = tolower((unsigned char)host[i]);
+  lhost[i] = 0;
+  i = buildgopherurl(url, MAXURLLEN, protocol, lhost, port, itemtype, selector);
+  if ((i < 0) || (i >= MAXURLLEN - 1)) return(-1);
+  return(0);
+}
+
+
+static void diskcache_fname(char *fname, unsigned long hash) {
+  sprintf(fname, "%s/%08lx.pgc", diskcache_dir, hash);
+}
+
+
+/* opens and locks the index, then loads it into idx. returns 0 on success */
+static int diskcache_lock(struct diskcache_idx *idx) {
+  char fname[sizeof(diskcache_dir) + 16];
+  long sz;
+
+  sprintf(fname, "%s/%s", diskcache_dir, DISKCACHE_INDEX);
+  idx->rec = NULL;
+  idx->count = 0;
+  idx->fd = fopen(fname, "r+b");
+  if (idx->fd == NULL) { /* create it, without truncating what another instance might have created meanwhile */
+    idx->fd = fopen(fname, "ab");
+    if (idx->fd != NULL) fclose(idx->fd);
+    idx->fd = fopen(fname, "r+b");
+    if (idx->fd == NULL) return(-1);
+  }
+  filelock(idx->fd);
+  if (fseek(idx->fd, 0, SEEK_END) != 0) goto FAIL;
+  sz = ftell(idx->fd);
+  idx->count = sz / DISKCACHE_RECSZ;
+  if (idx->count == 0) return(0);
+  idx->rec = malloc(idx->count * DISKCACHE_RECSZ);
+  if (idx->rec == NULL) goto FAIL;
+  rewind(idx->fd);
+  if (fread(idx->rec, DISKCACHE_RECSZ, idx->count, idx->fd) != (size_t)(idx->count)) goto FAIL;
+  return(0);
+
+  FAIL:
+  fileunlock(idx->fd);
+  fclose(idx->fd);
+  free(idx->rec);
+  return(-1);
+}
+
+
+static void diskcache_unlock(struct diskcache_idx *idx) {
+  fflush(idx->fd);
+  fileunlock(idx->fd);
+  fclose(idx->fd);
+  free(idx->rec);
+}
+
+
+/* writes record i of idx to disk */
+static void diskcache_writerec(struct diskcache_idx *idx, long i) {
+  if (fseek(idx->fd, i * DISKCACHE_RECSZ, SEEK_SET) != 0) return;
+  fwrite(idx->rec + i * DISKCACHE_RECSZ, DISKCACHE_RECSZ, 1, idx->fd);
+}
+
+
+/* drops record i of idx, along with its page file */
+static void diskcache_drop(struct diskcache_idx *idx, long i) {
+  char fname[sizeof(diskcache_dir) + 16];
+  diskcache_fname(fname, diskcache_get32(idx->rec + i * DISKCACHE_RECSZ));
+  remove(fname);
+  memset(idx->rec + i * DISKCACHE_RECSZ, 0, DISKCACHE_RECSZ);
+  diskcache_writerec(idx, i);
+}
+
+
+static int diskcache_isfree(const unsigned char *rec) {
+  return((diskcache_get32(rec + 4) == 0) && (diskcache_get32(rec + 8) == 0));
+}
+
+
+/* returns the record of idx that holds hash, or -1 if none */
+static long diskcache_find(const struct diskcache_idx *idx, unsigned long hash) {
+  long i;
+  for (i = 0; i < idx->count; i++) {
+    const unsigned char *r = idx->rec + i * DISKCACHE_RECSZ;
+    if ((diskcache_isfree(r) == 0) && (diskcache_get32(r) == hash)) return(i);
+  }
+  return(-1);
+}
+
+
+long diskcache_get(unsigned char protocol, const char *host, unsigned short port, char itemtype, const char *selector, char *buff, long buffsz) {
+  struct diskcache_idx idx;
+  char url[MAXURLLEN], fname[sizeof(diskcache_dir) + 16];
+  unsigned char *r;
+  unsigned long hash, now = (unsigned long)time(NULL);
+  long i, sz, urllen, res = -1;
+  FILE *fd;
+
+  if (diskcache_url(url, protocol, host, port, itemtype, selector) != 0) return(-1);
+  hash = diskcache_hash(url);
+  urllen = strlen(url);
+  if (diskcache_lock(&idx) != 0) return(-1);
+  i = diskcache_find(&idx, hash);
+  if (i < 0) goto DONE;
+  r = idx.rec + i * DISKCACHE_RECSZ;
+  sz = diskcache_get32(r + 4);
+  if (now - diskcache_get32(r + 8) >= (unsigned long)((itemtype == '1') ? diskcache_menuttl : diskcache_ttl)) goto DONE;
+  if ((sz <= urllen) || (sz - urllen - 1 > buffsz)) goto DONE;
+
+  diskcache_fname(fname, hash);
+  fd = fopen(fname, "rb");
+  if ((fd != NULL) && ((fseek(fd, 0, SEEK_END) != 0) || (ftell(fd) != sz))) {
+    fclose(fd);
+    fd = NULL;
+  }
+  if (fd == NULL) { /* removed (or altered) behind our back */
+    diskcache_drop(&idx, i);
+    goto DONE;
+  }
+  rewind(fd);
+  {
+    const char *map = filemap(fd, sz);
+    if (map != NULL) {
+      /* the page must be of the same url (and not another one of same hash) */
+      if ((memcmp(map, url, urllen) == 0) && (map[urllen] == '\n')) {
+        res = sz - urllen - 1;
+        memcpy(buff, map + urllen + 1, res);
+      }
+      fileunmap(map, sz);
+    } else if ((urllen + 1 <= buffsz) && (fread(buff, 1, urllen + 1, fd) == (size_t)urllen + 1)) { /* buff is big enough to hold the url line first */
+      if ((memcmp(buff, url, urllen) == 0) && (buff[urllen] == '\n')) {
+        res = sz - urllen - 1;
+        if (fread(buff, 1, res, fd) != (size_t)res) res = -1;
+      }
+    }
+  }
+  fclose(fd);
+
+  /* remember it has been used now */
+  if (res >= 0) {
+    diskcache_put32(r + 12, now);
+    diskcache_writerec(&idx, i);
+  }
+
+  DONE:
+  diskcache_unlock(&idx);
+  return(res);
+}
+
+
+void diskcache_put(unsigned char protocol, const char *host, unsigned short port, char itemtype, const char *selector, const char *data, long len) {
+  struct diskcache_idx idx;
+  char url[MAXURLLEN], fname[sizeof(diskcache_dir) + 16];
+  unsigned char *r;
+  unsigned long hash, now = (unsigned long)time(NULL), total = 0;
+  long i, sz;
+  FILE *fd;
+  int err;
+
+  if (diskcache_url(url, protocol, host, port, itemtype, selector) != 0) return;
+  hash = diskcache_hash(url);
+  sz = strlen(url) + 1 + len;
+  if (sz > diskcache_max) return;
+  if (diskcache_lock(&idx) != 0) return;
+
+  /* take the record of the earlier copy if there is one, otherwise the
+   * first free one (or a new one) */
+  i = diskcache_find(&idx, hash);
+  if (i < 0) {
+    for (i = 0; (i < idx.count) && (diskcache_isfree(idx.rec + i * DISKCACHE_RECSZ) == 0); i++);
+    if (i == idx.count) {
+      r = realloc(idx.rec, (idx.count + 1) * DISKCACHE_RECSZ);
+      if (r == NULL) goto DONE;
+      idx.rec = r;
+      memset(idx.rec + i * DISKCACHE_RECSZ, 0, DISKCACHE_RECSZ);
+      idx.count++;
+    }
+  }
+  r = idx.rec + i * DISKCACHE_RECSZ;
+
+  diskcache_fname(fname, hash);
+  fd = fopen(fname, "wb");
+  if (fd == NULL) goto DONE;
+  err = (fprintf(fd, "%s\n", url) < 0);
+  if ((len > 0) && (fwrite(data, 1, len, fd) != (size_t)len)) err = 1;
+  if (fclose(fd) != 0) err = 1;
+  if (err) { /* disk full? */
+    diskcache_drop(&idx, i);
+    goto DONE;
+  }
+  diskcache_put32(r, hash);
+  diskcache_put32(r + 4, sz);
+  diskcache_put32(r + 8, now);
+  diskcache_put32(r + 12, now);
+  diskcache_writerec(&idx, i);
+
+  /* evict the least recently used pages until the cache fits its size */
+  for (i = 0; i < idx.count; i++) total += diskcache_get32(idx.rec + i * DISKCACHE_RECSZ + 4);
+  while (total > (unsigned long)diskcache_max) {
+    long oldest = -1;
+    for (i = 0; i < idx.count; i++) {
+      const unsigned char *o = idx.rec + i * DISKCACHE_RECSZ;
+      if ((diskcache_isfree(o)) || (o == r)) continue;
+      if ((oldest < 0) || (diskcache_get32(o + 12) < diskcache_get32(idx.rec + oldest * DISKCACHE_RECSZ + 12))) oldest = i;
+    }
+    if (oldest < 0) break;
+    total -= diskcache_get32(idx.rec + oldest * DISKCACHE_RECSZ + 4);
+    diskcache_drop(&idx, oldest);
+  }
+
+  DONE:
+  diskcache_unlock(&idx);
+}
@@ -0,0 +1,30 @@
+/*
+ * This file is part of the Gopherus project.
+ * Copyright (C) 2013-2022 Mateusz Viste
+ *
+ * Disk cache of pages: menus, text and html pages are kept on disk (one
+ * file per page) so they survive a restart. Pages are keyed by their url,
+ * stay fresh for a time that depends on their item type, and the least
+ * recently used ones are evicted once the cache outgrows its size. The
+ * cache may be shared by many Gopherus instances, every operation being
+ * done under a lock on the index file.
+ */
+
+#ifndef diskcache_h_sentinel
+#define diskcache_h_sentinel
+
+/* sets up the cache in directory dir (created if needed). maxbytes is the
+ * size of the cache (0 disables it), menus stay fresh for menuttl seconds
+ * and other pages for ttl seconds. */
+void diskcache_setup(const char *dir, long maxbytes, long menuttl, long ttl);
+
+/* copies a fresh copy of a page into buff (up to buffsz bytes). returns the
+ * length of the page, or -1 if the cache has no fresh copy of it that fits
+ * in buff. */
+long diskcache_get(unsigned char protocol, const char *host, unsigned short port, char itemtype, const char *selector, char *buff, long buffsz);
+
+/* stores page data of len bytes into the cache. query results (type 7) and
+ * the internal pages of Gopherus are never stored. */
+void diskcache_put(unsigned char protocol, const char *host, unsigned short port, char itemtype, const char *selector, const char *data, long len);
+
+#endif
@@ -1,56 +1,311 @@
 /*
  * This file is part of the Gopherus project.
  * Copyright (C) 2013-2020 Mateusz Viste
+ *
+ * Entries live in a hash table (for lookups) and in a doubly-linked list
+ * ordered from most to least recently used (for eviction).
  */
 
+#include <ctype.h>   /* tolower() */
+#include <stdio.h>   /* fopen(), fgets(), fprintf() */
+#include <stdlib.h>  /* malloc(), calloc(), free(), strtoul() */
 #include <time.h>
 #include <string.h>
 #include <strings.h> /* strcasecmp() */
 
 #include "config.h"
+#include "fs/fs.h"
 #include "dnscache.h"
 
+/* upper limit of hash buckets, the table does not grow past this */
+#define DNSCACHE_MAXBUCKETS 4096u
+
+/* first line of the cache file, bump the version when the format changes */
+#define DNSCACHE_FILESIG "GOPHERUS-DNSCACHE 1"
 
 struct dnscache_t {
-  char host[DNS_MAXHOSTLEN + 1];
-  char addr[64];
-  time_t inserttime;
+  struct dnscache_t *hnext;  /* next entry in the same bucket */
+  struct dnscache_t *newer;  /* LRU list neighbours */
+  struct dnscache_t *older;
+  time_t expires;
+  int addrcount;             /* 0 for negative entries */
+  char (*addr)[NET_ADDRSTRLEN]; /* addresses, stored right after the struct */
+  char *host;                /* hostname, stored after the addresses */
 };
 
-static struct dnscache_t dnscache_table[DNS_MAXENTRIES];
+static struct dnscache_t **dnscache_bucket;
+static unsigned int dnscache_bucketcount;
+static struct dnscache_t *dnscache_newest;
+static struct dnscache_t *dnscache_oldest;
+static unsigned int dnscache_count;
+static unsigned int dnscache_capacity = DNS_MAXENTRIES;
+static long dnscache_ttl = DNS_CACHETIME;
+static unsigned long dnscache_hits, dnscache_misses;
+static unsigned char dnscache_dirty; /* changed since loaded from disk */
+
+
+/* case-insensitive FNV-1a hash */
+static unsigned int dnscache_hash(const char *host) {
+  unsigned long h = 2166136261ul;
+  for (; *host != 0; host++) {
+    h ^= (unsigned char)tolower((unsigned char)*host);
+    h *= 16777619ul;
+  }
+  return((unsigned int)(h & (dnscache_bucketcount - 1)));
+}
 
 
-/* fills ipaddr with cached IP for host, returns 0 on success */
-int dnscache_ask(char *ipaddr, const char *host) {
-  int x;
-  time_t oldlimit = time(NULL) - DNS_CACHETIME;
-  for (x = 0; x < DNS_MAXENTRIES; x++) {
-    if (dnscache_table[x].inserttime < oldlimit) continue; /* expired entry */
-    if (strcasecmp(host, dnscache_table[x].host) == 0) {
-      strcpy(ipaddr, dnscache_table[x].addr);
-      return(0);
+/* (re)allocates the bucket array so it matches the cache capacity */
+static int dnscache_resize(void) {
+  struct dnscache_t **newbucket, *e;
+  unsigned int newcount = 16;
+
+  while ((newcount < dnscache_capacity) && (newcount < DNSCACHE_MAXBUCKETS)) newcount <<= 1;
+  if (newcount == dnscache_bucketcount) return(0);
+  newbucket = calloc(newcount, sizeof(struct dnscache_t *));
+  if (newbucket == NULL) return((dnscache_bucket == NULL) ? -1 : 0); /* keep the old one */
+
+  free(dnscache_bucket);
+  dnscache_bucket = newbucket;
+  dnscache_bucketcount = newcount;
+  for (e = dnscache_newest; e != NULL; e = e->older) {
+    unsigned int h = dnscache_hash(e->host);
+    e->hnext = dnscache_bucket[h];
+    dnscache_bucket[h] = e;
+  }
+  return(0);
+}
+
+
+/* unlinks entry e from the table and from the LRU list, then frees it */
+static void dnscache_remove(struct dnscache_t *e) {
+  struct dnscache_t **p;
+  for (p = &(dnscache_bucket[dnscache_hash(e->host)]); *p != e; p = &((*p)->hnext));
+  *p = e->hnext;
+  if (e->newer != NULL) {
+    e->newer->older = e->older;
+  } else {
+    dnscache_newest = e->older;
+  }
+  if (e->older != NULL) {
+    e->older->newer = e->newer;
+  } else {
+    dnscache_oldest = e->newer;
+  }
+  dnscache_count--;
+  free(e);
+}
+
+
+/* puts entry e at the head of the LRU list (e must not be on it) */
+static void dnscache_pushnewest(struct dnscache_t *e) {
+  e->older = dnscache_newest;
+  e->newer = NULL;
+  if (dnscache_newest != NULL) dnscache_newest->newer = e;
+  dnscache_newest = e;
+  if (dnscache_oldest == NULL) dnscache_oldest = e;
+}
+
+
+/* returns the entry of host, or NULL if not found (or expired) */
+static struct dnscache_t *dnscache_find(const char *host) {
+  struct dnscache_t *e;
+  if (dnscache_bucket == NULL) return(NULL);
+  for (e = dnscache_bucket[dnscache_hash(host)]; e != NULL; e = e->hnext) {
+    if (strcasecmp(host, e->host) == 0) break;
+  }
+  if (e == NULL) return(NULL);
+  if (e->expires < time(NULL)) {
+    dnscache_remove(e);
+    return(NULL);
+  }
+  return(e);
+}
+
+
+void dnscache_setcapacity(unsigned int capacity) {
+  if (capacity < 1) capacity = 1;
+  dnscache_capacity = capacity;
+  while (dnscache_count > dnscache_capacity) dnscache_remove(dnscache_oldest);
+  if (dnscache_bucket != NULL) dnscache_resize();
+}
+
+
+void dnscache_setttl(long ttl) {
+  dnscache_ttl = ttl;
+}
+
+
+/* fills addr with cached addresses of host, returns their amount */
+int dnscache_ask(char addr[][NET_ADDRSTRLEN], int maxaddr, const char *host) {
+  struct dnscache_t *e;
+  int i;
+  e = dnscache_find(host);
+  if (addr == NULL) {
+    if (e == NULL) return(0);
+    return((e->addrcount == 0) ? -1 : e->addrcount);
+  }
+  if (e == NULL) {
+    dnscache_misses++;
+    return(0);
+  }
+  dnscache_hits++;
+  /* move it to the head of the LRU list */
+  if (e != dnscache_newest) {
+    e->newer->older = e->older;
+    if (e->older != NULL) {
+      e->older->newer = e->newer;
+    } else {
+      dnscache_oldest = e->newer;
     }
+    dnscache_pushnewest(e);
+  }
+  if (e->addrcount == 0) return(-1);
+  for (i = 0; (i < e->addrcount) && (i < maxaddr); i++) {
+    strcpy(addr[i], e->addr[i]);
   }
-  return(-1);
+  return(i);
+}
+
+
+/* inserts a new entry that expires at the given time */
+static void dnscache_insert(const char *host, char addr[][NET_ADDRSTRLEN], int addrcount, time_t expires) {
+  struct dnscache_t *e;
+  unsigned int h;
+  int i;
+
+  if (addrcount < 0) return;
+  if (addrcount > DNS_MAXADDR) addrcount = DNS_MAXADDR;
+  if ((dnscache_bucket == NULL) && (dnscache_resize() != 0)) return;
+
+  /* drop the previous entry of this host, if any */
+  e = dnscache_find(host);
+  if (e != NULL) dnscache_remove(e);
+
+  /* evict least recently used entries to make room */
+  while (dnscache_count >= dnscache_capacity) dnscache_remove(dnscache_oldest);
+
+  e = malloc(sizeof(struct dnscache_t) + addrcount * NET_ADDRSTRLEN + strlen(host) + 1);
+  if (e == NULL) return;
+  e->addr = (void *)(e + 1);
+  e->host = (char *)(e + 1) + addrcount * NET_ADDRSTRLEN;
+  strcpy(e->host, host);
+  for (i = 0; i < addrcount; i++) strcpy(e->addr[i], addr[i]);
+  e->addrcount = addrcount;
+  e->expires = expires;
+
+  h = dnscache_hash(host);
+  e->hnext = dnscache_bucket[h];
+  dnscache_bucket[h] = e;
+  dnscache_pushnewest(e);
+  dnscache_count++;
+  dnscache_dirty = 1;
 }
 
 
 /* adds a new entry to the DNS cache */
-void dnscache_add(const char *host, const char *ipaddr) {
-  int x, oldest = 0;
-  if (strlen(host) > DNS_MAXHOSTLEN) return; /* if host len too long, abort */
-  /* find the best slot for storing the new entry (either oldest slot or the one for same entry)*/
-  for (x = 0; x < DNS_MAXENTRIES; x++) {
-    if (dnscache_table[x].inserttime < dnscache_table[oldest].inserttime) oldest = x; /* remember the oldest entry */
-    if (dnscache_table[x].inserttime > 0) { /* check if it's an already known host */
-      if (strcasecmp(dnscache_table[x].host, host) == 0) {
-        oldest = x;
-        break;
-      }
+void dnscache_add(const char *host, char addr[][NET_ADDRSTRLEN], int addrcount) {
+  dnscache_insert(host, addr, addrcount, time(NULL) + ((addrcount == 0) ? DNS_NEGCACHE : dnscache_ttl));
+}
+
+
+void dnscache_del(const char *host) {
+  struct dnscache_t *e;
+  e = dnscache_find(host);
+  if (e == NULL) return;
+  dnscache_remove(e);
+  dnscache_dirty = 1;
+}
+
+
+/* moves addr to the front of host's address list */
+void dnscache_setwinner(const char *host, const char *addr) {
+  char tmp[NET_ADDRSTRLEN];
+  struct dnscache_t *e;
+  int i;
+  e = dnscache_find(host);
+  if (e == NULL) return;
+  for (i = 0; i < e->addrcount; i++) {
+    if (strcmp(e->addr[i], addr) == 0) break;
+  }
+  if ((i == 0) || (i == e->addrcount)) return; /* first already, or unknown */
+  strcpy(tmp, e->addr[i]);
+  for (; i > 0; i--) strcpy(e->addr[i], e->addr[i - 1]);
+  strcpy(e->addr[0], tmp);
+  dnscache_dirty = 1;
+}
+
+
+void dnscache_stats(unsigned long *hits, unsigned long *misses) {
+  *hits = dnscache_hits;
+  *misses = dnscache_misses;
+}
+
+
+/* the cache file is a text file with one line per host, from the least to
+ * the most recently used one: "expiration_time hostname [addr...]". a line
+ * without any address is a negative entry. */
+void dnscache_load(const char *fname) {
+  char line[512];
+  char addr[DNS_MAXADDR][NET_ADDRSTRLEN];
+  time_t now = time(NULL);
+  FILE *fd;
+
+  fd = fopen(fname, "rb");
+  if (fd == NULL) return;
+  if ((fgets(line, sizeof(line), fd) == NULL) || (strncmp(line, DNSCACHE_FILESIG, strlen(DNSCACHE_FILESIG)) != 0)) {
+    fclose(fd);
+    return;
+  }
+
+  while (fgets(line, sizeof(line), fd) != NULL) {
+    char *host, *tok, *end;
+    int addrcount = 0;
+    time_t expires;
+    if (strchr(line, '\n') == NULL) break; /* overlong or truncated line */
+    expires = (time_t)strtoul(line, &end, 10);
+    if ((end == line) || (expires < now)) continue;
+    host = strtok(end, " \r\n");
+    if (host == NULL) continue;
+    while ((tok = strtok(NULL, " \r\n")) != NULL) {
+      if ((addrcount == DNS_MAXADDR) || (strlen(tok) >= NET_ADDRSTRLEN)) continue;
+      strcpy(addr[addrcount++], tok);
     }
+    dnscache_insert(host, addr, addrcount, expires);
+  }
+
+  fclose(fd);
+  dnscache_dirty = 0;
+}
+
+
+int dnscache_save(const char *fname) {
+  char tmpname[256];
+  struct dnscache_t *e;
+  time_t now = time(NULL);
+  FILE *fd;
+  int i, err;
+
+  if (dnscache_dirty == 0) return(0); /* nothing new */
+
+  /* write everything to a temporary file first, then move it over the real
+   * one so a crash never leaves a half-written cache behind. the temp file is
+   * private to this process, another instance may be saving too */
+  if (filetmpname(tmpname, sizeof(tmpname), fname) == NULL) return(-1);
+  fd = fopen(tmpname, "wb");
+  if (fd == NULL) return(-1);
+  err = (fprintf(fd, "%s\n", DNSCACHE_FILESIG) < 0);
+  for (e = dnscache_oldest; (e != NULL) && (err == 0); e = e->newer) {
+    if (e->expires < now) continue;
+    err |= (fprintf(fd, "%lu %s", (unsigned long)e->expires, e->host) < 0);
+    for (i = 0; i < e->addrcount; i++) err |= (fprintf(fd, " %s", e->addr[i]) < 0);
+    err |= (fputc('\n', fd) == EOF);
+  }
+  err |= (fclose(fd) != 0);
+  if ((err != 0) || (filereplace(tmpname, fname) != 0)) {
+    remove(tmpname);
+    return(-1);
   }
-  /* replace the chosen slot with new entry */
-  dnscache_table[oldest].inserttime = time(NULL);
-  strcpy(dnscache_table[oldest].host, host);
-  strcpy(dnscache_table[oldest].addr, ipaddr);
+  dnscache_dirty = 0;
+  return(0);
 }
@@ -7,10 +7,44 @@
 #ifndef dnscache_h_sentinel
 #define dnscache_h_sentinel
 
-/* fills ipaddr with cached IP for host, returns 0 on success */
-int dnscache_ask(char *ipaddr, const char *host);
+#include "net/net.h" /* NET_ADDRSTRLEN */
 
-/* adds a new entry to the DNS cache */
-void dnscache_add(const char *host, const char *ipaddr);
+/* sets the max amount of hosts kept in cache (DNS_MAXENTRIES by default).
+ * least recently used entries are dropped if the cache is too big already */
+void dnscache_setcapacity(unsigned int capacity);
+
+/* sets how long (seconds) the addresses of a host are kept in cache once
+ * resolved (DNS_CACHETIME by default) */
+void dnscache_setttl(long ttl);
+
+/* fills addr with up to maxaddr cached addresses of host and returns their
+ * amount. returns 0 if host is not in cache, or -1 if host is known not to
+ * exist. addr may be NULL if the caller only wishes to know whether or not
+ * host is cached (such calls are not accounted in the statistics). */
+int dnscache_ask(char addr[][NET_ADDRSTRLEN], int maxaddr, const char *host);
+
+/* adds a new entry to the DNS cache, replacing any previous entry of host.
+ * an addrcount of 0 stores a negative entry (host does not exist). */
+void dnscache_add(const char *host, char addr[][NET_ADDRSTRLEN], int addrcount);
+
+/* forgets everything about host */
+void dnscache_del(const char *host);
+
+/* remembers that host has been successfully reached at addr, so this
+ * address (and its family) is tried first the next time */
+void dnscache_setwinner(const char *host, const char *addr);
+
+/* loads entries saved by a previous session from file fname, skipping
+ * those that expired in the meantime */
+void dnscache_load(const char *fname);
+
+/* writes all unexpired entries to file fname (only if something changed
+ * since the cache was loaded). the file is replaced atomically. returns 0
+ * on success, non-zero otherwise. */
+int dnscache_save(const char *fname);
+
+/* reports how many dnscache_ask() lookups were answered from cache (hits)
+ * or not (misses) so far */
+void dnscache_stats(unsigned long *hits, unsigned long *misses);
 
 #endif
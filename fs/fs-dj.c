@@ -3,8 +3,12 @@
  * Copyright (C) 2019-2022 Mateusz Viste
  */
 
+#include <fcntl.h>  /* O_BINARY */
+#include <io.h>     /* setmode() */
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h> /* memcpy(), strlen() */
+#include <sys/stat.h> /* mkdir(), stat() */
 #include <unistd.h> /* truncate() */
 
 #include "fs.h"
@@ -23,6 +27,81 @@ char *config_getfname(char *s, size_t ssz) {
 }
 
 
+/* returns path and filename of the DNS cache file */
+char *dnscache_getfname(char *s, size_t ssz) {
+  snprintf(s, ssz, "%s\\gopherus.dns", getenv("TEMP"));
+  return(s);
+}
+
+
+char *diskcache_getdir(char *s, size_t ssz) {
+  snprintf(s, ssz, "%s\\gophcach", getenv("TEMP"));
+  return(s);
+}
+
+
 void filetrunc(const char *fname, long sz) {
   truncate(fname, sz);
 }
+
+
+/* DOS rename() fails if the destination exists already */
+/* DOS runs a single program at a time, the temporary name only has to
+ * differ from fname: its last character is replaced by a '~' (8+3 safe) */
+char *filetmpname(char *s, size_t ssz, const char *fname) {
+  size_t len = strlen(fname);
+  if ((len == 0) || (len >= ssz)) return(NULL);
+  memcpy(s, fname, len + 1);
+  s[len - 1] = '~';
+  return(s);
+}
+
+
+int filereplace(const char *src, const char *dst) {
+  remove(dst);
+  return(rename(src, dst));
+}
+
+
+void fileprealloc(FILE *fd, long sz) {
+  (void)fd;
+  (void)sz;
+}
+
+
+void filebinstdout(void) {
+  setmode(fileno(stdout), O_BINARY);
+}
+
+
+int filemkdir(const char *path) {
+  struct stat st;
+  if (mkdir(path, 0777) == 0) return(0);
+  if ((stat(path, &st) == 0) && S_ISDIR(st.st_mode)) return(0);
+  return(-1);
+}
+
+
+/* DJGPP has no memory-mapped files */
+const void *filemap(FILE *fd, long sz) {
+  (void)fd;
+  (void)sz;
+  return(NULL);
+}
+
+
+void fileunmap(const void *p, long sz) {
+  (void)p;
+  (void)sz;
+}
+
+
+/* DOS runs a single program at a time */
+void filelock(FILE *fd) {
+  (void)fd;
+}
+
+
+void fileunlock(FILE *fd) {
+  (void)fd;
+}
@@ -6,10 +6,13 @@
  * http://mdr.osdn.io
  */
 
-#include <fcntl.h>
+#include <direct.h> /* mkdir() */
+#include <fcntl.h>  /* O_BINARY */
 #include <i86.h>
-#include <io.h>     /* _chsize() */
+#include <io.h>     /* _chsize(), setmode() */
+#include <stdio.h>  /* remove(), rename() */
 #include <string.h>
+#include <sys/stat.h> /* stat() */
 
 #include "fs.h"
 
@@ -102,6 +105,24 @@ char *config_getfname(char *s, size_t ssz) {
 }
 
 
+char *dnscache_getfname(char *s, size_t ssz) {
+  unsigned char plen;
+  if (ssz < 128 + 13) return(NULL);
+  plen = mdr_dos_exepath(s);
+  memcpy(s + plen, "GOPHERUS.DNS", 13);
+  return(s);
+}
+
+
+char *diskcache_getdir(char *s, size_t ssz) {
+  unsigned char plen;
+  if (ssz < 128 + 6) return(NULL);
+  plen = mdr_dos_exepath(s);
+  memcpy(s + plen, "CACHE", 6);
+  return(s);
+}
+
+
 void filetrunc(const char *fname, long sz) {
   int handle;
   handle = open(fname, O_RDWR | O_BINARY);
@@ -109,3 +130,65 @@ void filetrunc(const char *fname, long sz) {
   _chsize(handle, sz);
   close(handle);
 }
+
+
+/* DOS rename() fails if the destination exists already */
+/* DOS runs a single program at a time, the temporary name only has to
+ * differ from fname: its last character is replaced by a '~' (8+3 safe) */
+char *filetmpname(char *s, size_t ssz, const char *fname) {
+  size_t len = strlen(fname);
+  if ((len == 0) || (len >= ssz)) return(NULL);
+  memcpy(s, fname, len + 1);
+  s[len - 1] = '~';
+  return(s);
+}
+
+
+int filereplace(const char *src, const char *dst) {
+  remove(dst);
+  return(rename(src, dst));
+}
+
+
+void fileprealloc(FILE *fd, long sz) {
+  (void)fd;
+  (void)sz;
+}
+
+
+void filebinstdout(void) {
+  setmode(fileno(stdout), O_BINARY);
+}
+
+
+int filemkdir(const char *path) {
+  struct stat st;
+  if (mkdir(path) == 0) return(0);
+  if ((stat(path, &st) == 0) && S_ISDIR(st.st_mode)) return(0);
+  return(-1);
+}
+
+
+/* real mode DOS has no memory-mapped files */
+const void *filemap(FILE *fd, long sz) {
+  (void)fd;
+  (void)sz;
+  return(NULL);
+}
+
+
+void fileunmap(const void *p, long sz) {
+  (void)p;
+  (void)sz;
+}
+
+
+/* DOS runs a single program at a time */
+void filelock(FILE *fd) {
+  (void)fd;
+}
+
+
+void fileunlock(FILE *fd) {
+  (void)fd;
+}
@@ -3,9 +3,17 @@
  * Copyright (C) 2019-2022 Mateusz Viste
  */
 
+#ifdef __linux__
+  #define _GNU_SOURCE /* fallocate() */
+  #include <fcntl.h>
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
-#include <unistd.h> /* truncate() */
+#include <sys/file.h> /* flock() */
+#include <sys/mman.h> /* mmap() */
+#include <sys/stat.h> /* mkdir(), stat() */
+#include <unistd.h> /* truncate(), getpid() */
 
 #include "fs.h"
 
@@ -23,6 +31,79 @@ char *config_getfname(char *s, size_t ssz) {
 }
 
 
+/* returns path and filename of the DNS cache file */
+char *dnscache_getfname(char *s, size_t ssz) {
+  snprintf(s, ssz, "%s/.gopherus.dns", getenv("HOME"));
+  return(s);
+}
+
+
+/* returns the directory of the disk cache */
+char *diskcache_getdir(char *s, size_t ssz) {
+  snprintf(s, ssz, "%s/.gopherus.cache", getenv("HOME"));
+  return(s);
+}
+
+
 void filetrunc(const char *fname, long sz) {
   truncate(fname, sz);
 }
+
+
+char *filetmpname(char *s, size_t ssz, const char *fname) {
+  int len = snprintf(s, ssz, "%s.%lu~", fname, (unsigned long)getpid());
+  if ((len < 0) || ((size_t)len >= ssz)) return(NULL);
+  return(s);
+}
+
+
+int filereplace(const char *src, const char *dst) {
+  return(rename(src, dst));
+}
+
+
+void fileprealloc(FILE *fd, long sz) {
+#ifdef __linux__
+  /* KEEP_SIZE: the file must not look complete before it really is */
+  fallocate(fileno(fd), FALLOC_FL_KEEP_SIZE, 0, sz);
+#else
+  (void)fd;
+  (void)sz;
+#endif
+}
+
+
+void filebinstdout(void) {
+}
+
+
+int filemkdir(const char *path) {
+  struct stat st;
+  if (mkdir(path, 0777) == 0) return(0);
+  if ((stat(path, &st) == 0) && S_ISDIR(st.st_mode)) return(0);
+  return(-1);
+}
+
+
+const void *filemap(FILE *fd, long sz) {
+  void *p;
+  if (sz <= 0) return(NULL);
+  p = mmap(NULL, sz, PROT_READ, MAP_PRIVATE, fileno(fd), 0);
+  if (p == MAP_FAILED) return(NULL);
+  return(p);
+}
+
+
+void fileunmap(const void *p, long sz) {
+  munmap((void *)p, sz);
+}
+
+
+void filelock(FILE *fd) {
+  flock(fileno(fd), LOCK_EX);
+}
+
+
+void fileunlock(FILE *fd) {
+  flock(fileno(fd), LOCK_UN);
+}
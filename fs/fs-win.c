@@ -3,8 +3,11 @@
  * Copyright (C) 2019-2022 Mateusz Viste
  */
 
+#include <fcntl.h>  /* _O_BINARY */
+#include <io.h>     /* _setmode(), _get_osfhandle() */
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h> /* memset() */
 #include <windows.h>
 
 #include "fs.h"
@@ -26,6 +29,22 @@ char *config_getfname(char *s, size_t ssz) {
 }
 
 
+char *dnscache_getfname(char *s, size_t ssz) {
+  snprintf(s, ssz, "%s/Gopherus", getenv("APPDATA"));
+  CreateDirectory(s, NULL);
+  snprintf(s, ssz, "%s/Gopherus/gopherus.dns", getenv("APPDATA"));
+  return(s);
+}
+
+
+char *diskcache_getdir(char *s, size_t ssz) {
+  snprintf(s, ssz, "%s/Gopherus", getenv("APPDATA"));
+  CreateDirectory(s, NULL);
+  snprintf(s, ssz, "%s/Gopherus/cache", getenv("APPDATA"));
+  return(s);
+}
+
+
 void filetrunc(const char *fname, long sz) {
   HANDLE fh;
   fh = CreateFileA(fname, GENERIC_WRITE, 0, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
@@ -34,3 +53,72 @@ void filetrunc(const char *fname, long sz) {
   SetEndOfFile(fh);
   CloseHandle(fh);
 }
+
+
+char *filetmpname(char *s, size_t ssz, const char *fname) {
+  int len = snprintf(s, ssz, "%s.%lu~", fname, (unsigned long)GetCurrentProcessId());
+  if ((len < 0) || ((size_t)len >= ssz)) return(NULL);
+  return(s);
+}
+
+
+int filereplace(const char *src, const char *dst) {
+  if (MoveFileExA(src, dst, MOVEFILE_REPLACE_EXISTING) == 0) return(-1);
+  return(0);
+}
+
+
+void fileprealloc(FILE *fd, long sz) {
+  (void)fd;
+  (void)sz;
+}
+
+
+void filebinstdout(void) {
+  _setmode(_fileno(stdout), _O_BINARY);
+}
+
+
+int filemkdir(const char *path) {
+  DWORD attr;
+  if (CreateDirectoryA(path, NULL) != 0) return(0);
+  attr = GetFileAttributesA(path);
+  if ((attr != INVALID_FILE_ATTRIBUTES) && (attr & FILE_ATTRIBUTE_DIRECTORY)) return(0);
+  return(-1);
+}
+
+
+const void *filemap(FILE *fd, long sz) {
+  HANDLE h;
+  const void *p;
+  if (sz <= 0) return(NULL);
+  h = CreateFileMappingA((HANDLE)_get_osfhandle(_fileno(fd)), NULL, PAGE_READONLY, 0, sz, NULL);
+  if (h == NULL) return(NULL);
+  p = MapViewOfFile(h, FILE_MAP_READ, 0, 0, sz);
+  CloseHandle(h); /* the view keeps the mapping alive */
+  return(p);
+}
+
+
+void fileunmap(const void *p, long sz) {
+  (void)sz;
+  UnmapViewOfFile(p);
+}
+
+
+/* the locked byte lies far past the end of the file: Windows locks are
+ * mandatory, locking actual data would prevent others from reading it */
+void filelock(FILE *fd) {
+  OVERLAPPED ov;
+  memset(&ov, 0, sizeof(ov));
+  ov.Offset = 0x7fffffff;
+  LockFileEx((HANDLE)_get_osfhandle(_fileno(fd)), LOCKFILE_EXCLUSIVE_LOCK, 0, 1, 0, &ov);
+}
+
+
+void fileunlock(FILE *fd) {
+  OVERLAPPED ov;
+  memset(&ov, 0, sizeof(ov));
+  ov.Offset = 0x7fffffff;
+  UnlockFileEx((HANDLE)_get_osfhandle(_fileno(fd)), 0, 1, 0, &ov);
+}
@@ -6,13 +6,56 @@
 #ifndef gophfs_h
 #define gophfs_h
 
+#include <stdio.h> /* FILE, size_t */
+
 /* fills s with path and filename of the bookmark file, returns s on success, NULL on error */
 char *bookmarks_getfname(char *s, size_t ssz);
 
 /* fills s with path and filename of the config file, returns s on success, NULL on error */
 char *config_getfname(char *s, size_t ssz);
 
+/* fills s with path and filename of the DNS cache file, returns s on success, NULL on error */
+char *dnscache_getfname(char *s, size_t ssz);
+
+/* fills s with the directory of the disk cache, returns s on success, NULL on error */
+char *diskcache_getdir(char *s, size_t ssz);
+
 /* truncates file fname to sz bytes */
 void filetrunc(const char *fname, long sz);
 
+/* tells the OS that file fd is about to grow to sz bytes, so it may
+ * allocate all of it at once (no-op where not supported) */
+void fileprealloc(FILE *fd, long sz);
+
+/* switches stdout to binary mode (no-op where there is no such thing) */
+void filebinstdout(void);
+
+/* creates directory path (its parent must exist already). returns 0 on
+ * success, or if path is a directory already. */
+int filemkdir(const char *path);
+
+/* fills s with the name of a temporary file next to file fname (so it can
+ * be moved over it with filereplace), that no other running instance of
+ * Gopherus would pick. returns s on success, NULL on error */
+char *filetmpname(char *s, size_t ssz, const char *fname);
+
+/* renames file src to dst, replacing dst if it exists. the replacement is
+ * atomic where the OS permits it. returns 0 on success. */
+int filereplace(const char *src, const char *dst);
+
+/* maps the sz first bytes of file fd (opened for reading) into memory.
+ * returns NULL where the platform cannot do it, the file has to be read
+ * the usual way then. */
+const void *filemap(FILE *fd, long sz);
+
+/* releases a mapping obtained through filemap() */
+void fileunmap(const void *p, long sz);
+
+/* waits until file fd is not locked by another process, then locks it. this
+ * is advisory, it only holds off processes that lock the file too. */
+void filelock(FILE *fd);
+
+/* releases a lock obtained through filelock() */
+void fileunlock(FILE *fd);
+
 #endif
@@ -35,17 +35,29 @@
 #include <stdio.h>   /* snprintf(), fwrite()... */
 #include <time.h>    /* time_t */
 
+#include "batch.h"
+#include "crawl.h"
+#include "diskcache.h"
 #include "dnscache.h"
 #include "config.h"
+#include "connpool.h"
 #include "fs/fs.h"
 #include "history.h"
+#include "pagecache.h"
+#include "menuline.h"
 #include "net/net.h"
+#include "pack.h"
 #include "parseurl.h"
+#include "preconn.h"
+#include "prefetch.h"
+#include "ratelim.h"
 #include "readflin.h"
 #include "ui/ui.h"
 #include "wordwrap.h"
 #include "startpg.h"
+#include "timer.h"
 #include "version.h"
+#include "xfer.h"
 
 #define DISPLAY_ORDER_NONE 0
 #define DISPLAY_ORDER_QUIT 1
@@ -92,13 +104,59 @@ struct gopherusconfig {
   int attr_urlbar;
   int attr_urlbardeco;
   const char *bookmarksfile;
-  unsigned char notui; /* no TUI output, typically: -o download */
+  unsigned char notui; /* no TUI output, typically: -o download (2 = messages go to stderr, stdout carries data) */
+  unsigned char dl_parallel; /* max concurrent transfers of "download all" */
+  unsigned char dl_perhost;  /* max concurrent "download all" transfers per host */
+  unsigned char dl_rename;   /* "download all": rename (1) or skip (0) already existing files */
+  unsigned char crawl_depth; /* mirror: levels of menus followed from the starting url */
+  long crawl_delay;          /* mirror: min pause (ms) between two requests to a host */
+  unsigned short dns_cachesize; /* max amount of hosts in DNS cache */
+  long dns_ttl;                 /* how long (s) resolved addresses are kept in DNS cache */
+  unsigned short prefetch_conns; /* max amount of items prefetched per menu */
+  long prefetch_bytes;           /* byte budget of the prefetcher */
+  unsigned short preconn_socks;  /* max amount of speculative connections */
+  long preconn_idle;             /* how long (s) an unused speculative connection lives */
+  long rate_total;               /* max throughput of all transfers (KiB/s, 0 = unlimited) */
+  long rate_xfer;                /* max throughput of a single transfer (KiB/s) */
+  int net_tune;                  /* NET_TUNE_xxx flags applied to new sockets */
+  long net_rcvbuf;               /* socket receive buffer size (0 = OS default) */
+  unsigned char tls_verify;      /* gophers: check the certificates of servers */
+  long cache_size;               /* size of the disk cache (KiB, 0 = disabled) */
+  long cache_menuttl;            /* how long (s) a cached menu stays fresh */
+  long cache_ttl;                /* how long (s) other cached pages stay fresh */
   unsigned short keys[KEY_COUNT]; /* key bindings */
 };
 
 /* statusbar content, used by set_statusbar and draw_statusbar() */
 static char glob_statusbar[128];
 
+/* page that is displayed while still being received (see loadfile_buff) */
+static struct {
+  struct xfer *x;
+  unsigned long redrawtime; /* timer_ms() of the last redraw */
+  long redrawlen;           /* bytes received at the last redraw */
+  unsigned char complete;   /* loadfile_buff() got all of the page from the network */
+} glob_pageload;
+
+/* longest time (ms) between two looks at the keyboard, on platforms where it
+ * cannot be waited on along with the sockets */
+#define KBD_POLL 50
+
+/* how long (ms) a wait for network events may last at most: no limit as long
+ * as the keyboard can be watched along with the sockets (see kbd_watch) */
+static long glob_kbdwait = -1;
+
+/* set the keyboard is waited on along with the sets of the prefetcher and
+ * of the pre-connector, when idle (see wait_background) */
+static struct {
+  struct net_pollset *ws;
+  struct net_pollset *bg[2]; /* sets nested in ws */
+  int nested;                /* ws watches the keyboard and the nested sets */
+} glob_bgwait;
+
+/* offline pack the resources are looked for in first (see -p) */
+static struct pack *glob_pack = NULL;
+
 
 static unsigned char getfunckey(const struct gopherusconfig *config) {
   unsigned short k, i;
@@ -108,6 +166,48 @@ static unsigned char getfunckey(const struct gopherusconfig *config) {
 }
 
 
+/* registers the keyboard in set ps, so a key press wakes net_pollset_wait()
+ * up (reported with NULL sock and userdata). if that is not possible, waits
+ * get limited to KBD_POLL ms so the keyboard is still polled often enough. */
+static void kbd_watch(struct net_pollset *ps, const struct gopherusconfig *cfg) {
+  if (cfg->notui != 0) return; /* no keyboard to watch */
+  if (net_pollset_addfd(ps, ui_getfd(), NULL) != 0) glob_kbdwait = KBD_POLL;
+}
+
+
+/* returns non-zero if a key is waiting. the keyboard is told about by the
+ * evcount events of ev when kbd_watch() could register it, it is polled
+ * otherwise. */
+static int kbd_hit(const struct net_pollevent *ev, int evcount, const struct gopherusconfig *cfg) {
+  int i;
+  if (cfg->notui != 0) return(0);
+  if (glob_kbdwait >= 0) return(ui_kbhit());
+  for (i = 0; i < evcount; i++) {
+    if ((ev[i].sock == NULL) && (ev[i].userdata == NULL)) return(1);
+  }
+  return(0);
+}
+
+
+/* returns the NET_EV_* flags reported for sockets among the evcount events
+ * of ev (the keyboard left aside) */
+static int sock_events(const struct net_pollevent *ev, int evcount) {
+  int i, res = 0;
+  for (i = 0; i < evcount; i++) {
+    if (ev[i].sock != NULL) res |= ev[i].events;
+  }
+  return(res);
+}
+
+
+/* returns the shortest of two timeouts, a negative one being infinite */
+static long mintimeout(long a, long b) {
+  if (a < 0) return(b);
+  if ((b >= 0) && (b < a)) return(b);
+  return(a);
+}
+
+
 static int hex2int(char c) {
   switch (c) {
     case '0':
@@ -177,6 +277,16 @@ static void rtrim(char *s) {
 }
 
 
+/* parses val as a decimal number within [min;max], returns 0 on success */
+static int cfg_getnum(long *res, const char *val, long min, long max) {
+  char *end;
+  *res = strtol(val, &end, 10);
+  if ((end == val) || (*end != 0)) return(-1);
+  if ((*res < min) || (*res > max)) return(-1);
+  return(0);
+}
+
+
 static char *cfg_tokvaldelim(char **val, char *line) {
   char *tok = NULL;
 
@@ -301,10 +411,152 @@ static int cfgfileread(struct gopherusconfig *cfg, char *colorstring, const char
       continue;
     }
 
+    if (strcmp(tok, "dl.parallel") == 0) {
+      long v;
+      if (cfg_getnum(&v, val, 1, DL_MAXPARALLEL) != 0) goto INVALID_VALUE;
+      cfg->dl_parallel = v;
+      continue;
+    }
+
+    if (strcmp(tok, "dl.perhost") == 0) {
+      long v;
+      if (cfg_getnum(&v, val, 1, DL_MAXPARALLEL) != 0) goto INVALID_VALUE;
+      cfg->dl_perhost = v;
+      continue;
+    }
+
+    if (strcmp(tok, "crawl.depth") == 0) {
+      long v;
+      if (cfg_getnum(&v, val, 0, 255) != 0) goto INVALID_VALUE;
+      cfg->crawl_depth = v;
+      continue;
+    }
+
+    if (strcmp(tok, "crawl.delay") == 0) {
+      if (cfg_getnum(&(cfg->crawl_delay), val, 0, 60000l) != 0) goto INVALID_VALUE;
+      continue;
+    }
+
+    if (strcmp(tok, "dl.existing") == 0) {
+      if (strcmp(val, "skip") == 0) {
+        cfg->dl_rename = 0;
+      } else if (strcmp(val, "rename") == 0) {
+        cfg->dl_rename = 1;
+      } else {
+        goto INVALID_VALUE;
+      }
+      continue;
+    }
+
+    if (strcmp(tok, "dns.cachesize") == 0) {
+      long v;
+      if (cfg_getnum(&v, val, 1, 65535l) != 0) goto INVALID_VALUE;
+      cfg->dns_cachesize = v;
+      continue;
+    }
+
+    if (strcmp(tok, "dns.ttl") == 0) {
+      long v;
+      if (cfg_getnum(&v, val, 1, 604800l) != 0) goto INVALID_VALUE;
+      cfg->dns_ttl = v;
+      continue;
+    }
+
+    if (strcmp(tok, "prefetch.bytes") == 0) {
+      long v;
+      if (cfg_getnum(&v, val, 0, PAGEBUFSZ) != 0) goto INVALID_VALUE;
+      cfg->prefetch_bytes = v;
+      continue;
+    }
+
+    if (strcmp(tok, "prefetch.conns") == 0) {
+      long v;
+      if (cfg_getnum(&v, val, 0, 1000) != 0) goto INVALID_VALUE;
+      cfg->prefetch_conns = v;
+      continue;
+    }
+
+    if (strcmp(tok, "cache.size") == 0) {
+      if (cfg_getnum(&(cfg->cache_size), val, 0, 2097151l) != 0) goto INVALID_VALUE;
+      continue;
+    }
+
+    if (strcmp(tok, "cache.menuttl") == 0) {
+      if (cfg_getnum(&(cfg->cache_menuttl), val, 0, 31536000l) != 0) goto INVALID_VALUE;
+      continue;
+    }
+
+    if (strcmp(tok, "cache.ttl") == 0) {
+      if (cfg_getnum(&(cfg->cache_ttl), val, 0, 31536000l) != 0) goto INVALID_VALUE;
+      continue;
+    }
+
+    if (strcmp(tok, "preconnect.socks") == 0) {
+      long v;
+      if (cfg_getnum(&v, val, 0, PRECONN_MAXSOCKS) != 0) goto INVALID_VALUE;
+      cfg->preconn_socks = v;
+      continue;
+    }
+
+    if (strcmp(tok, "preconnect.idle") == 0) {
+      long v;
+      if (cfg_getnum(&v, val, 1, 3600) != 0) goto INVALID_VALUE;
+      cfg->preconn_idle = v;
+      continue;
+    }
+
+    if (strcmp(tok, "rate.total") == 0) {
+      long v;
+      if (cfg_getnum(&v, val, 0, RATELIM_MAX) != 0) goto INVALID_VALUE;
+      cfg->rate_total = v;
+      continue;
+    }
+
+    if (strcmp(tok, "rate.transfer") == 0) {
+      long v;
+      if (cfg_getnum(&v, val, 0, RATELIM_MAX) != 0) goto INVALID_VALUE;
+      cfg->rate_xfer = v;
+      continue;
+    }
+
+    if ((strcmp(tok, "net.nodelay") == 0) || (strcmp(tok, "net.quickack") == 0) || (strcmp(tok, "net.fastopen") == 0)) {
+      long v;
+      int flag = NET_TUNE_NODELAY;
+      if (tok[5] == 'q') flag = NET_TUNE_QUICKACK;
+      if (tok[5] == 'f') flag = NET_TUNE_FASTOPEN;
+      if (cfg_getnum(&v, val, 0, 1) != 0) goto INVALID_VALUE;
+      if (v != 0) {
+        cfg->net_tune |= flag;
+      } else {
+        cfg->net_tune &= ~flag;
+      }
+      continue;
+    }
+
+    if (strcmp(tok, "tls.verify") == 0) {
+      long v;
+      if (cfg_getnum(&v, val, 0, 1) != 0) goto INVALID_VALUE;
+      cfg->tls_verify = v;
+      continue;
+    }
+
+    if (strcmp(tok, "net.rcvbuf") == 0) {
+      long v;
+      if (cfg_getnum(&v, val, 0, 16777216l) != 0) goto INVALID_VALUE;
+      cfg->net_rcvbuf = v;
+      continue;
+    }
+
     /* invalid token */
     snprintf(buff, sizeof(buff), "ERR: Invalid token on line #%zu of %s", linecount, configfile);
     ui_puts(buff);
     errflag = -1;
+    continue;
+
+    INVALID_VALUE:
+    snprintf(buff, sizeof(buff), "ERR: Invalid value on line #%zu of %s", linecount, configfile);
+    ui_puts(buff);
+    errflag = -1;
   }
 
   fclose(fd);
@@ -320,6 +572,21 @@ static int loadcfg(struct gopherusconfig *cfg) {
 
   /* for starters let's zero out the struct */
   memset(cfg, 0, sizeof(*cfg));
+  cfg->dl_parallel = DL_PARALLEL;
+  cfg->dl_perhost = DL_PERHOST;
+  cfg->crawl_depth = CRAWL_DEPTH;
+  cfg->crawl_delay = CRAWL_DELAY;
+  cfg->cache_size = DISKCACHE_SIZE;
+  cfg->cache_menuttl = DISKCACHE_MENUTTL;
+  cfg->cache_ttl = DISKCACHE_TTL;
+  cfg->dns_cachesize = DNS_MAXENTRIES;
+  cfg->dns_ttl = DNS_CACHETIME;
+  cfg->prefetch_bytes = (PREFETCH_BYTES < PAGEBUFSZ) ? PREFETCH_BYTES : PAGEBUFSZ;
+  cfg->prefetch_conns = PREFETCH_CONNS;
+  cfg->preconn_socks = PRECONN_SOCKS;
+  cfg->preconn_idle = PRECONN_IDLE;
+  cfg->net_tune = NET_TUNE_NODELAY;
+  cfg->tls_verify = 1;
 
   /* get bookmarks and config files locations (will be useful later) */
   cfg->bookmarksfile = strdup(bookmarks_getfname(sbuf, sizeof(sbuf)));
@@ -364,6 +631,13 @@ static int loadcfg(struct gopherusconfig *cfg) {
   cfg->attr_menuselectable = (hex2int(colorstring[14]) << 4) | hex2int(colorstring[15]);
   cfg->attr_menucurrent = (hex2int(colorstring[16]) << 4) | hex2int(colorstring[17]);
 
+  dnscache_setcapacity(cfg->dns_cachesize);
+  dnscache_setttl(cfg->dns_ttl);
+  prefetch_setbudget(cfg->prefetch_bytes, cfg->prefetch_conns);
+  preconn_setlimits(cfg->preconn_socks, cfg->preconn_idle);
+  net_settuning(cfg->net_tune, cfg->net_rcvbuf);
+  net_settls(cfg->tls_verify);
+
   return(0);
 }
 
@@ -372,47 +646,7 @@ static void set_statusbar(const char *msg) {
   /* accept new status message only if no message set yet */
   if (glob_statusbar[0] != 0) return;
   /* copy msg to statusbar, watch out for overflows */
-  snprintf(glob_statusbar, sizeof(glob_statusbar), "%s", msg);
-}
-
-
-/* parses a buffer that contains a gopher menu and processes the first menu entry
- * fills itemtype with the gopher type of the entry and sets description, selector, host and port pointers so they point to the corresponding value in the menu.
- * returns length of the parsed line */
-static unsigned short menuline_explode(char *buffer, unsigned short bufferlen, char *itemtype, char **description, char **selector, char **host, char **port) {
-  char *cursor = buffer;
-  int column = 0;
-  if (itemtype != NULL) *itemtype = *cursor;
-  cursor += 1;
-  if (description != NULL) *description = cursor;
-  *selector = NULL;
-  *host = NULL;
-  *port = NULL;
-  for (; cursor < (buffer + bufferlen); cursor++) { /* read the whole line */
-    /* silently ignore CR chars */
-    if (*cursor == '\r') continue;
-
-    /* end of line, I'm done */
-    if (*cursor == '\n') {
-      *cursor = 0; /* put a NULL instead to terminate previous string */
-      cursor += 1;
-      break;
-    }
-
-    /* delimiter */
-    if (*cursor == '\t') { /* delimiter */
-      *cursor = 0; /* put a NULL instead to terminate previous string */
-      if (column == 0) {
-        *selector = cursor + 1;
-      } else if (column == 1) {
-        *host = cursor + 1;
-      } else if (column == 2) {
-        *port = cursor + 1;
-      }
-      if (column < 16) column += 1;
-    }
-  }
-  return(cursor - buffer);
+  snprintf(glob_statusbar, sizeof(glob_statusbar), "%.*s", (int)sizeof(glob_statusbar) - 1, msg);
 }
 
 
@@ -720,255 +954,373 @@ static int askQuitConfirmation(const struct gopherusconfig *cfg) {
 }
 
 
-static long http_skip_headers(char *buffer, long buffersz, struct net_tcpsocket *sock, unsigned short timeout) {
-  long res = 0;
-  long i;
-  int bytesread;
-  time_t now = time(NULL);
-
-  FETCHNEXTCHUNK:
-
-  /* abort on timeout */
-  if (time(NULL) - now > timeout) return(-1);
-
-  /* abort if buffer full - this should never happen, HTTP headers are not that huge */
-  if (res >= buffersz) return(-1);
-
-  bytesread = net_recv(sock, buffer + res, buffersz - res);
-
-  /* reloop if got nothing */
-  if (bytesread == 0) goto FETCHNEXTCHUNK;
-
-  /* error (end of connection) */
-  if (bytesread < 0) return(-1);
-
-  /* got some data, let's look */
-  res += bytesread;
+/* called by loadfile_buff() to emit messages either to status bar or console */
+static void status_msg(const char *s, const struct gopherusconfig *cfg) {
+  if (cfg->notui != 0) {
+    if (s[0] == '!') s++; /* strip the '!' error prefix when outputting to console */
+    if (s[0] == 0) return;
+    if (cfg->notui == 2) { /* stdout is busy with the downloaded data */
+      fprintf(stderr, "%s\n", s);
+    } else {
+      ui_puts(s);
+    }
+  } else {
+    set_statusbar(s);
+  }
+}
 
-  for (i = 0; i < res - 2; i++) {
 
-    /* find next LF */
-    if (buffer[i] != '\n') continue;
+/* describes the progress of the running transfer x: bytes received so far,
+ * current throughput and, when the size is known, the time left */
+static void progress_msg(char *s, size_t ssz, const struct xfer *x) {
+  long left = xfer_bytesleft(x);
+  char eta[32] = "";
+  if (x->rate <= 0) {
+    snprintf(s, ssz, "Downloading... [%ld bytes]", x->totlen);
+    return;
+  }
+  if (left >= 0) snprintf(eta, sizeof(eta), ", %lds left", (left + x->rate - 1) / x->rate);
+  if (x->rate < 10240) {
+    snprintf(s, ssz, "Downloading... [%ld bytes, %ld B/s%s]", x->totlen, x->rate, eta);
+  } else {
+    snprintf(s, ssz, "Downloading... [%ld bytes, %ld KiB/s%s]", x->totlen, x->rate / 1024, eta);
+  }
+}
 
-    /* skip the trailing CR, if present */
-    if (buffer[i + 1] == '\r') i++;
 
-    /* is the next byte an LF? then I reached the end of HTTP headers */
-    if (buffer[i + 1] == '\n') {
-      i += 2;
-      /* move any leftover data to the front of the buffer and quit */
-      if (res - i > 0) memmove(buffer, buffer + i, res - i);
-      return(res - i);
+/* reports how long each phase of the completed transfer x took */
+static void timing_msg(const struct xfer *x, const struct gopherusconfig *cfg) {
+  char msg[256];
+  unsigned long dns = x->timing.resolved - x->timing.start;
+  unsigned long conn = x->timing.connected - x->timing.resolved;
+  unsigned long tls = x->timing.secured - x->timing.connected;
+  unsigned long ttfb = x->timing.firstbyte - x->timing.secured;
+  char tlsmsg[48] = "";
+  unsigned long recv = x->timing.end - x->timing.firstbyte;
+  unsigned long total = x->timing.end - x->timing.start;
+  long recvms = recv / 1000, rate;
+  if (recvms < 1) recvms = 1;
+  rate = (x->totlen / recvms) * 1000 + ((x->totlen % recvms) * 1000) / recvms;
+  if (cfg->notui != 0) { /* made to be easy to parse */
+    unsigned long hits, misses;
+    dnscache_stats(&hits, &misses);
+    if (x->protocol == PARSEURL_PROTO_GOPHERS) snprintf(tlsmsg, sizeof(tlsmsg), " tls=%lu.%03lums resumed=%d", tls / 1000, tls % 1000, x->tlsresumed);
+    snprintf(msg, sizeof(msg), "Timing: dns=%lu.%03lums connect=%lu.%03lums%s ttfb=%lu.%03lums transfer=%lu.%03lums total=%lu.%03lums bytes=%ld rate=%ldB/s dnscache=%lu/%lu", dns / 1000, dns % 1000, conn / 1000, conn % 1000, tlsmsg, ttfb / 1000, ttfb % 1000, recv / 1000, recv % 1000, total / 1000, total % 1000, x->totlen, rate, hits, misses);
+  } else {
+    const char *unit = "B/s";
+    if (rate >= 10240) {
+      rate /= 1024;
+      unit = "KiB/s";
     }
+    if (x->protocol == PARSEURL_PROTO_GOPHERS) snprintf(tlsmsg, sizeof(tlsmsg), ", tls%s %lu.%lu", x->tlsresumed ? " (resumed)" : "", tls / 1000, (tls % 1000) / 100);
+    snprintf(msg, sizeof(msg), "Loaded %ld bytes in %lu ms: dns %lu.%lu, conn %lu.%lu%s, ttfb %lu.%lu ms, %ld %s", x->totlen, total / 1000, dns / 1000, (dns % 1000) / 100, conn / 1000, (conn % 1000) / 100, tlsmsg, ttfb / 1000, (ttfb % 1000) / 100, rate, unit);
   }
-  goto FETCHNEXTCHUNK;
+  status_msg(msg, cfg);
 }
 
 
-/* called by loadfile_buff() to emit messages either to status bar or console */
-static void status_msg(const char *s, const struct gopherusconfig *cfg) {
-  if (cfg->notui != 0) {
-    if (s[0] == '!') s++; /* strip the '!' error prefix when outputting to console */
-    if (s[0] != 0) ui_puts(s);
-  } else {
-    set_statusbar(s);
+/* loads entry of the offline pack into buffer, or into file filename ("-"
+ * standing for stdout) if not NULL. returns the length of the resource, or
+ * -1 on error. */
+static long loadfile_pack(long entry, char *buffer, long buffer_max, const char *filename, const struct gopherusconfig *cfg) {
+  FILE *fd = NULL;
+  long res;
+  char statusmsg[128];
+  if (filename != NULL) {
+    fd = stdout;
+    if (strcmp(filename, "-") != 0) fd = fopen(filename, "wb");
+    if (fd == NULL) {
+      status_msg("!Error: could not create the file on disk!", cfg);
+      return(-1);
+    }
+  }
+  res = pack_read(glob_pack, entry, buffer, buffer_max, fd);
+  if ((fd != NULL) && (fd != stdout) && (fclose(fd) != 0)) res = -1;
+  if (res < 0) {
+    status_msg("!Error: could not read the resource from the pack", cfg);
+  } else if ((fd == NULL) && (pack_len(glob_pack, entry) > res)) {
+    snprintf(statusmsg, sizeof(statusmsg), "!Error: Server's answer is too long! (truncated to %ld bytes)", res);
+    status_msg(statusmsg, cfg);
   }
+  return(res);
 }
 
 
 /* downloads a gopher or http resource and write it to a file or a memory
  * buffer. if *filename is not NULL, the resource will be written in the file
- * (but a valid *buffer is still required) */
-static long loadfile_buff(unsigned char protocol, const char *hostaddr, unsigned short hostport, char *selector, char *buffer, long buffer_max, const char *filename, const struct gopherusconfig *cfg) {
-  char ipaddr[64];
-  long reslength, byteread, totlen = 0;
-  int warnflag = 0;
+ * (but a valid *buffer is still required). if bg is not NULL, a memory
+ * transfer is left running as soon as a screenful of data arrived: *bg is
+ * then set to it and the amount of bytes received so far is returned, the
+ * caller taking care of the transfer (and its pollset) from there on. */
+static long loadfile_buff(unsigned char protocol, const char *hostaddr, unsigned short hostport, char *selector, char *buffer, long buffer_max, const char *filename, const struct gopherusconfig *cfg, struct xfer **bg) {
   char statusmsg[128];
-  time_t lastrefresh = 0;
-  FILE *fd = NULL;
-  struct net_tcpsocket *sock = NULL;
-  time_t lastactivity, curtime;
-
-  /* open file if out to file requested */
-  if (filename != NULL) {
+  long res = -1;
+  long scanned = 0, lines = 0;
+  unsigned long lastrefresh = 0;
+  int laststate = -1;
+  struct net_pollset *ps;
+  struct xfer *x;
+
+  glob_pageload.complete = 0;
+
+  /* refuse to overwrite an existing file */
+  if ((filename != NULL) && (strcmp(filename, "-") != 0)) {
+    FILE *fd;
     fd = fopen(filename, "rb"); /* try to open for read - this should fail */
     if (fd != NULL) {
       status_msg("!File already exists! Operation aborted.", cfg);
       fclose(fd);
       return(-1);
     }
-    fd = fopen(filename, "wb"); /* now open for write - this will create the file */
-    if (fd == NULL) { /* this should not fail */
-      status_msg("!Error: could not create the file on disk!", cfg);
-      goto FAIL;
-    }
   }
 
   /* is the call for an embedded page? */
   if (hostaddr[0] == '#') {
-    reslength = loadembeddedstartpage(buffer, buffer_max, hostaddr + 1, cfg->bookmarksfile);
+    res = loadembeddedstartpage(buffer, buffer_max, hostaddr + 1, cfg->bookmarksfile);
     /* write to file, if downloading to a file */
-    if (fd != NULL) {
-      fwrite(buffer, 1, reslength, fd);
+    if ((filename != NULL) && (strcmp(filename, "-") == 0)) {
+      fwrite(buffer, 1, res, stdout);
+    } else if (filename != NULL) {
+      FILE *fd;
+      fd = fopen(filename, "wb");
+      if (fd == NULL) {
+        status_msg("!Error: could not create the file on disk!", cfg);
+        return(-1);
+      }
+      fwrite(buffer, 1, res, fd);
       fclose(fd);
     }
-    return(reslength);
+    return(res);
   }
 
-  /* DNS resolution */
-  if (dnscache_ask(ipaddr, hostaddr) != 0) {
-    snprintf(statusmsg, sizeof(statusmsg), "Resolving '%s'...", hostaddr);
-    status_msg(statusmsg, cfg);
-    if (net_dnsresolve(ipaddr, hostaddr) != 0) {
-      status_msg("!DNS resolution failed!", cfg);
-      goto FAIL;
-    }
-    dnscache_add(hostaddr, ipaddr);
+  /* an offline pack may hold the resource, the network is the fallback */
+  if ((glob_pack != NULL) && ((protocol == PARSEURL_PROTO_GOPHER) || (protocol == PARSEURL_PROTO_GOPHERS))) {
+    long entry = pack_find(glob_pack, hostaddr, hostport, selector);
+    if (entry >= 0) return(loadfile_pack(entry, buffer, buffer_max, filename, cfg));
   }
 
-  /* connect */
-  snprintf(statusmsg, sizeof(statusmsg), "Connecting to %s...", ipaddr);
-  status_msg(statusmsg, cfg);
-
-  sock = net_connect(ipaddr, hostport);
-  if (sock == NULL) {
-    status_msg("!Connection error!", cfg);
-    goto FAIL;
+  ps = net_pollset_new();
+  if (ps == NULL) {
+    status_msg("!Out of memory", cfg);
+    return(-1);
   }
-
-  /* wait for net_connect() to actually connect */
-  for (;;) {
-    int connstate;
-    connstate = net_isconnected(sock, 1);
-    if (connstate > 0) break;
-    if (connstate < 0) {
-      status_msg("!Connection error!", cfg);
-      goto FAIL;
+  kbd_watch(ps, cfg);
+  /* ...or be on its way, then there is no need to start over */
+  x = NULL;
+  if (filename == NULL) {
+    x = prefetch_adopt(protocol, hostaddr, hostport, selector, buffer, buffer_max, ps);
+  } else {
+    prefetch_cancel();
+  }
+  if (x == NULL) {
+    x = xfer_new(protocol, hostaddr, hostport, selector, buffer, buffer_max, filename, ps);
+    if (x == NULL) {
+      net_pollset_free(ps);
+      status_msg("!Out of memory", cfg);
+      return(-1);
     }
-    if (ui_kbhit()) {
-      status_msg("Connection aborted by user", cfg);
-      ui_getkey(); /* consume the pressed key */
-      goto FAIL;
+    /* a connection to the server may have been opened already */
+    {
+      char ipaddr[NET_ADDRSTRLEN];
+      xfer_adoptsock(x, preconn_take(hostaddr, hostport, ipaddr), ipaddr);
     }
   }
 
-  /* build and send the query */
-  if (protocol == PARSEURL_PROTO_HTTP) { /* http */
-    snprintf(buffer, buffer_max, "GET /%s HTTP/1.0\r\nHOST: %s\r\nUSER-AGENT: Gopherus\r\n\r\n", selector, hostaddr);
-  } else { /* gopher */
-    snprintf(buffer, buffer_max, "%s\r\n", selector);
-  }
-  if (net_send(sock, buffer, strlen(buffer)) != (int)strlen(buffer)) {
-    status_msg("!send() error!", cfg);
-    goto FAIL;
-  }
-
-  /* prepare timers */
-  curtime = time(NULL);
-  lastactivity = curtime;
-  lastrefresh = curtime;
-
-  /* zero out reslength */
-  reslength = 0;
-
-  /* if protocol is http, ignore headers */
-  if (protocol == PARSEURL_PROTO_HTTP) {
-    reslength = http_skip_headers(buffer, buffer_max, sock, 2);
-    if (reslength < 0) {
-      status_msg("!Error: Failed to fetch or parse HTTP headers", cfg);
-      goto FAIL;
+  while ((x->state != XFER_DONE) && (x->state != XFER_FAIL)) {
+    struct net_pollevent ev[2]; /* the socket and the keyboard */
+    long timeout;
+    int evcount;
+
+    /* tell the user what is going on */
+    if (x->state != laststate) {
+      laststate = x->state;
+      if (x->state == XFER_RESOLVE) {
+        if (dnscache_ask(NULL, 0, hostaddr) == 0) {
+          snprintf(statusmsg, sizeof(statusmsg), "Resolving '%s'...", hostaddr);
+          status_msg(statusmsg, cfg);
+        }
+      } else if (x->state == XFER_CONNECT) {
+        if (x->addrcount > 1) {
+          snprintf(statusmsg, sizeof(statusmsg), "Connecting to %s (+%d more)...", x->addr[0], x->addrcount - 1);
+        } else {
+          snprintf(statusmsg, sizeof(statusmsg), "Connecting to %s...", x->addr[0]);
+        }
+        status_msg(statusmsg, cfg);
+      } else if (x->state == XFER_HANDSHAKE) {
+        snprintf(statusmsg, sizeof(statusmsg), "Securing the connection to %s...", x->ipaddr);
+        status_msg(statusmsg, cfg);
+      }
     }
-  }
 
-  /* receive payload */
-  for (;;) {
+    /* wait for something to happen on the socket or on the keyboard, or for
+     * the transfer (or the status bar) to need attention */
+    timeout = mintimeout(xfer_timeout(x), glob_kbdwait);
+    if ((x->state == XFER_RECV) && (lastrefresh != 0)) {
+      long left = 1000 - (long)(timer_ms() - lastrefresh);
+      timeout = mintimeout(timeout, (left > 0) ? left : 0);
+    }
+    evcount = net_pollset_wait(ps, ev, 2, timeout);
+    xfer_step(x, sock_events(ev, evcount));
+
+    /* enough lines for a first screen are there: the rest will be received
+     * while the page is displayed already */
+    if ((bg != NULL) && (x->state == XFER_RECV)) {
+      for (; scanned < x->bufflen; scanned++) {
+        if (buffer[scanned] == '\n') lines++;
+      }
+      if ((lines >= ui_getrowcount() - 2) || (x->bufflen >= (long)ui_getrowcount() * ui_getcolcount())) {
+        *bg = x;
+        return(x->bufflen);
+      }
+    }
 
     /* a key has been pressed - read it */
-    if (ui_kbhit() != 0) {
+    if (kbd_hit(ev, evcount, cfg) != 0) {
       unsigned char presskey = getfunckey(cfg);
-      if ((presskey == KEY_ESC) || (presskey == KEY_TAB)) { /* if it's escape or backspace, abort the connection */
+      /* any key aborts the resolve and connect phases, only escape or tab
+       * aborts later */
+      if ((x->state == XFER_RESOLVE) || (x->state == XFER_CONNECT) || (x->state == XFER_HANDSHAKE) || (presskey == KEY_ESC) || (presskey == KEY_TAB)) {
         status_msg("Connection aborted by the user.", cfg);
-        goto FAIL;
+        goto DONE;
       }
     }
 
-    /* look out for buffer space */
-    if (reslength >= buffer_max) { /* too much data! */
-      snprintf(statusmsg, sizeof(statusmsg), "!Error: Server's answer is too long! (truncated to %ld bytes)", reslength);
-      status_msg(statusmsg, cfg);
-      warnflag = 1;
-      break;
-    }
-
-    byteread = net_recv(sock, buffer + reslength, buffer_max - reslength);
-    curtime = time(NULL);
-
     /* refresh the status bar once every second */
-    if ((curtime != lastrefresh) || (byteread < 0)) {
-      lastrefresh = curtime;
-      snprintf(statusmsg, sizeof(statusmsg), "Downloading... [%ld bytes]", totlen);
+    if ((x->state == XFER_RECV) && ((lastrefresh == 0) || (timer_ms() - lastrefresh >= 1000))) {
+      lastrefresh = timer_ms();
+      progress_msg(statusmsg, sizeof(statusmsg), x);
       status_msg(statusmsg, cfg);
       if (cfg->notui == 0) draw_statusbar(cfg);
     }
+  }
 
-    /* got nothing */
-    if (byteread == 0) {
-      if (curtime - lastactivity > 20) { /* TIMEOUT! */
-        status_msg("!Timeout while waiting for data!", cfg);
-        reslength = -1;
-        goto FAIL;
-      }
-      continue;
-    }
+  if (x->state == XFER_FAIL) {
+    status_msg(x->errmsg, cfg);
+    goto DONE;
+  }
+
+  res = x->totlen;
+  if (x->truncated) {
+    snprintf(statusmsg, sizeof(statusmsg), "!Error: Server's answer is too long! (truncated to %ld bytes)", res);
+    status_msg(statusmsg, cfg);
+  } else if (filename == NULL) {
+    glob_pageload.complete = 1;
+    timing_msg(x, cfg);
+  }
 
-    /* end of connection */
-    if (byteread < 0) break;
+  /* if downloading to file: print message (along with timings, for whoever
+   * scripts gopherus) */
+  if (filename != NULL) {
+    snprintf(statusmsg, sizeof(statusmsg), "Saved %ld bytes on disk", res);
+    status_msg(statusmsg, cfg);
+    if (cfg->notui != 0) timing_msg(x, cfg);
+  }
 
-    /* got something */
-    lastactivity = curtime;
-    totlen += byteread;
+  DONE:
+  xfer_free(x);
+  net_pollset_free(ps);
+  return(res);
+}
 
-    /* if downloading to file, write data to disk */
-    if (fd != NULL) {
-      if ((long)fwrite(buffer, 1, byteread, fd) != byteread) {
-        status_msg("!Error while writing data to disk", cfg);
-        goto FAIL;
-      }
-    } else { /* else just keep it in the buffer */
-      reslength += byteread;
-    }
 
+/* ends the page load in progress (if any) and trims the cache of node, that
+ * received it, to the size of its data */
+static void pageload_end(struct historytype *node) {
+  signed char *newcache;
+  if (glob_pageload.x != NULL) {
+    struct net_pollset *ps = glob_pageload.x->ps;
+    node->cachesize = glob_pageload.x->bufflen;
+    xfer_free(glob_pageload.x);
+    net_pollset_free(ps);
+    glob_pageload.x = NULL;
   }
+  newcache = realloc(node->cache, (node->cachesize > 0) ? node->cachesize : 1);
+  if (newcache != NULL) node->cache = newcache;
+}
 
-  if ((totlen >= 0) && (warnflag == 0)) {
-    net_close(&sock);
-  } else {
-    net_abort(&sock);
-  }
 
-  /* consider 0-sized results as error (probably selector does not exist) */
-  if (totlen == 0) {
-    status_msg("!Error: selector does not exist", cfg);
-    goto FAIL;
+/* hands the page received by node over to the page cache, and stores it in
+ * the disk cache as well if it has been received entirely. returns 0 on
+ * success, non-zero if memory is short (the page is lost then). */
+static int page_store(struct historytype *node) {
+  if (glob_pageload.complete) diskcache_put(node->protocol, node->host, node->port, node->itemtype, node->selector, (const char *)node->cache, node->cachesize);
+  if (pagecache_put(node->protocol, node->host, node->port, node->itemtype, node->selector, node->cache, node->cachesize) != 0) {
+    node->cache = NULL;
+    node->cachesize = 0;
+    set_statusbar("!Out of memory!");
+    return(-1);
   }
+  return(0);
+}
 
-  /* if downloading to file: close file and print message */
-  if (fd != NULL) {
-    fclose(fd);
-    fd = NULL;
-    snprintf(statusmsg, sizeof(statusmsg), "Saved %ld bytes on disk", totlen);
+
+/* makes the page load in progress (if any) progress, waiting for network
+ * activity or for a key press (its set watches the keyboard, see
+ * loadfile_buff). data is received straight into the cache of node. *key
+ * is set to non-zero if a key is waiting. returns non-zero if there is
+ * something new to display. */
+static int pageload_step(struct historytype *node, const struct gopherusconfig *cfg, int *key) {
+  struct xfer *x = glob_pageload.x;
+  struct net_pollevent ev[2]; /* the socket and the keyboard */
+  char statusmsg[128];
+  long timeout;
+  int evcount;
+
+  *key = 0;
+  if (x == NULL) return(0);
+  timeout = mintimeout(xfer_timeout(x), glob_kbdwait);
+  /* data received since the last redraw is waiting to be displayed */
+  if (x->bufflen != glob_pageload.redrawlen) {
+    long left = 250 - (long)(timer_ms() - glob_pageload.redrawtime);
+    timeout = mintimeout(timeout, (left > 0) ? left : 0);
+  }
+  evcount = net_pollset_wait(x->ps, ev, 2, timeout);
+  *key = kbd_hit(ev, evcount, cfg);
+  xfer_step(x, sock_events(ev, evcount));
+  node->cachesize = x->bufflen;
+
+  if (x->state == XFER_FAIL) {
+    status_msg(x->errmsg, cfg);
+  } else if (x->state == XFER_DONE) {
+    if (x->truncated) {
+      snprintf(statusmsg, sizeof(statusmsg), "!Error: Server's answer is too long! (truncated to %ld bytes)", x->bufflen);
+      status_msg(statusmsg, cfg);
+    } else {
+      timing_msg(x, cfg);
+      glob_pageload.complete = 1;
+    }
+  } else {
+    /* redraw a few times per second at most, as data keeps coming */
+    if ((x->bufflen == glob_pageload.redrawlen) || (timer_ms() - glob_pageload.redrawtime < 250)) return(0);
+    glob_pageload.redrawtime = timer_ms();
+    glob_pageload.redrawlen = x->bufflen;
+    progress_msg(statusmsg, sizeof(statusmsg), x);
     status_msg(statusmsg, cfg);
+    return(1);
   }
+  pageload_end(node);
+  page_store(node); /* on failure, the display function sees the page is gone */
+  return(1);
+}
 
-  return(totlen);
 
-  FAIL:
-  if (fd != NULL) {
-    fclose(fd);
-    remove(filename);
+/* waits for a key press, while the page load in progress (if any) goes on.
+ * returns KEY_NONE whenever there is something new to display first. */
+static unsigned char getfunckey_pageload(struct historytype *node, const struct gopherusconfig *cfg) {
+  while (glob_pageload.x != NULL) {
+    int key;
+    if (pageload_step(node, cfg, &key) != 0) return(KEY_NONE); /* a waiting key is read next time */
+    if (key != 0) {
+      unsigned char presskey = getfunckey(cfg);
+      if (presskey != KEY_ESC) return(presskey);
+      /* escape stops the transfer, what has been received so far is kept */
+      pageload_end(node);
+      status_msg("Connection aborted by the user.", cfg);
+      page_store(node);
+      return(KEY_NONE);
+    }
   }
-  if (sock != NULL) net_abort(&sock);
-  return(-1);
+  return(getfunckey(cfg));
 }
 
 
@@ -1058,131 +1410,518 @@ static int isitemtypedownloadable(char itemtype) {
 }
 
 
-/* explodes a gopher menu into separate lines. returns amount of lines */
-static long menu_explode(char *buffer, long bufferlen, unsigned char *line_itemtype, char **line_description, unsigned short *line_selector, unsigned short *line_host, unsigned short *line_port, long maxlines, long *firstlinkline, long *lastlinkline) {
-  char *cursor;
-  char *singlelinebuf;
-  long linecount = 0;
-  int screenw = ui_getcolcount();
-
-  singlelinebuf = malloc(screenw + 2);
+/* a line of a menu, as displayed. fields are spans of the page itself, that
+ * is never modified (nor nul-terminated) by the parsing */
+struct menuspan {
+  long desc;                /* description, or the part of it on this line */
+  long sel;                 /* selector */
+  long host;
+  unsigned short desclen;
+  unsigned short sellen;
+  unsigned short hostlen;
+  unsigned short port;
+  unsigned char itemtype;   /* high bit set if the line continues a wrapped description */
+};
 
-  *firstlinkline = -1;
-  *lastlinkline = -1;
+/* span table of a menu, for a given screen width. it is built as the menu
+ * arrives, then kept in the page cache along with the page, so showing the
+ * menu again costs no parsing. */
+struct menuindex {
+  long parsedlen;           /* bytes of the page parsed already */
+  long linecount;
+  long firstlinkline;
+  long lastlinkline;
+  int width;                /* screen width descriptions are wrapped for */
+  int trimmed;              /* the menu is complete and has been trimmed */
+  struct menuspan line[1];  /* MAXMENULINES while built, linecount after */
+};
 
-  for (cursor = buffer; bufferlen > 0;) {
-    unsigned char colid = 0;
-    char *selector = NULL;
-    char *host = NULL;
-    char *port = NULL;
-    char *lineorigin;
-    char itemtype;
 
-    /* abort if too many lines already */
-    if (linecount >= maxlines) {
-      set_statusbar("!ERROR: Too many lines, the document has been truncated.");
-      break;
-    }
+/* returns the length of a span, truncated to what a menuspan may hold */
+static unsigned short menu_spanlen(long len) {
+  if (len > 0xffffl) return(0xffff);
+  return((unsigned short)len);
+}
 
-    /* remember where the line starts */
-    lineorigin = cursor;
 
-    /* advance cursor to next line, change all tabs to nuls on the way and remember the position of the 3 first columns (selector, host, port) */
-    while (bufferlen) {
-      if (*cursor == '\t') {
-        *cursor = 0;
-        switch (colid) {
-          case 0: /* selector */
-            selector = cursor + 1;
-            break;
-          case 1: /* host */
-            host = cursor + 1;
-            break;
-          case 2: /* port */
-            port = cursor + 1;
-            break;
-        }
-        colid++;
+/* parses (a part of) a gopher menu that lies in page at idx->parsedlen, up
+ * to pagelen, appending its lines to idx. every line is expected to be
+ * complete, except maybe the last one of the page. */
+static void menu_index(struct menuindex *idx, const signed char *page, long pagelen) {
+  const char *p = (const char *)page;
+  int screenw = idx->width;
+
+  while (idx->parsedlen < pagelen) {
+    long start = idx->parsedlen, end, pos;
+    long fieldoff[4], fieldlen[4];
+    unsigned short port = 70;
+    char itemtype = 'i'; /* empty lines are informational (i) */
+    int col;
+
+    for (end = start; (end < pagelen) && (p[end] != '\n'); end++);
+    idx->parsedlen = (end < pagelen) ? end + 1 : end;
+
+    /* find the description, selector, host and port columns. a field ends
+     * at the next TAB, or at a CR */
+    for (col = 0; col < 4; col++) {
+      fieldoff[col] = start;
+      fieldlen[col] = 0;
+    }
+    if ((end > start) && (p[start] != '\r')) {
+      itemtype = p[start];
+      fieldoff[0] = start + 1;
+      fieldlen[0] = -1;
+      col = 0;
+      for (pos = start + 1; pos <= end; pos++) {
+        if ((pos < end) && (p[pos] != '\t') && (p[pos] != '\r')) continue;
+        if (fieldlen[col] < 0) fieldlen[col] = pos - fieldoff[col];
+        if ((pos == end) || (p[pos] != '\t')) continue;
+        if (++col == 4) break;
+        fieldoff[col] = pos + 1;
+        fieldlen[col] = -1;
       }
-      cursor++;
-      bufferlen--;
-      if (*cursor == '\r') *cursor = 0;
-      if (cursor[-1] == '\n') {
-        cursor[-1] = 0;
-        break;
+    }
+    { /* port, read the way atol() would */
+      long portnum = 0;
+      for (pos = fieldoff[3]; (pos < fieldoff[3] + fieldlen[3]) && (p[pos] == ' '); pos++);
+      for (; (pos < fieldoff[3] + fieldlen[3]) && (p[pos] >= '0') && (p[pos] <= '9') && (portnum < 65536l); pos++) {
+        portnum = portnum * 10 + (p[pos] - '0');
       }
+      if ((portnum > 0) && (portnum < 65536l)) port = (unsigned short)portnum;
     }
 
-    /* consider empty lines as informational (i) */
-    if (lineorigin[0] != 0) {
-      itemtype = *lineorigin;
-    } else {
-      itemtype = 'i';
+    if (isitemtypeselectable(itemtype) != 0) {
+      if (idx->firstlinkline < 0) idx->firstlinkline = idx->linecount;
+      idx->lastlinkline = idx->linecount;
     }
 
-    { /* line-wrapping business */
-      char *wrapptr = lineorigin + 1;
-      int wraplen;
-      int firstiteration = 1;
-      if (isitemtypeselectable(itemtype) != 0) {
-        if (*firstlinkline < 0) *firstlinkline = linecount;
-        *lastlinkline = linecount;
-      }
-      for (;; firstiteration = 0) {
-        if (itemtype == 'i') {
-          wraplen = screenw;
-        } else {
-          wraplen = screenw - 4;
-        }
-        line_description[linecount] = wrapptr;
-        wrapptr = wordwrap(wrapptr, singlelinebuf, wraplen);
-        line_description[linecount][strlen(singlelinebuf)] = 0; /* terminate line after wrap */
-        if (selector == NULL) {
-          line_selector[linecount] = 0;
-        } else {
-          line_selector[linecount] = (selector - line_description[linecount]);
+    { /* line-wrapping business, same as wordwrap() does */
+      long wrapoff = fieldoff[0], wrapleft = fieldlen[0];
+      int wraplen, firstiteration;
+      wraplen = (itemtype == 'i') ? screenw : screenw - 4;
+      if (wraplen < 1) wraplen = 1;
+      for (firstiteration = 1; wrapleft >= 0; firstiteration = 0) {
+        struct menuspan *l;
+        long chunk;
+        /* abort if too many lines already */
+        if (idx->linecount >= MAXMENULINES) {
+          set_statusbar("!ERROR: Too many lines, the document has been truncated.");
+          idx->parsedlen = pagelen;
+          return;
         }
-        if (host == NULL) {
-          line_host[linecount] = 0;
+        l = &(idx->line[idx->linecount++]);
+        l->desc = wrapoff;
+        l->sel = fieldoff[1];
+        l->sellen = menu_spanlen(fieldlen[1]);
+        l->host = fieldoff[2];
+        l->hostlen = menu_spanlen(fieldlen[2]);
+        l->port = port;
+        l->itemtype = (unsigned char)itemtype;
+        if (!firstiteration) l->itemtype |= 128;
+        if (wrapleft <= wraplen) { /* the rest fits */
+          chunk = wrapleft;
+          wrapleft = -1;
         } else {
-          line_host[linecount] = (host - line_description[linecount]);
-        }
-        if (port == NULL) {
-          line_port[linecount] = 70;
-        } else {
-          line_port[linecount] = atol(port);
-          if (line_port[linecount] == 0) line_port[linecount] = 70;
+          long x, lastspace = 0;
+          for (x = 0; x <= wraplen; x++) {
+            if (p[wrapoff + x] == ' ') lastspace = x;
+          }
+          if (lastspace == 0) { /* I have to cut it in a dumb way */
+            chunk = wraplen;
+            wrapoff += wraplen;
+            wrapleft -= wraplen;
+          } else { /* cut it in word boundary */
+            chunk = lastspace;
+            for (; (lastspace < wrapleft) && (p[wrapoff + lastspace] == ' '); lastspace++);
+            wrapoff += lastspace;
+            wrapleft -= lastspace;
+            if (wrapleft == 0) wrapleft = -1;
+          }
         }
-        line_itemtype[linecount] = itemtype;
-        if (!firstiteration) line_itemtype[linecount] |= 128;
-        linecount++;
-        if (wrapptr == NULL) break;
+        l->desclen = menu_spanlen(chunk);
       }
     }
   }
+}
 
+
+/* trims the end of an indexed menu, once all of it is there */
+static void menu_trim(struct menuindex *idx) {
   /* trim out the last line if its starting with a '.' (gopher's "end of menu" marker) */
-  if (linecount > 0) {
-    if (line_itemtype[linecount - 1] == '.') linecount--;
-  }
+  if ((idx->linecount > 0) && (idx->line[idx->linecount - 1].itemtype == '.')) idx->linecount--;
 
   /* trim out all trailing empty lines */
-  while ((linecount > 0) && (line_description[linecount - 1][0] == 0)) linecount--;
+  while ((idx->linecount > 0) && (idx->line[idx->linecount - 1].desclen == 0)) idx->linecount--;
+
+  /* links may have been trimmed out */
+  if (idx->lastlinkline >= idx->linecount) {
+    while ((idx->lastlinkline >= 0) && (isitemtypeselectable(idx->line[idx->lastlinkline].itemtype) == 0)) idx->lastlinkline--;
+    if (idx->lastlinkline < 0) idx->firstlinkline = -1;
+  }
+  idx->trimmed = 1;
+}
 
-  free(singlelinebuf);
 
-  return(linecount);
+/* copies a span of page into buff as a nul-terminated string (truncated to
+ * buffsz - 1 bytes if needed), returns buff */
+static char *menu_field(char *buff, size_t buffsz, const signed char *page, long off, unsigned short len) {
+  if (len > buffsz - 1) len = buffsz - 1;
+  memcpy(buff, page + off, len);
+  buff[len] = 0;
+  return(buff);
 }
 
 
-static int display_menu(struct historytype **history, const struct gopherusconfig *cfg, char *buffer, long buffersize) {
+/* returns non-zero if file fname exists */
+static int fileexists(const char *fname) {
+  FILE *fd;
+  fd = fopen(fname, "rb");
+  if (fd == NULL) return(0);
+  fclose(fd);
+  return(1);
+}
+
+
+/* if fname is already taken by an existing file, changes it into a similar
+ * name that is still free, by appending a ~N suffix to its base. returns 0
+ * on success, non-zero if no free name could be found. */
+static int fname_makeunique(char *fname, unsigned short fnamesz) {
+  char orig[64];
+  char *ext;
+  unsigned short i;
+  if (fileexists(fname) == 0) return(0);
+  snprintf(orig, sizeof(orig), "%s", fname);
+  ext = strrchr(orig, '.');
+  if (ext != NULL) *(ext++) = 0;
+  for (i = 1; i < 1000; i++) {
+    char suffix[8];
+    int suffixlen, baselen, room;
+    suffixlen = sprintf(suffix, "~%u", i);
+    baselen = strlen(orig);
+    room = fnamesz - 1 - suffixlen;
+    if (ext != NULL) room -= strlen(ext) + 1;
+#ifdef NOLFN
+    if (room > 8 - suffixlen) room = 8 - suffixlen;
+#endif
+    if (room < 1) return(-1);
+    if (baselen > room) baselen = room;
+    /* room has been computed so the new name always fits in fname */
+    memcpy(fname, orig, baselen);
+    strcpy(fname + baselen, suffix);
+    if (ext != NULL) {
+      strcat(fname, ".");
+      strcat(fname, ext);
+    }
+    if (fileexists(fname) == 0) return(0);
+  }
+  return(-1);
+}
+
+
+struct dlslot {
+  struct xfer *x;
+  int events;
+  char fname[32];
+  char buff[DL_BUFSZ];
+};
+
+
+/* draws the progress of a "download all" operation over the page area */
+static void download_all_draw(struct dlslot **slot, int active, unsigned short okcount, unsigned short skipcount, unsigned short failcount, long queued, const struct gopherusconfig *cfg) {
+  char line[128];
+  int i, y;
+  time_t now = time(NULL);
+  snprintf(line, sizeof(line), "Downloading... %u saved, %u skipped, %u failed, %d in progress, %ld queued", okcount, skipcount, failcount, active, queued);
+  drawstr(line, cfg->attr_menutype, 0, 1, ui_getcolcount());
+  for (y = 2; y < ui_getrowcount() - 1; y++) {
+    i = y - 2;
+    if (i >= active) {
+      drawstr("", cfg->attr_textnorm, 0, y, ui_getcolcount());
+      continue;
+    }
+    {
+      const char *st;
+      long rate = slot[i]->x->totlen;
+      if (now > slot[i]->x->starttime) rate /= (now - slot[i]->x->starttime);
+      switch (slot[i]->x->state) {
+        case XFER_RESOLVE:
+          st = "resolving";
+          break;
+        case XFER_CONNECT:
+          st = "connecting";
+          break;
+        case XFER_HANDSHAKE:
+          st = "securing";
+          break;
+        default:
+          st = "receiving";
+          break;
+      }
+      if (rate < 10240) {
+        snprintf(line, sizeof(line), "%-31s %-10s %10ld bytes %6ld B/s   %s", slot[i]->fname, st, slot[i]->x->totlen, rate, slot[i]->x->host);
+      } else {
+        snprintf(line, sizeof(line), "%-31s %-10s %10ld bytes %6ld KiB/s %s", slot[i]->fname, st, slot[i]->x->totlen, rate / 1024, slot[i]->x->host);
+      }
+      drawstr(line, cfg->attr_textnorm, 0, y, ui_getcolcount());
+    }
+  }
+  set_statusbar("Press ESC to abort");
+  draw_statusbar(cfg);
+  ui_refresh();
+}
+
+
+/* returns the protocol that the item at host:port of a menu is fetched
+ * with. gopher menus do not tell, but whatever is served by the server of
+ * a gophers menu is expected to be reachable over TLS as well */
+static unsigned char menu_itemproto(const struct historytype *menu, const char *host, unsigned short port) {
+  if ((menu->protocol == PARSEURL_PROTO_GOPHERS) && (menu->port == port) && (strcasecmp(menu->host, host) == 0)) return(PARSEURL_PROTO_GOPHERS);
+  return(PARSEURL_PROTO_GOPHER);
+}
+
+
+/* downloads all downloadable items of a menu to disk, running up to
+ * cfg->dl_parallel transfers at the same time (and no more than
+ * cfg->dl_perhost to a single host) */
+static void download_all(const struct historytype *menu, const struct gopherusconfig *cfg, const struct menuindex *idx) {
+  struct dlslot *slot[DL_MAXPARALLEL];
+  struct net_pollevent ev[DL_MAXPARALLEL + 1]; /* the sockets and the keyboard */
+  struct net_pollset *ps;
+  unsigned char *done; /* per-item flag: item processed already (or not downloadable) */
+  long firstlinkline = idx->firstlinkline, lastlinkline = idx->lastlinkline;
+  long firstpending = firstlinkline, queued, x;
+  int active = 0, i, evcount, keyflag, abortflag = 0;
+  unsigned short okcount = 0, skipcount = 0, failcount = 0;
+  time_t lastdraw = 0;
+  char msg[96];
+
+  if (firstlinkline < 0) return;
+  done = calloc(lastlinkline - firstlinkline + 1, 1);
+  ps = net_pollset_new();
+  if ((done == NULL) || (ps == NULL)) {
+    free(done);
+    net_pollset_free(ps);
+    set_statusbar("!Out of memory");
+    return;
+  }
+  kbd_watch(ps, cfg);
+  for (x = firstlinkline; x <= lastlinkline; x++) {
+    if (isitemtypedownloadable(idx->line[x].itemtype) == 0) done[x - firstlinkline] = 1;
+  }
+
+  for (;;) {
+    long timeout = mintimeout(1000, glob_kbdwait); /* the progress view is refreshed every second */
+
+    /* start new transfers while there are free slots and pending items */
+    queued = 0;
+    while ((firstpending <= lastlinkline) && (done[firstpending - firstlinkline] != 0)) firstpending++;
+    for (x = firstpending; x <= lastlinkline; x++) {
+      const struct menuspan *l = &(idx->line[x]);
+      char host[MAXHOSTLEN], selector[MAXSELLEN];
+      struct dlslot *s;
+      int samehost = 0;
+      if (done[x - firstlinkline] != 0) continue;
+      if (active >= cfg->dl_parallel) {
+        queued++;
+        continue;
+      }
+      /* respect the per-host limit */
+      menu_field(host, sizeof(host), menu->cache, l->host, l->hostlen);
+      for (i = 0; i < active; i++) {
+        if (strcasecmp(slot[i]->x->host, host) == 0) samehost++;
+      }
+      if (samehost >= cfg->dl_perhost) {
+        queued++;
+        continue;
+      }
+      done[x - firstlinkline] = 1;
+      s = malloc(sizeof(struct dlslot));
+      if (s == NULL) {
+        failcount++;
+        continue;
+      }
+      /* generate a filename for the target, skip or rename it if a file with
+       * the same name exists already */
+      menu_field(selector, sizeof(selector), menu->cache, l->sel, l->sellen);
+      genfnamefromselector(s->fname, sizeof(s->fname), selector);
+      if (s->fname[0] == 0) {
+        free(s);
+        failcount++;
+        continue;
+      }
+      if (fileexists(s->fname) != 0) {
+        if ((cfg->dl_rename == 0) || (fname_makeunique(s->fname, sizeof(s->fname)) != 0)) {
+          free(s);
+          skipcount++;
+          continue;
+        }
+      }
+      s->events = 0;
+      s->x = xfer_new(menu_itemproto(menu, host, l->port), host, l->port, selector, s->buff, sizeof(s->buff), s->fname, ps);
+      if (s->x == NULL) {
+        free(s);
+        failcount++;
+        continue;
+      }
+      slot[active++] = s;
+      lastdraw = 0; /* force a redraw */
+    }
+
+    /* nothing running, nothing could be started: all done */
+    if (active == 0) break;
+
+    /* refresh the progress view once every second */
+    if (time(NULL) != lastdraw) {
+      lastdraw = time(NULL);
+      download_all_draw(slot, active, okcount, skipcount, failcount, queued, cfg);
+    }
+
+    /* wait for network events or a key press (or until a transfer needs to
+     * be stepped anyway), then make all transfers progress */
+    for (i = 0; i < active; i++) timeout = mintimeout(timeout, xfer_timeout(slot[i]->x));
+    evcount = net_pollset_wait(ps, ev, DL_MAXPARALLEL + 1, timeout);
+    keyflag = kbd_hit(ev, evcount, cfg);
+    for (; evcount > 0; evcount--) {
+      for (i = 0; i < active; i++) {
+        if (slot[i]->x == ev[evcount - 1].userdata) slot[i]->events |= ev[evcount - 1].events;
+      }
+    }
+    for (i = 0; i < active; i++) {
+      int state = xfer_step(slot[i]->x, slot[i]->events);
+      slot[i]->events = 0;
+      if ((state != XFER_DONE) && (state != XFER_FAIL)) continue;
+      if (state == XFER_DONE) {
+        okcount++;
+      } else {
+        failcount++;
+      }
+      xfer_free(slot[i]->x);
+      free(slot[i]);
+      slot[i--] = slot[--active];
+      lastdraw = 0;
+    }
+
+    /* ESC aborts all transfers */
+    if (keyflag != 0) {
+      if (getfunckey(cfg) == KEY_ESC) {
+        abortflag = 1;
+        break;
+      }
+    }
+  }
+
+  /* free whatever is still running (partial files are removed) */
+  for (i = 0; i < active; i++) {
+    xfer_free(slot[i]->x);
+    free(slot[i]);
+  }
+  net_pollset_free(ps);
+  free(done);
+
+  snprintf(msg, sizeof(msg), "%s%u file(s) saved, %u skipped, %u failed", (abortflag != 0) ? "!Aborted: " : "", okcount, skipcount, failcount);
+  set_statusbar(msg);
+}
+
+
+/* waits up to timeout ms (forever if negative) for a key press, or for the
+ * sockets of the prefetcher and of the pre-connector to get ready. returns
+ * non-zero if a key is waiting. */
+static int wait_background(long timeout) {
+  struct net_pollset *ps, *bg[2];
+  struct net_pollevent ev[3]; /* the keyboard and both sets */
+  int i, evcount;
+
+  bg[0] = prefetch_pollset();
+  bg[1] = preconn_pollset();
+  /* data kept by the TLS layer does not make the descriptor of a set
+   * readable, only a look at the set itself tells */
+  for (i = 0; i < 2; i++) {
+    if ((bg[i] != NULL) && (net_pollset_wait(bg[i], ev, 1, 0) > 0)) return(0);
+  }
+  /* the set waiting on all of it at once is created on the first call and
+   * freed on exit. the prefetcher and the pre-connector create their sets
+   * when first needed and keep them until exit too, so these only have to
+   * be added once they show up */
+  if (glob_bgwait.ws == NULL) {
+    glob_bgwait.ws = net_pollset_new();
+    glob_bgwait.nested = ((glob_bgwait.ws != NULL) && (net_pollset_addfd(glob_bgwait.ws, ui_getfd(), NULL) == 0));
+  }
+  for (i = 0; i < 2; i++) {
+    if ((bg[i] == NULL) || (bg[i] == glob_bgwait.bg[i])) continue;
+    glob_bgwait.bg[i] = bg[i];
+    if (glob_bgwait.nested && (net_pollset_addfd(glob_bgwait.ws, net_pollset_fd(bg[i]), bg[i]) != 0)) glob_bgwait.nested = 0;
+  }
+  if (glob_bgwait.nested) {
+    evcount = net_pollset_wait(glob_bgwait.ws, ev, 3, timeout);
+    for (i = 0; i < evcount; i++) {
+      if (ev[i].userdata == NULL) return(1);
+    }
+    return(0);
+  }
+  /* all of it cannot be waited on at once: wait on a single set, looking at
+   * the keyboard every KBD_POLL ms (events are level-triggered, those of the
+   * set left aside will still be there) */
+  ps = (bg[0] != NULL) ? bg[0] : (bg[1] != NULL) ? bg[1] : glob_bgwait.ws;
+  if ((timeout < 0) || (timeout > KBD_POLL)) timeout = KBD_POLL;
+  if (ps != NULL) net_pollset_wait(ps, ev, 1, timeout);
+  return(ui_kbhit());
+}
+
+
+/* waits for a key press. meanwhile, the menu item pointed at by url is
+ * prefetched, if it is something that is likely to be displayed next (but
+ * only once the menu itself has been received), and its server is
+ * connected to in any case */
+static unsigned char getfunckey_prefetch(struct historytype *node, const struct gopherusconfig *cfg, const char *url) {
+  char tmpurl[MAXURLLEN], host[MAXHOSTLEN], selector[MAXSELLEN], itemtype;
+  unsigned short port;
+  unsigned char proto = PARSEURL_ERROR;
+
+  if (glob_pageload.x != NULL) return(getfunckey_pageload(node, cfg));
+
+  if (url[0] != 0) {
+    snprintf(tmpurl, sizeof(tmpurl), "%s", url); /* parsegopherurl() alters it */
+    proto = parsegopherurl(tmpurl, host, sizeof(host), &port, &itemtype, selector, sizeof(selector));
+  }
+  if (((proto == PARSEURL_PROTO_GOPHER) || (proto == PARSEURL_PROTO_GOPHERS) || (proto == PARSEURL_PROTO_HTTP)) && (host[0] != '#') && ((itemtype == '0') || (itemtype == '1') || (itemtype == 'h'))) {
+    prefetch_select(proto, host, port, itemtype, selector);
+  } else {
+    prefetch_select(0, NULL, 0, 0, NULL);
+  }
+  if (((proto == PARSEURL_PROTO_GOPHER) || (proto == PARSEURL_PROTO_GOPHERS) || (proto == PARSEURL_PROTO_HTTP)) && (host[0] != '#')) {
+    preconn_select(host, port);
+  } else {
+    preconn_select(NULL, 0);
+  }
+
+  /* the background work goes on until a key is pressed, without waking up
+   * for anything else than its own sockets and deadlines */
+  for (;;) {
+    long timeout = mintimeout(prefetch_timeout(), preconn_timeout());
+    if (timeout < 0) break; /* nothing left to do but wait for the key */
+    if (wait_background(timeout) != 0) break;
+    prefetch_step(0);
+    preconn_step(0);
+  }
+  return(getfunckey(cfg));
+}
+
+
+/* size of a menuindex of linecount lines */
+static long menu_indexsize(long linecount) {
+  return(sizeof(struct menuindex) + ((linecount > 1) ? linecount - 1 : 0) * sizeof(struct menuspan));
+}
+
+
+/* displays the menu held by the cache of history, using the span table of
+ * *pidx (that is completed as the menu arrives). once the menu is complete
+ * the table is handed over to the page cache, and *owned is reset. */
+static int display_menu_idx(struct historytype **history, const struct gopherusconfig *cfg, struct menuindex **pidx, int *owned) {
+  struct menuindex *idx = *pidx;
+  const struct menuspan *l;
   long bufferlen, linecount;
-  char *line_description[MAXMENULINES];
-  unsigned short line_selector_off[MAXMENULINES];
-  unsigned short line_host_off[MAXMENULINES];
-  unsigned short line_port[MAXMENULINES];
-  unsigned char line_itemtype[MAXMENULINES];
-  char curURL[MAXURLLEN];
+  char curURL[MAXURLLEN], linebuff[256];
+  char host[MAXHOSTLEN], selector[MAXSELLEN];
   long x;
   long *selectedline = &(*history)->displaymemory[0];
   long *screenlineoffset = &(*history)->displaymemory[1];
@@ -1190,24 +1929,46 @@ static int display_menu(struct historytype **history, const struct gopherusconfi
   unsigned char keypress;
 
   if (*screenlineoffset < 0) *screenlineoffset = 0;
-
-  /* copy the history content into buffer - we need to do this because we'll perform changes on the data */
-  bufferlen = (*history)->cachesize;
-  if (bufferlen >= buffersize) bufferlen = buffersize - 1; /* -1 for the final nul terminator */
-  memcpy(buffer, (*history)->cache, bufferlen);
-  buffer[bufferlen] = 0;
-  /* */
-  linecount = menu_explode(buffer, bufferlen, line_itemtype, line_description, line_selector_off, line_host_off, line_port, MAXMENULINES, &firstlinkline, &lastlinkline);
-
-  /* if there is at least one position, and nothing is selected yet, make it active */
-  if ((firstlinkline >= 0) && (*selectedline < 0)) *selectedline = firstlinkline;
+  prefetch_newmenu();
 
   for (;;) {
     curURL[0] = 0;
 
+    /* the page got lost while it was being received (see page_store) */
+    if ((*history)->cache == NULL) return(DISPLAY_ORDER_BACK);
+
+    /* index whatever complete lines came since last time, the page itself
+     * is left untouched */
+    bufferlen = (*history)->cachesize;
+    if (glob_pageload.x != NULL) {
+      while ((bufferlen > idx->parsedlen) && ((*history)->cache[bufferlen - 1] != '\n')) bufferlen--;
+    }
+    if (bufferlen > idx->parsedlen) menu_index(idx, (*history)->cache, bufferlen);
+    if ((glob_pageload.x == NULL) && (idx->trimmed == 0)) {
+      menu_trim(idx);
+      /* the menu is complete: keep its table along with the page */
+      if (*owned) {
+        struct menuindex *shrunk = realloc(idx, menu_indexsize(idx->linecount));
+        if (shrunk != NULL) *pidx = idx = shrunk;
+        if (pagecache_setindex((*history)->cache, idx, menu_indexsize(idx->linecount)) == 0) *owned = 0;
+      }
+    }
+    linecount = idx->linecount;
+    firstlinkline = idx->firstlinkline;
+    lastlinkline = idx->lastlinkline;
+
+    /* if there is at least one position, and nothing is selected yet, make it active */
+    if ((firstlinkline >= 0) && (*selectedline < 0)) *selectedline = firstlinkline;
+    /* a position remembered from an earlier visit may be past what has
+     * been received */
+    if ((*selectedline >= linecount) && (glob_pageload.x == NULL)) *selectedline = lastlinkline;
+
     /* if any position is selected, fetch the selected values and print the url in status bar */
-    if (*selectedline >= 0) {
-      buildgopherurl(curURL, sizeof(curURL), PARSEURL_PROTO_GOPHER, line_description[*selectedline] + line_host_off[*selectedline], line_port[*selectedline], line_itemtype[*selectedline] & 127, line_description[*selectedline] + line_selector_off[*selectedline]);
+    if ((*selectedline >= 0) && (*selectedline < linecount)) {
+      l = &(idx->line[*selectedline]);
+      menu_field(host, sizeof(host), (*history)->cache, l->host, l->hostlen);
+      menu_field(selector, sizeof(selector), (*history)->cache, l->sel, l->sellen);
+      buildgopherurl(curURL, sizeof(curURL), menu_itemproto(*history, host, l->port), host, l->port, l->itemtype & 127, selector);
       if (glob_statusbar[0] == 0) set_statusbar(curURL);
     }
     /* start drawing lines of the menu */
@@ -1221,7 +1982,8 @@ static int display_menu(struct historytype **history, const struct gopherusconfi
         } else {
           attr = cfg->attr_menutype;
         }
-        switch (line_itemtype[x] & 127) {
+        l = &(idx->line[x]);
+        switch (l->itemtype & 127) {
           case 'i': /* message */
             break;
           case 'h': /* html */
@@ -1258,7 +2020,7 @@ static int display_menu(struct historytype **history, const struct gopherusconfi
             prefix = "UNK";
             break;
         }
-        if ((line_itemtype[x] & 128) && (prefix != NULL)) prefix = "   ";
+        if ((l->itemtype & 128) && (prefix != NULL)) prefix = "   ";
         z = 0;
         if (prefix != NULL) {
           drawstr(prefix, attr, 0, 1 + (x - *screenlineoffset), 4);
@@ -1267,19 +2029,19 @@ static int display_menu(struct historytype **history, const struct gopherusconfi
         /* select foreground color */
         if (x == *selectedline) {
           attr = cfg->attr_menucurrent;
-        } else if ((line_itemtype[x] & 127) == 'i') {
+        } else if ((l->itemtype & 127) == 'i') {
           attr = cfg->attr_textnorm;
-        } else if ((line_itemtype[x] & 127) == '3') {
+        } else if ((l->itemtype & 127) == '3') {
           attr = cfg->attr_menuerr;
         } else {
-          if (isitemtypeselectable(line_itemtype[x] & 127) != 0) {
+          if (isitemtypeselectable(l->itemtype & 127) != 0) {
             attr = cfg->attr_menuselectable;
           } else {
             attr = cfg->attr_textnorm;
           }
         }
         /* print the the line's description */
-        drawstr(line_description[x], attr, 0 + z, 1 + (x - *screenlineoffset), ui_getcolcount() - z);
+        drawstr(menu_field(linebuff, sizeof(linebuff), (*history)->cache, l->desc, l->desclen), attr, 0 + z, 1 + (x - *screenlineoffset), ui_getcolcount() - z);
       } else { /* x >= linecount */
         drawstr("", cfg->attr_textnorm, 0, 1 + (x - *screenlineoffset), ui_getcolcount());
       }
@@ -1288,7 +2050,9 @@ static int display_menu(struct historytype **history, const struct gopherusconfi
     draw_statusbar(cfg);
     ui_refresh();
     /* wait for a keypress */
-    keypress = getfunckey(cfg);
+    keypress = getfunckey_prefetch(*history, cfg, curURL);
+    /* moving around stays within what has been received so far */
+    if ((keypress != KEY_NONE) && (*selectedline >= linecount)) *selectedline = lastlinkline;
     switch (keypress) {
       case KEY_BACKSPC:
         return(DISPLAY_ORDER_BACK);
@@ -1302,7 +2066,8 @@ static int display_menu(struct historytype **history, const struct gopherusconfi
       case KEY_SAVE_AS:
       case KEY_ENTER:
         if (*selectedline < 0) break; /* no effect if no menu entry is selected */
-        if (((line_itemtype[*selectedline] & 127) == '7') && (keypress != KEY_SAVE_AS)) { /* a query needs to be issued */
+        l = &(idx->line[*selectedline]);
+        if (((l->itemtype & 127) == '7') && (keypress != KEY_SAVE_AS)) { /* a query needs to be issued */
           char query[MAXQUERYLEN];
           char *finalselector;
           size_t finalselectorsz;
@@ -1310,14 +2075,16 @@ static int display_menu(struct historytype **history, const struct gopherusconfi
           draw_statusbar(cfg);
           query[0] = 0;
           if (editstring(query, sizeof(query), 64, 15, ui_getrowcount() - 1, cfg->attr_statusbarinfo) == 0) break;
-          finalselectorsz = strlen(line_description[*selectedline] + line_selector_off[*selectedline]) + strlen(query) + 2; /* add 1 for the TAB, and 1 for the NULL terminator */
+          finalselectorsz = l->sellen + strlen(query) + 2; /* add 1 for the TAB, and 1 for the NULL terminator */
           finalselector = malloc(finalselectorsz);
           if (finalselector == NULL) {
             set_statusbar("!Out of memory");
             break;
           }
-          snprintf(finalselector, finalselectorsz, "%s\t%s", line_description[*selectedline] + line_selector_off[*selectedline], query);
-          history_push(history, PARSEURL_PROTO_GOPHER, line_description[*selectedline] + line_host_off[*selectedline], line_port[*selectedline], line_itemtype[*selectedline] & 127, finalselector);
+          memcpy(finalselector, (*history)->cache + l->sel, l->sellen);
+          snprintf(finalselector + l->sellen, finalselectorsz - l->sellen, "\t%s", query);
+          menu_field(host, sizeof(host), (*history)->cache, l->host, l->hostlen);
+          history_push(history, menu_itemproto(*history, host, l->port), host, l->port, l->itemtype & 127, finalselector);
           free(finalselector);
           return(DISPLAY_ORDER_NONE);
         } else { /* itemtype is anything else than type 7 */
@@ -1335,7 +2102,7 @@ static int display_menu(struct historytype **history, const struct gopherusconfi
           if (tmpproto == PARSEURL_ERROR) {
             set_statusbar("!Bad URL");
             break;
-          } else if ((tmpproto == PARSEURL_PROTO_GOPHER) || (tmpproto == PARSEURL_PROTO_HTTP)) {
+          } else if ((tmpproto == PARSEURL_PROTO_GOPHER) || (tmpproto == PARSEURL_PROTO_GOPHERS) || (tmpproto == PARSEURL_PROTO_HTTP)) {
             history_push(history, tmpproto, tmphost, tmpport, tmpitemtype, tmpselector);
             return(DISPLAY_ORDER_NONE);
           } else {
@@ -1345,23 +2112,15 @@ static int display_menu(struct historytype **history, const struct gopherusconfi
         }
         break;
       case KEY_DOWN_ALL: /* download all items from current directory */
-        if (firstlinkline >= 0) {
-          for (x = firstlinkline; x <= lastlinkline; x++) {
-            char fname[32];
-            char b[512];
-            /* skip not downloadable items */
-            if (isitemtypedownloadable(line_itemtype[x]) == 0) continue;
-            /* generate a filename for the target */
-            genfnamefromselector(fname, sizeof(fname), line_description[x] + line_selector_off[x]);
-            /* TODO watch out for already-existing files! */
-            /* download the file */
-            loadfile_buff(PARSEURL_PROTO_GOPHER, line_description[x] + line_host_off[x], line_port[x], line_description[x] + line_selector_off[x], b, sizeof(b), fname, cfg);
-          }
-        }
+        prefetch_cancel();
+        download_all(*history, cfg, idx);
         break;
       case KEY_DEL:
-        if ((history[0]->host[0] == '#') && (history[0]->host[1] == 'w')) {
-          delbookmark(line_description[*selectedline] + line_host_off[*selectedline], line_port[*selectedline], line_description[*selectedline] + line_selector_off[*selectedline], cfg);
+        if ((history[0]->host[0] == '#') && (history[0]->host[1] == 'w') && (*selectedline >= 0)) {
+          l = &(idx->line[*selectedline]);
+          menu_field(host, sizeof(host), (*history)->cache, l->host, l->hostlen);
+          menu_field(selector, sizeof(selector), (*history)->cache, l->sel, l->sellen);
+          delbookmark(host, l->port, selector, cfg);
           return(DISPLAY_ORDER_REFR);
         }
         break;
@@ -1377,8 +2136,8 @@ static int display_menu(struct historytype **history, const struct gopherusconfi
         return(DISPLAY_ORDER_NONE);
         break;
       case KEY_JMP_MAIN: /* server's main menu (gopher only) */
-        if (((*history)->protocol == PARSEURL_PROTO_GOPHER) && ((*history)->host[0] != '#')) {
-          history_push(history, PARSEURL_PROTO_GOPHER, (*history)->host, (*history)->port, '1', "");
+        if ((((*history)->protocol == PARSEURL_PROTO_GOPHER) || ((*history)->protocol == PARSEURL_PROTO_GOPHERS)) && ((*history)->host[0] != '#')) {
+          history_push(history, (*history)->protocol, (*history)->host, (*history)->port, '1', "");
           return(DISPLAY_ORDER_NONE);
         }
         break;
@@ -1393,7 +2152,7 @@ static int display_menu(struct historytype **history, const struct gopherusconfi
         if (*selectedline > firstlinkline) {
           long prevlink = *selectedline;
           /* find the next item that is selectable */
-          while (isitemtypeselectable(line_itemtype[--prevlink]) == 0);
+          while (isitemtypeselectable(idx->line[--prevlink].itemtype) == 0);
           /* if prevlink is on screen, select it */
           if (prevlink >= *screenlineoffset) {
             *selectedline = prevlink;
@@ -1419,7 +2178,7 @@ static int display_menu(struct historytype **history, const struct gopherusconfi
           long i;
           for (i = *screenlineoffset; i < (*screenlineoffset + ui_getrowcount() - 2); i++) {
             if (i >= linecount) break;
-            if (isitemtypeselectable(line_itemtype[i]) != 0) {
+            if (isitemtypeselectable(idx->line[i].itemtype) != 0) {
               *selectedline = i;
             }
           }
@@ -1439,7 +2198,7 @@ static int display_menu(struct historytype **history, const struct gopherusconfi
         if (*selectedline < lastlinkline) {
           long nextlink = *selectedline;
           /* find the next selectable item */
-          while (isitemtypeselectable(line_itemtype[++nextlink]) == 0);
+          while (isitemtypeselectable(idx->line[++nextlink].itemtype) == 0);
           /* if next link is within screen area, select it */
           if ((nextlink >= *screenlineoffset) && (nextlink <= (*screenlineoffset + (ui_getrowcount() - 3)))) {
             *selectedline = nextlink;
@@ -1471,7 +2230,7 @@ static int display_menu(struct historytype **history, const struct gopherusconfi
           long i;
           for (i = *screenlineoffset; i < (*screenlineoffset + ui_getrowcount() - 2); i++) {
             if (i >= linecount) break;
-            if (isitemtypeselectable(line_itemtype[i]) != 0) {
+            if (isitemtypeselectable(idx->line[i].itemtype) != 0) {
               *selectedline = i;
               break;
             }
@@ -1490,98 +2249,124 @@ static int display_menu(struct historytype **history, const struct gopherusconfi
 }
 
 
-static int display_text(struct historytype **history, const struct gopherusconfig *cfg, char *buffer, long buffersize, int txtformat) {
-  char *txtptr;
-  char linebuff[128];
-  long x, y, firstline, lastline, bufferlen;
-  int eof_flag;
-  int screenw = ui_getcolcount();
+static int display_menu(struct historytype **history, const struct gopherusconfig *cfg) {
+  struct menuindex *idx;
+  int owned = 0, res;
 
-  if (screenw > (int)sizeof(linebuff) - 1) screenw = (int)sizeof(linebuff) - 1;
+  /* the menu has been indexed already, unless the screen got resized since */
+  idx = pagecache_getindex((*history)->cache);
+  if ((idx != NULL) && (idx->width != ui_getcolcount())) idx = NULL;
+  if (idx == NULL) {
+    idx = malloc(menu_indexsize(MAXMENULINES));
+    if (idx == NULL) {
+      set_statusbar("!Out of memory");
+      return(DISPLAY_ORDER_BACK);
+    }
+    idx->parsedlen = 0;
+    idx->linecount = 0;
+    idx->firstlinkline = -1;
+    idx->lastlinkline = -1;
+    idx->width = ui_getcolcount();
+    idx->trimmed = 0;
+    owned = 1;
+  }
 
-  snprintf(linebuff, sizeof(linebuff), "file loaded (%ld bytes)", (*history)->cachesize);
-  set_statusbar(linebuff);
+  res = display_menu_idx(history, cfg, &idx, &owned);
+  if (owned) free(idx);
+  return(res);
+}
 
-  /* copy the content of the file into buffer, and take care to modify dangerous chars and apply formating (if any) */
-  bufferlen = 0;
+
+/* state of the conversion of a text page for display, kept between calls so
+ * the page can be converted piece by piece as it arrives */
+struct txtconv {
+  long srclen;          /* source bytes converted already */
+  int lastcharwasaspace;
+  int insidetoken;
+  int insidescript;
+  int insidebody;
+  int insidespecialchar;
+  char token[8];
+  char specialchar[8];
+};
+
+
+/* converts the source bytes that arrived since the previous call, appending
+ * the result to the bufferlen bytes of buffer, taking care to modify
+ * dangerous chars and apply formating (if any). returns the new length. */
+static long txt_convert(struct txtconv *s, const signed char *src, long srclen, char *buffer, long bufferlen, long buffersize, int txtformat) {
+  long x, y;
   if (txtformat == TXT_FORMAT_HTM) { /* HTML format */
-    int lastcharwasaspace = 0;
-    int insidetoken = -1;
-    int insidescript = 0;
-    int insidebody = 0;
-    char token[8];
-    char specialchar[8];
-    int insidespecialchar = -1;
-    for (x = 0; x < (*history)->cachesize; x++) {
+    for (x = s->srclen; x < srclen; x++) {
       if ((bufferlen + 4) > buffersize) break;
-      if ((insidescript != 0) && (insidetoken < 0) && ((*history)->cache[x] != '<')) continue;
-      switch ((*history)->cache[x]) {
+      if ((s->insidescript != 0) && (s->insidetoken < 0) && (src[x] != '<')) continue;
+      switch (src[x]) {
         case '\t':  /* replace whitespaces by single spaces */
         case '\n':
         case '\r':
         case ' ':
-          if (insidetoken >= 0) {
-            if (insidetoken < 7) token[insidetoken++] = 0;
+          if (s->insidetoken >= 0) {
+            if (s->insidetoken < 7) s->token[s->insidetoken++] = 0;
             continue;
           }
-          if (lastcharwasaspace == 0) {
+          if (s->lastcharwasaspace == 0) {
             buffer[bufferlen++] = ' ';
-            lastcharwasaspace = 1;
+            s->lastcharwasaspace = 1;
           }
           break;
         case '<':
-          lastcharwasaspace = 0;
-          insidetoken = 0;
+          s->lastcharwasaspace = 0;
+          s->insidetoken = 0;
           break;
         case '>':
-          lastcharwasaspace = 0;
-          if (insidetoken < 0) continue;
-          token[insidetoken] = 0;
-          insidetoken = -1;
-          if ((strcasecmp(token, "/p") == 0) || (strcasecmp(token, "br") == 0) || (strcasecmp(token, "/tr") == 0) || (strcasecmp(token, "/title") == 0)) {
+          s->lastcharwasaspace = 0;
+          if (s->insidetoken < 0) continue;
+          s->token[s->insidetoken] = 0;
+          s->insidetoken = -1;
+          if ((strcasecmp(s->token, "/p") == 0) || (strcasecmp(s->token, "br") == 0) || (strcasecmp(s->token, "/tr") == 0) || (strcasecmp(s->token, "/title") == 0)) {
             buffer[bufferlen++] = '\n';
-          } else if (strcasecmp(token, "script") == 0) {
-            insidescript = 1;
-          } else if (strcasecmp(token, "body") == 0) {
-            insidebody = 1;
-          } else if (strcasecmp(token, "/script") == 0) {
-            insidescript = 0;
+          } else if (strcasecmp(s->token, "script") == 0) {
+            s->insidescript = 1;
+          } else if (strcasecmp(s->token, "body") == 0) {
+            s->insidebody = 1;
+          } else if (strcasecmp(s->token, "/script") == 0) {
+            s->insidescript = 0;
           }
           break;
         default:
-          lastcharwasaspace = 0;
-          if (insidetoken >= 0) {
-            if (insidetoken < 7) token[insidetoken++] = (*history)->cache[x];
+          s->lastcharwasaspace = 0;
+          if (s->insidetoken >= 0) {
+            if (s->insidetoken < 7) s->token[s->insidetoken++] = src[x];
             continue;
           }
-          if ((insidespecialchar < 0) && ((*history)->cache[x] == '&')) {
-            insidespecialchar = 0;
+          if ((s->insidespecialchar < 0) && (src[x] == '&')) {
+            s->insidespecialchar = 0;
             continue;
           }
-          if ((insidespecialchar >= 0) && (insidespecialchar < 7)) {
-            if ((*history)->cache[x] != ';') {
-              specialchar[insidespecialchar++] = (*history)->cache[x];
+          if ((s->insidespecialchar >= 0) && (s->insidespecialchar < 7)) {
+            if (src[x] != ';') {
+              s->specialchar[s->insidespecialchar++] = src[x];
               continue;
             }
-            specialchar[insidespecialchar] = 0;
-            if (strcasecmp(specialchar, "nbsp") == 0) {
+            s->specialchar[s->insidespecialchar] = 0;
+            if (strcasecmp(s->specialchar, "nbsp") == 0) {
               buffer[bufferlen++] = ' ';
             } else {
               buffer[bufferlen++] = '_';
             }
-            insidespecialchar = -1;
+            s->insidespecialchar = -1;
             continue;
           }
-          if ((*history)->cache[x] < 32) break; /* ignore ascii control chars */
-          if (insidebody == 0) break; /* ignore everything until <body> starts */
-          buffer[bufferlen++] = (*history)->cache[x]; /* copy everything else */
+          if (src[x] < 32) break; /* ignore ascii control chars */
+          if (s->insidebody == 0) break; /* ignore everything until <body> starts */
+          buffer[bufferlen++] = src[x]; /* copy everything else */
           break;
       }
     }
   } else { /* process content as raw text */
-    for (x = 0; x < (*history)->cachesize; x++) {
+    for (x = s->srclen; x < srclen; x++) {
       if (bufferlen + 10 > buffersize) break;
-      switch ((*history)->cache[x]) {
+      switch (src[x]) {
         case 8:     /* replace tabs by 8 spaces */
           for (y = 0; y < 8; y++) buffer[bufferlen++] = ' ';
           break;
@@ -1592,20 +2377,57 @@ static int display_text(struct historytype **history, const struct gopherusconfi
         case 127:   /* as well as DEL chars */
           break;
         default:
-          if (((*history)->cache[x] >= 0) && ((*history)->cache[x] < 32)) break; /* ignore ascii control chars */
-          buffer[bufferlen++] = (*history)->cache[x]; /* copy everything else */
+          if ((src[x] >= 0) && (src[x] < 32)) break; /* ignore ascii control chars */
+          buffer[bufferlen++] = src[x]; /* copy everything else */
           break;
       }
     }
-    /* check if there is a single . on the last line */
-    if ((buffer[bufferlen - 1] == '\n') && (buffer[bufferlen - 2] == '.')) bufferlen -= 2;
   }
-  /* terminate the buffer with a nul terminator */
-  buffer[bufferlen] = 0;
+  s->srclen = srclen;
+  return(bufferlen);
+}
+
+
+static int display_text(struct historytype **history, const struct gopherusconfig *cfg, char *buffer, long buffersize, int txtformat) {
+  char *txtptr;
+  char linebuff[128];
+  long y, firstline, lastline, bufferlen;
+  int eof_flag, complete = 0;
+  int screenw = ui_getcolcount();
+  struct txtconv conv;
+
+  if (screenw > (int)sizeof(linebuff) - 1) screenw = (int)sizeof(linebuff) - 1;
+
+  memset(&conv, 0, sizeof(conv));
+  conv.insidetoken = -1;
+  conv.insidespecialchar = -1;
+  bufferlen = 0;
+  buffer[0] = 0;
+
   /* display the file on screen */
   firstline = 0;
   lastline = ui_getrowcount() - 3;
   for (;;) { /* display-control loop */
+    /* the page got lost while it was being received (see page_store) */
+    if ((*history)->cache == NULL) return(DISPLAY_ORDER_BACK);
+    /* convert whatever arrived since last time */
+    if ((*history)->cachesize > conv.srclen) {
+      bufferlen = txt_convert(&conv, (*history)->cache, (*history)->cachesize, buffer, bufferlen, buffersize, txtformat);
+      buffer[bufferlen] = 0;
+    }
+    if ((glob_pageload.x == NULL) && (complete == 0)) {
+      complete = 1;
+      /* check if there is a single . on the last line */
+      if ((txtformat != TXT_FORMAT_HTM) && (bufferlen >= 2) && (buffer[bufferlen - 1] == '\n') && (buffer[bufferlen - 2] == '.')) {
+        bufferlen -= 2;
+        buffer[bufferlen] = 0;
+      }
+      if (glob_statusbar[0] == 0) {
+        snprintf(linebuff, sizeof(linebuff), "file loaded (%ld bytes)", (*history)->cachesize);
+        set_statusbar(linebuff);
+      }
+    }
+
     y = 0;
     for (txtptr = buffer; txtptr != NULL; ) {
       txtptr = wordwrap(txtptr, linebuff, screenw);
@@ -1627,7 +2449,7 @@ static int display_text(struct historytype **history, const struct gopherusconfi
     draw_statusbar(cfg);
     ui_refresh();
 
-    switch (getfunckey(cfg)) {
+    switch (getfunckey_pageload(*history, cfg)) {
       case KEY_BACKSPC:
         return(DISPLAY_ORDER_BACK);
         break;
@@ -1649,8 +2471,8 @@ static int display_text(struct historytype **history, const struct gopherusconfi
         return(DISPLAY_ORDER_NONE);
         break;
       case KEY_JMP_MAIN: /* server's main menu (gopher only) */
-        if (((*history)->protocol == PARSEURL_PROTO_GOPHER) && ((*history)->host[0] != '#')) {
-          history_push(history, PARSEURL_PROTO_GOPHER, (*history)->host, (*history)->port, '1', "");
+        if ((((*history)->protocol == PARSEURL_PROTO_GOPHER) || ((*history)->protocol == PARSEURL_PROTO_GOPHERS)) && ((*history)->host[0] != '#')) {
+          history_push(history, (*history)->protocol, (*history)->host, (*history)->port, '1', "");
           return(DISPLAY_ORDER_NONE);
         }
         break;
@@ -1762,6 +2584,11 @@ int main(int argc, char **argv) {
   char *fatalerr = NULL;
   char *buffer = NULL;
   char *saveas = NULL;
+  char *batchlist = NULL;
+  struct crawl_opts crawlopts;
+  char *packfile = NULL;
+  int reload = 0; /* next page is to be fetched anew, not from the disk cache */
+  int exitcode = 0;
   struct historytype *history = NULL;
   struct gopherusconfig cfg;
 
@@ -1773,6 +2600,9 @@ int main(int argc, char **argv) {
 
   /* Load configuration (or defaults) */
   if (loadcfg(&cfg) != 0) return(1);
+  memset(&crawlopts, 0, sizeof(crawlopts));
+  crawlopts.maxdepth = cfg.crawl_depth;
+  crawlopts.delay = cfg.crawl_delay;
 
   if (argc > 1) { /* if some params have been received, parse them */
     char itemtype;
@@ -1785,6 +2615,11 @@ int main(int argc, char **argv) {
       /* catch -o outfile */
       if ((strcmp(argv[i], "-o") == 0) && (saveas == NULL)) {
         i++;
+        if ((i < argc) && (strcmp(argv[i], "-") == 0)) { /* stream to stdout */
+          cfg.notui = 2;
+          saveas = argv[i];
+          continue;
+        }
         if ((i < argc) && (argv[i][0] != '-')) {
           cfg.notui = 1; /* switch into non-interactive mode */
           saveas = argv[i];
@@ -1795,6 +2630,90 @@ int main(int argc, char **argv) {
         }
       }
 
+      /* catch -b list: batch mode, "url outfile" pairs are read from list */
+      if ((strcmp(argv[i], "-b") == 0) && (batchlist == NULL)) {
+        i++;
+        if (i >= argc) {
+          ui_puts("Error: -b must be followed by a list file (or - for stdin)");
+          return(1);
+        }
+        cfg.notui = 1;
+        batchlist = argv[i];
+        continue;
+      }
+
+      /* catch -m outdir: mirror the url into outdir */
+      if ((strcmp(argv[i], "-m") == 0) && (crawlopts.outdir == NULL)) {
+        i++;
+        if ((i >= argc) || (argv[i][0] == 0)) {
+          ui_puts("Error: -m must be followed by a directory");
+          return(1);
+        }
+        cfg.notui = 1;
+        crawlopts.outdir = argv[i];
+        continue;
+      }
+
+      /* catch -d depth, overrides crawl.depth from the config file */
+      if (strcmp(argv[i], "-d") == 0) {
+        long v;
+        i++;
+        if ((i >= argc) || (cfg_getnum(&v, argv[i], 0, 255) != 0)) {
+          ui_puts("Error: -d must be followed by a depth (0-255)");
+          return(1);
+        }
+        crawlopts.maxdepth = v;
+        continue;
+      }
+
+      /* catch -H hostglob and -S selglob, the mirror filters */
+      if ((strcmp(argv[i], "-H") == 0) || (strcmp(argv[i], "-S") == 0)) {
+        i++;
+        if (i >= argc) {
+          ui_puts("Error: -H and -S must be followed by a pattern");
+          return(1);
+        }
+        if (argv[i - 1][1] == 'H') {
+          crawlopts.hostglob = argv[i];
+        } else {
+          crawlopts.selglob = argv[i];
+        }
+        continue;
+      }
+
+      /* catch -p pack: the offline pack to browse (or to build, with -m) */
+      if ((strcmp(argv[i], "-p") == 0) && (packfile == NULL)) {
+        i++;
+        if ((i >= argc) || (argv[i][0] == 0)) {
+          ui_puts("Error: -p must be followed by a pack file");
+          return(1);
+        }
+        packfile = argv[i];
+        continue;
+      }
+
+      /* catch -j jobs, overrides dl.parallel from the config file */
+      if (strcmp(argv[i], "-j") == 0) {
+        long v;
+        i++;
+        if ((i >= argc) || (cfg_getnum(&v, argv[i], 1, DL_MAXPARALLEL) != 0)) {
+          ui_puts("Error: -j must be followed by an amount of parallel transfers");
+          return(1);
+        }
+        cfg.dl_parallel = v;
+        continue;
+      }
+
+      /* catch -r rate (KiB/s), overrides rate.total from the config file */
+      if (strcmp(argv[i], "-r") == 0) {
+        i++;
+        if ((i >= argc) || (cfg_getnum(&(cfg.rate_total), argv[i], 0, RATELIM_MAX) != 0)) {
+          ui_puts("Error: -r must be followed by a rate limit (KiB/s)");
+          return(1);
+        }
+        continue;
+      }
+
       /* catch legacy -o=outfile format (recognized for compatibility with pre-1.2.2 syntax) */
       if ((argv[i][0] == '-') && (argv[i][1] == 'o') && (argv[i][2] == '=') && (saveas == NULL)) {
         saveas = argv[i] + 3;
@@ -1805,7 +2724,19 @@ int main(int argc, char **argv) {
       if (argv[i][0] == '-') {
         ui_puts("Gopherus v" pVer " Copyright (C) " pDate " Mateusz Viste");
         ui_puts("");
-        ui_puts("Usage: gopherus [url [-o outfile]]");
+        ui_puts("Usage: gopherus [-r KiB/s] [url [-o outfile]]");
+        ui_puts("       gopherus [-r KiB/s] [-j jobs] -b listfile");
+        ui_puts("       gopherus [-r KiB/s] [-j jobs] [-d depth] [-H hostglob] [-S selglob]");
+        ui_puts("                [-p packfile] url -m outdir");
+        ui_puts("       gopherus -p packfile [url [-o outfile]]");
+        ui_puts("       (-o - writes the resource to stdout)");
+        ui_puts("       (-r caps the download rate, like rate.total does)");
+        ui_puts("       (-b fetches the \"url outfile\" pairs listed in listfile, - for");
+        ui_puts("        stdin, and reports each of them as a line of JSON)");
+        ui_puts("       (-m mirrors url into outdir, following links down to depth menus,");
+        ui_puts("        to hosts matching hostglob and selectors matching selglob)");
+        ui_puts("       (-p browses an offline pack, or builds it out of the mirror with -m)");
+        ui_puts("       (-j sets how many transfers -b or -m run at once, like dl.parallel)");
         ui_puts("");
         ui_puts("Latest version can be found at the following addresses:");
         ui_puts("  http://gopherus.sourceforge.net");
@@ -1836,6 +2767,21 @@ int main(int argc, char **argv) {
     }
   }
 
+  if ((batchlist != NULL) && ((history != NULL) || (saveas != NULL))) {
+    ui_puts("Invalid parameters list.");
+    return(1);
+  }
+  if ((packfile != NULL) && (batchlist != NULL)) {
+    ui_puts("Invalid parameters list.");
+    return(1);
+  }
+  if ((crawlopts.outdir != NULL) && ((history == NULL) || (saveas != NULL) || (batchlist != NULL))) {
+    ui_puts("Invalid parameters list.");
+    return(1);
+  }
+
+  ratelim_set(cfg.rate_total * 1024, cfg.rate_xfer * 1024);
+
   /* alloc page buffer + 2 bytes for a guardian value to detect overflows */
   buffer = malloc(PAGEBUFSZ + 2);
   if (buffer != NULL) {
@@ -1853,13 +2799,83 @@ int main(int argc, char **argv) {
     goto GAMEOVER;
   }
 
+  /* warm up the DNS cache with what previous sessions learned */
+  {
+    char fname[256];
+    if (dnscache_getfname(fname, sizeof(fname)) != NULL) dnscache_load(fname);
+  }
+
+  /* batch mode: fetch everything that is listed and quit */
+  if (batchlist != NULL) {
+    FILE *fd = stdin;
+    long failcount;
+    if (strcmp(batchlist, "-") != 0) fd = fopen(batchlist, "rb");
+    if (fd == NULL) {
+      fatalerr = "Could not open the batch list";
+      goto GAMEOVER;
+    }
+    failcount = batch_run(fd, cfg.dl_parallel, cfg.dl_perhost);
+    if (fd != stdin) fclose(fd);
+    if (failcount < 0) fatalerr = "Out of memory!";
+    if (failcount > 0) exitcode = 1; /* let scripts know something failed */
+    goto GAMEOVER;
+  }
+
+  /* mirror mode: crawl the url and quit */
+  if (crawlopts.outdir != NULL) {
+    char url[MAXURLLEN];
+    long failcount;
+    crawlopts.parallel = cfg.dl_parallel;
+    crawlopts.perhost = cfg.dl_perhost;
+    buildgopherurl(url, sizeof(url), history->protocol, history->host, history->port, history->itemtype, history->selector);
+    failcount = crawl_run(url, &crawlopts);
+    if (failcount != 0) exitcode = 1;
+    /* ...and store the mirror into a pack */
+    if ((packfile != NULL) && (failcount >= 0)) {
+      const char *err;
+      long count = pack_build(crawlopts.outdir, packfile, &err);
+      if (count < 0) {
+        printf("Failed to build the pack: %s\n", err);
+        exitcode = 1;
+      } else {
+        printf("Packed %ld resources into %s\n", count, packfile);
+      }
+    }
+    goto GAMEOVER;
+  }
+
+  /* browse an offline pack, its resources are read from there */
+  if (packfile != NULL) {
+    glob_pack = pack_open(packfile);
+    if (glob_pack == NULL) {
+      fatalerr = "Could not open the pack file";
+      goto GAMEOVER;
+    }
+    /* no speculative network traffic for what the pack holds anyway */
+    prefetch_setbudget(0, 0);
+    preconn_setlimits(0, cfg.preconn_idle);
+    /* start at the root of the pack, unless told otherwise */
+    if (history == NULL) {
+      char url[MAXURLLEN], host[MAXHOSTLEN], selector[MAXSELLEN], itemtype;
+      unsigned short port;
+      unsigned char protocol;
+      if (pack_root(glob_pack, url, sizeof(url)) == 0) {
+        protocol = parsegopherurl(url, host, sizeof(host), &port, &itemtype, selector, sizeof(selector));
+        if ((protocol != PARSEURL_ERROR) && (history_push(&history, protocol, host, port, itemtype, selector) != 0)) {
+          fatalerr = "Out of memory!";
+          goto GAMEOVER;
+        }
+      }
+    }
+  }
+
   /* if in non-interactive mode (-o=...), then fetch the resource and quit */
   if (saveas != NULL) {
     if (history == NULL) {
       ui_puts("You must provide an URL when using -o");
       goto GAMEOVER;
     }
-    loadfile_buff(history->protocol, history->host, history->port, history->selector, buffer, PAGEBUFSZ, saveas, &cfg);
+    loadfile_buff(history->protocol, history->host, history->port, history->selector, buffer, PAGEBUFSZ, saveas, &cfg, NULL);
     /* return to the OS */
     goto GAMEOVER;
   }
@@ -1876,7 +2892,14 @@ int main(int argc, char **argv) {
   /* create a bookmark file template if it does not exist yet */
   bookmarkfile_createifnone(cfg.bookmarksfile);
 
+  /* pages browsed in earlier sessions are kept on disk */
+  {
+    char dir[256];
+    if (diskcache_getdir(dir, sizeof(dir)) != NULL) diskcache_setup(dir, cfg.cache_size * 1024, cfg.cache_menuttl, cfg.cache_ttl);
+  }
+
   for (;;) {
+    struct historytype *loadnode;
     int exitflag;
 
     /* preload history with the welcome screen if history is empty  */
@@ -1889,28 +2912,55 @@ int main(int argc, char **argv) {
 
     if ((history->itemtype == '0') || (history->itemtype == '1') || (history->itemtype == '7') || (history->itemtype == 'h')) { /* if it's a displayable item type... */
       draw_urlbar(history, &cfg);
+      history->cache = pagecache_get(history->protocol, history->host, history->port, history->itemtype, history->selector, &(history->cachesize));
+      /* a prefetched page is stored on disk once it is actually displayed */
+      if (pagecache_firstview(history->cache)) diskcache_put(history->protocol, history->host, history->port, history->itemtype, history->selector, (const char *)history->cache, history->cachesize);
+      /* a query that has been displayed already is not reissued automatically */
+      if ((history->cache == NULL) && (history->itemtype == '7') && (history->displaymemory[1] >= 0)) {
+        static char msg[] = "3Query not in cache\ni\niThis location is not available in the local cache. Gopherus is not reissuing custom queries automatically. If you wish to force a reload, press F5.\n";
+        history->cache = (signed char *)msg;
+        history->cachesize = strlen(msg);
+      }
       if (history->cache == NULL) { /* reload the resource if not in cache already */
         long bufferlen;
-        bufferlen = loadfile_buff(history->protocol, history->host, history->port, history->selector, buffer, PAGEBUFSZ, NULL, &cfg);
-        if (bufferlen < 0) {
+        /* the resource is received straight into its cache, it may be still
+         * in progress when displayed already */
+        signed char *page = malloc(PAGEBUFSZ);
+        if (page == NULL) {
           history_pop(&history);
+          set_statusbar("!Out of memory!");
           continue;
-        } else {
-          history_cleanupcache(history);
-          if (bufferlen == 0) { /* malloc(0) may return NULL on some platforms */
-            history->cache = malloc(1);
-          } else {
-            history->cache = malloc(bufferlen);
+        }
+        bufferlen = -1;
+        if (reload == 0) {
+          bufferlen = diskcache_get(history->protocol, history->host, history->port, history->itemtype, history->selector, (char *)page, PAGEBUFSZ);
+          if (bufferlen >= 0) set_statusbar("Page loaded from the disk cache");
+        }
+        reload = 0;
+        if (bufferlen < 0) {
+          bufferlen = loadfile_buff(history->protocol, history->host, history->port, history->selector, (char *)page, PAGEBUFSZ, NULL, &cfg, &glob_pageload.x);
+          if (bufferlen < 0) {
+            free(page);
+            history_pop(&history);
+            continue;
           }
-          if (history->cache == NULL) {
+        } else {
+          glob_pageload.complete = 0; /* it is in the disk cache already */
+        }
+        history->cache = page;
+        history->cachesize = bufferlen;
+        if (glob_pageload.x == NULL) {
+          pageload_end(history);
+          if (page_store(history) != 0) {
             history_pop(&history);
-            set_statusbar("!Out of memory!");
             continue;
           }
-          if (bufferlen > 0) memcpy(history->cache, buffer, bufferlen);
-          history->cachesize = bufferlen;
+        } else {
+          glob_pageload.redrawtime = timer_ms();
+          glob_pageload.redrawlen = bufferlen;
         }
       }
+      loadnode = history;
 
       switch (history->itemtype) {
         case '0': /* text file */
@@ -1921,7 +2971,7 @@ int main(int argc, char **argv) {
           break;
         case '1': /* menu */
         case '7': /* query result (also a menu) */
-          exitflag = display_menu(&history, &cfg, buffer, PAGEBUFSZ);
+          exitflag = display_menu(&history, &cfg);
           break;
         default:
           fatalerr = "Fatal error: got an unhandled itemtype!";
@@ -1929,12 +2979,21 @@ int main(int argc, char **argv) {
           break;
       }
 
+      /* a page left before it got received entirely is not kept */
+      if (glob_pageload.x != NULL) {
+        pageload_end(loadnode);
+        free(loadnode->cache);
+      }
+      /* the page is not on screen anymore: the page cache may compress or
+       * drop it from now on, it is looked up again when needed */
+      loadnode->cache = NULL;
+      loadnode->cachesize = 0;
+
       if (exitflag == DISPLAY_ORDER_BACK) {
         history_pop(&history);
       } else if (exitflag == DISPLAY_ORDER_REFR) {
-        free(history->cache);
-        history->cache = NULL;
-        history->cachesize = 0;
+        reload = 1; /* the disk cache would give the same page back */
+        pagecache_drop(history->protocol, history->host, history->port, history->itemtype, history->selector);
         history->displaymemory[0] = -1;
         history->displaymemory[1] = -1;
       } else if (exitflag == DISPLAY_ORDER_QUIT) {
@@ -1950,7 +3009,7 @@ int main(int argc, char **argv) {
       i = strlen(prompt);
       drawstr(prompt, 0x70, 0, ui_getrowcount() - 1, i);
       if (editstring(filename, sizeof(filename), sizeof(filename), i, ui_getrowcount() - 1, 0x70) != 0) {
-        loadfile_buff(history->protocol, history->host, history->port, history->selector, buffer, PAGEBUFSZ, filename, &cfg);
+        loadfile_buff(history->protocol, history->host, history->port, history->selector, buffer, PAGEBUFSZ, filename, &cfg, NULL);
       }
       history_pop(&history);
     }
@@ -1977,21 +3036,30 @@ int main(int argc, char **argv) {
     free(buffer);
   }
 
+  pack_close(glob_pack);
+
   /* unallocate all the history */
   if (history != NULL) {
     if (cfg.notui == 0) ui_puts("flushing cache history...");
     history_clear(&history);
   }
+  pagecache_clear();
 
   /* cleanup the networking subsystem */
   if (netinitflag == 0) {
+    char fname[256];
+    if (dnscache_getfname(fname, sizeof(fname)) != NULL) dnscache_save(fname);
+    net_pollset_free(glob_bgwait.ws);
+    prefetch_flush();
+    preconn_flush();
+    connpool_flush();
     if (cfg.notui == 0) ui_puts("uninitializing TCP/IP...");
     net_shut();
   }
 
   if (fatalerr == NULL) {
     if (cfg.notui == 0) ui_puts("all done, see you later.");
-    return(0);
+    return(exitcode);
   }
   return(1);
 }
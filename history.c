@@ -12,7 +12,6 @@
 
 
 static void history_free_node(struct historytype *node) {
-  if (node->cache != NULL) free(node->cache);
   if (node->selector != NULL) free(node->selector);
   free(node);
 }
@@ -26,19 +25,6 @@ void history_pop(struct historytype **history) {
     *history = (*history)->next;
     history_free_node(victim);
   }
-  if (*history == NULL) return;
-
-  /* check if the last request was a query, and if not in cache, put a message instead to avoid reloading a query again */
-  if (((*history)->itemtype == '7') && ((*history)->cache == NULL)) {
-    char *msg = "3Query not in cache\ni\niThis location is not available in the local cache. Gopherus is not reissuing custom queries automatically. If you wish to force a reload, press F5.\n";
-    (*history)->cachesize = strlen(msg);
-    (*history)->cache = malloc((*history)->cachesize + 1);
-    if ((*history)->cache == NULL) { /* oops, out of memory! */
-      (*history)->cachesize = 0;
-      return;
-    }
-    memcpy((*history)->cache, msg, (*history)->cachesize + 1);
-  }
 }
 
 
@@ -85,23 +71,6 @@ int history_push(struct historytype **history, unsigned char protocol, const cha
 }
 
 
-/* free cache content past latest MAXALLOWEDCACHE bytes, also drop any
- * internal (embedded) gopherus pages */
-void history_cleanupcache(struct historytype *history) {
-  unsigned long totalcache = 0;
-  for (; history != NULL; history = history->next) {
-    totalcache += history->cachesize;
-    if ((totalcache > MAXALLOWEDCACHE) || (history->host[0] == '#')) {
-      if (history->cache != NULL) {
-        free(history->cache);
-        history->cache = NULL;
-        history->cachesize = 0;
-      }
-    }
-  }
-}
-
-
 /* flush all history, freeing memory (sets the history ptr to NULL) */
 void history_clear(struct historytype **history) {
   struct historytype *victim;
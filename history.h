@@ -9,7 +9,7 @@
 struct historytype {
   long cachesize;
   char *selector;
-  signed char *cache;
+  signed char *cache;     /* the page while it is on screen (NULL otherwise), held by the page cache (see pagecache.h) once received */
   struct historytype *next;
   unsigned short port;
   unsigned char protocol;
@@ -24,9 +24,6 @@ void history_pop(struct historytype **history);
 /* adds a new node to the history list. Returns 0 on success, non-zero otherwise. */
 int history_push(struct historytype **history, unsigned char protocol, const char *host, unsigned short port, char itemtype, const char *selector);
 
-/* free cache content past latest maxallowedcache bytes */
-void history_cleanupcache(struct historytype *history);
-
 /* flush all history, freeing memory (sets the history ptr to NULL) */
 void history_clear(struct historytype **history);
 
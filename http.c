@@ -0,0 +1,351 @@
+/*
+ * This file is part of the Gopherus project.
+ * Copyright (C) 2013-2022 Mateusz Viste
+ */
+
+#include <stdlib.h>  /* calloc(), free(), strtol() */
+#include <string.h>  /* memmove(), strlen() */
+#include <strings.h> /* strncasecmp() */
+
+#ifdef HAVE_ZLIB
+#define ZLIB_CONST
+#include <zlib.h>
+#endif
+
+#include "http.h" /* include self for control */
+
+/* room kept in hdr for the line being received: once less than that is
+ * left, further header lines are parsed but not stored */
+#define HTTP_LINERESERVE 128
+
+/* states of the chunked transfer coding decoder */
+#define HTTP_CHUNK_SIZE  0  /* reading the hex size of next chunk */
+#define HTTP_CHUNK_EXT   1  /* skipping chunk extensions up to end of line */
+#define HTTP_CHUNK_DATA  2  /* reading chunk data */
+#define HTTP_CHUNK_CRLF  3  /* waiting for the line end that follows data */
+#define HTTP_CHUNK_TRAIL 4  /* skipping trailers up to an empty line */
+
+
+/* releases the inflate state, if any */
+static void http_zfree(struct http_resp *h) {
+  if (h->zs == NULL) return;
+#ifdef HAVE_ZLIB
+  inflateEnd(h->zs);
+#endif
+  free(h->zs);
+  h->zs = NULL;
+}
+
+
+void http_init(struct http_resp *h) {
+  http_zfree(h);
+  h->contentlen = -1;
+  h->bodylen = 0;
+  h->chunkleft = 0;
+  h->status = 0;
+  h->hdrlen = 0;
+  h->linestart = 0;
+  h->state = HTTP_HEAD;
+  h->keepalive = 0;
+  h->chunked = 0;
+  h->chunkstate = HTTP_CHUNK_SIZE;
+  h->midline = 0;
+  h->encoding = HTTP_ENC_IDENTITY;
+  h->zend = 0;
+}
+
+
+struct http_resp *http_new(void) {
+  struct http_resp *h;
+  h = calloc(1, sizeof(struct http_resp));
+  if (h != NULL) http_init(h);
+  return(h);
+}
+
+
+void http_free(struct http_resp *h) {
+  if (h == NULL) return;
+  http_zfree(h);
+  free(h);
+}
+
+
+/* returns non-zero if the comma-separated header value val contains tok */
+static int http_hastoken(const char *val, const char *tok) {
+  size_t toklen = strlen(tok);
+  for (;;) {
+    while ((*val == ' ') || (*val == '\t') || (*val == ',')) val++;
+    if (*val == 0) return(0);
+    if ((strncasecmp(val, tok, toklen) == 0) && ((val[toklen] == 0) || (val[toklen] == ',') || (val[toklen] == ' ') || (val[toklen] == ';'))) return(1);
+    while ((*val != 0) && (*val != ',')) val++;
+  }
+}
+
+
+/* skips the "name:" part of header line, returns its value (or NULL if
+ * line is not a name header) */
+static const char *http_hdrvalue(const char *line, const char *name) {
+  size_t namelen = strlen(name);
+  if ((strncasecmp(line, name, namelen) != 0) || (line[namelen] != ':')) return(NULL);
+  line += namelen + 1;
+  while ((*line == ' ') || (*line == '\t')) line++;
+  return(line);
+}
+
+
+/* looks at the complete header line at hdr + linestart. returns -1 if it
+ * makes the answer invalid */
+static int http_hdrline(struct http_resp *h) {
+  const char *line = h->hdr + h->linestart;
+  const char *val;
+  char *end;
+
+  if (h->linestart == 0) { /* status line: "HTTP/1.1 200 OK" */
+    if ((strncmp(line, "HTTP/", 5) != 0) || (line[6] != '.') || (line[8] != ' ')) return(-1);
+    h->status = (int)strtol(line + 9, &end, 10);
+    if ((end != line + 12) || (h->status < 100) || (h->status > 999)) return(-1);
+    /* HTTP/1.1 keeps connections open by default */
+    h->keepalive = ((line[5] > '1') || ((line[5] == '1') && (line[7] != '0')));
+  } else if ((val = http_hdrvalue(line, "content-length")) != NULL) {
+    h->contentlen = strtol(val, &end, 10);
+    if ((end == val) || (h->contentlen < 0)) return(-1);
+  } else if ((val = http_hdrvalue(line, "connection")) != NULL) {
+    if (http_hastoken(val, "close")) h->keepalive = 0;
+    if (http_hastoken(val, "keep-alive")) h->keepalive = 1;
+  } else if ((val = http_hdrvalue(line, "transfer-encoding")) != NULL) {
+    if (http_hastoken(val, "chunked")) h->chunked = 1;
+  } else if ((val = http_hdrvalue(line, "content-encoding")) != NULL) {
+    if ((*val == 0) || http_hastoken(val, "identity")) {
+      h->encoding = HTTP_ENC_IDENTITY;
+#ifdef HAVE_ZLIB
+    } else if (http_hastoken(val, "gzip") || http_hastoken(val, "x-gzip")) {
+      h->encoding = HTTP_ENC_GZIP;
+    } else if (http_hastoken(val, "deflate")) {
+      h->encoding = HTTP_ENC_DEFLATE;
+#endif
+    } else {
+      h->encoding = HTTP_ENC_UNKNOWN;
+    }
+  }
+  return(0);
+}
+
+
+/* end of headers: decide how the end of the body will be recognized */
+static void http_hdrdone(struct http_resp *h) {
+  /* interim answer (100 Continue...): the real one follows */
+  if ((h->status < 200) && (h->status != 101)) {
+    http_init(h);
+    return;
+  }
+  h->state = HTTP_BODY;
+  if ((h->status == 204) || (h->status == 304)) { /* never any body */
+    h->chunked = 0;
+    h->contentlen = 0;
+  }
+  if (h->chunked) {
+    h->contentlen = -1; /* chunked coding takes precedence (RFC 9112, 6.3) */
+  } else if (h->contentlen < 0) {
+    h->keepalive = 0; /* no length: the body ends when the connection does */
+  } else if (h->contentlen == 0) {
+    h->state = HTTP_DONE;
+  }
+}
+
+
+/* consumes header bytes at the start of buf, returns how many */
+static long http_head(struct http_resp *h, const char *buf, long len) {
+  long i;
+  for (i = 0; (i < len) && (h->state == HTTP_HEAD); i++) {
+    if (buf[i] == '\r') continue;
+    if (buf[i] != '\n') {
+      if (h->hdrlen < sizeof(h->hdr) - 1) h->hdr[h->hdrlen++] = buf[i]; /* overlong lines are truncated */
+      continue;
+    }
+    /* end of line */
+    if (h->hdrlen == h->linestart) { /* empty line: end of headers */
+      if (h->linestart == 0) return(-1); /* no status line */
+      http_hdrdone(h);
+      continue;
+    }
+    h->hdr[h->hdrlen] = 0;
+    if (http_hdrline(h) != 0) return(-1);
+    if ((h->linestart != 0) && (h->hdrlen + 1 > (long)sizeof(h->hdr) - HTTP_LINERESERVE)) {
+      h->hdrlen = h->linestart; /* out of room: forget it */
+    } else {
+      h->hdrlen++;
+      h->linestart = h->hdrlen;
+    }
+  }
+  return(i);
+}
+
+
+/* decodes the chunked transfer coding of len bytes in buf, in place.
+ * returns the amount of payload bytes left at the start of buf, or -1 if
+ * the encoding is invalid */
+static long http_dechunk(struct http_resp *h, char *buf, long len) {
+  long i = 0, o = 0, n;
+  while ((i < len) && (h->state == HTTP_BODY)) {
+    char c = buf[i];
+    switch (h->chunkstate) {
+      case HTTP_CHUNK_SIZE:
+        i++;
+        if ((c >= '0') && (c <= '9')) {
+          n = c - '0';
+        } else if ((c >= 'a') && (c <= 'f')) {
+          n = c - 'a' + 10;
+        } else if ((c >= 'A') && (c <= 'F')) {
+          n = c - 'A' + 10;
+        } else if (c == '\n') {
+          h->chunkstate = (h->chunkleft > 0) ? HTTP_CHUNK_DATA : HTTP_CHUNK_TRAIL;
+          continue;
+        } else {
+          h->chunkstate = HTTP_CHUNK_EXT;
+          continue;
+        }
+        if (h->chunkleft > 0x7ffffffl / 16) return(-1); /* absurd chunk size */
+        h->chunkleft = h->chunkleft * 16 + n;
+        break;
+      case HTTP_CHUNK_EXT:
+        i++;
+        if (c == '\n') {
+          h->chunkstate = (h->chunkleft > 0) ? HTTP_CHUNK_DATA : HTTP_CHUNK_TRAIL;
+        }
+        break;
+      case HTTP_CHUNK_DATA:
+        n = len - i;
+        if (n > h->chunkleft) n = h->chunkleft;
+        memmove(buf + o, buf + i, n);
+        o += n;
+        i += n;
+        h->chunkleft -= n;
+        if (h->chunkleft == 0) h->chunkstate = HTTP_CHUNK_CRLF;
+        break;
+      case HTTP_CHUNK_CRLF:
+        i++;
+        if (c == '\n') h->chunkstate = HTTP_CHUNK_SIZE;
+        break;
+      case HTTP_CHUNK_TRAIL: /* trailer lines, up to an empty one */
+        i++;
+        if (c == '\n') {
+          if (h->midline == 0) h->state = HTTP_DONE;
+          h->midline = 0;
+        } else if (c != '\r') {
+          h->midline = 1;
+        }
+        break;
+    }
+  }
+  return(o);
+}
+
+
+long http_feed(struct http_resp *h, char *buf, long len) {
+  long i;
+  if (h->state == HTTP_HEAD) {
+    i = http_head(h, buf, len);
+    if (i < 0) {
+      h->state = HTTP_ERR;
+      return(-1);
+    }
+    buf += i;
+    len -= i;
+  } else {
+    i = 0;
+  }
+  if ((h->state != HTTP_BODY) || (len == 0)) return(0);
+  if (h->chunked) {
+    len = http_dechunk(h, buf, len);
+    if (len < 0) {
+      h->state = HTTP_ERR;
+      return(-1);
+    }
+  } else if (h->contentlen >= 0) {
+    if (len > h->contentlen - h->bodylen) len = h->contentlen - h->bodylen;
+    if (h->bodylen + len == h->contentlen) h->state = HTTP_DONE;
+  }
+  if (i > 0) memmove(buf - i, buf, len);
+  h->bodylen += len;
+  return(len);
+}
+
+
+long http_bodyleft(const struct http_resp *h) {
+  if (h->chunked || (h->contentlen < 0)) return(-1);
+  return(h->contentlen - h->bodylen);
+}
+
+
+void http_bodyskipped(struct http_resp *h, long len) {
+  h->bodylen += len;
+  if (h->bodylen == h->contentlen) h->state = HTTP_DONE;
+}
+
+
+long http_inflate(struct http_resp *h, const char *in, long inlen, char *out, long outsz, long *used) {
+#ifdef HAVE_ZLIB
+  z_stream *zs = h->zs;
+  int r;
+
+  /* whatever follows the end of the compressed stream is ignored */
+  if (h->zend) {
+    *used = inlen;
+    return(0);
+  }
+  *used = 0;
+
+  if (zs == NULL) {
+    int wbits = 15 + 32; /* zlib or gzip, told apart by their header */
+    if (inlen == 0) return(0);
+    /* "deflate" is supposed to be zlib-wrapped, but some servers send a raw
+     * deflate stream. a zlib header is a multiple of 31 with method 8. */
+    if ((h->encoding == HTTP_ENC_DEFLATE) && (((in[0] & 0x0f) != 8) || ((inlen > 1) && ((((unsigned char)in[0] << 8) | (unsigned char)in[1]) % 31 != 0)))) {
+      wbits = -15;
+    }
+    zs = calloc(1, sizeof(z_stream));
+    if (zs == NULL) return(-1);
+    if (inflateInit2(zs, wbits) != Z_OK) {
+      free(zs);
+      return(-1);
+    }
+    h->zs = zs;
+  }
+
+  zs->next_in = (const Bytef *)in;
+  zs->avail_in = (uInt)inlen;
+  zs->next_out = (Bytef *)out;
+  zs->avail_out = (uInt)outsz;
+  r = inflate(zs, Z_NO_FLUSH);
+  *used = inlen - zs->avail_in;
+  if (r == Z_STREAM_END) {
+    h->zend = 1;
+    *used = inlen;
+  } else if ((r != Z_OK) && (r != Z_BUF_ERROR)) { /* BUF_ERROR = no progress possible */
+    return(-1);
+  }
+  return(outsz - zs->avail_out);
+#else
+  (void)h; (void)in; (void)inlen; (void)out; (void)outsz;
+  *used = inlen;
+  return(-1);
+#endif
+}
+
+
+const char *http_header(const struct http_resp *h, const char *name) {
+  const char *line, *val;
+  /* the status line comes first, skip it */
+  for (line = h->hdr + strlen(h->hdr) + 1; line < h->hdr + h->linestart; line += strlen(line) + 1) {
+    val = http_hdrvalue(line, name);
+    if (val != NULL) return(val);
+  }
+  return(NULL);
+}
+
+
+const char *http_reason(const struct http_resp *h) {
+  if (h->linestart == 0) return("");
+  if (strlen(h->hdr) < 13) return("");
+  return(h->hdr + 13);
+}
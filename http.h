@@ -0,0 +1,91 @@
+/*
+ * This file is part of the Gopherus project.
+ * Copyright (C) 2013-2022 Mateusz Viste
+ *
+ * Streaming parser of http answers. Data is fed to it in whatever pieces
+ * it arrives, every byte being looked at exactly once: the status line and
+ * headers are consumed, the body is freed from its transfer coding (if any)
+ * and the parser tells when the answer is complete, so the connection does
+ * not have to be closed to mark the end of data.
+ */
+
+#ifndef http_h_sentinel
+#define http_h_sentinel
+
+#include "config.h" /* HTTP_HDRSZ */
+
+/* parser states */
+#define HTTP_HEAD 0  /* receiving the status line and headers */
+#define HTTP_BODY 1  /* receiving the body */
+#define HTTP_DONE 2  /* end of answer reached */
+#define HTTP_ERR  3  /* malformed answer */
+
+/* content codings of the body */
+#define HTTP_ENC_IDENTITY 0  /* not encoded */
+#define HTTP_ENC_GZIP     1
+#define HTTP_ENC_DEFLATE  2
+#define HTTP_ENC_UNKNOWN  3  /* something we are unable to decode */
+
+/* header line to put in requests, telling what content codings we accept */
+#ifdef HAVE_ZLIB
+#define HTTP_ACCEPTENC "Accept-Encoding: gzip, deflate\r\n"
+#else
+#define HTTP_ACCEPTENC ""
+#endif
+
+struct http_resp {
+  long contentlen;          /* Content-Length, -1 if not announced */
+  long bodylen;             /* payload bytes delivered so far */
+  long chunkleft;           /* bytes left in current chunk */
+  int status;               /* status code (200, 404...) */
+  unsigned short hdrlen;    /* bytes of hdr in use */
+  unsigned short linestart; /* offset in hdr of the line being received */
+  unsigned char state;
+  unsigned char keepalive;  /* server keeps the connection open afterwards */
+  unsigned char chunked;    /* body uses the chunked transfer coding */
+  unsigned char chunkstate;
+  unsigned char midline;    /* a non-empty trailer line is being skipped */
+  unsigned char encoding;   /* content coding (HTTP_ENC_*) */
+  unsigned char zend;       /* end of the compressed stream reached */
+  void *zs;                 /* inflate state */
+  char hdr[HTTP_HDRSZ];     /* status line and headers, each NUL-terminated */
+};
+
+/* returns a new parser, ready for an answer, or NULL on out of memory */
+struct http_resp *http_new(void);
+
+/* prepares h for parsing a new answer */
+void http_init(struct http_resp *h);
+
+/* frees parser h and everything it holds */
+void http_free(struct http_resp *h);
+
+/* parses len bytes of answer at buf. payload bytes found among them are
+ * decoded and moved to the start of buf, their amount is returned. returns
+ * -1 if the answer is malformed. anything past the end of the answer is
+ * ignored. */
+long http_feed(struct http_resp *h, char *buf, long len);
+
+/* amount of body bytes still expected, or -1 if not known in advance (not
+ * announced or chunked). meaningful in the HTTP_BODY state. */
+long http_bodyleft(const struct http_resp *h);
+
+/* accounts len body bytes the caller moved elsewhere without passing them
+ * through http_feed(). only allowed for bodies that are not chunked. */
+void http_bodyskipped(struct http_resp *h, long len);
+
+/* inflates the content-encoded body bytes found in in (as returned by
+ * http_feed), writing at most outsz bytes to out. *used is set to the
+ * amount of input bytes consumed, call again with what is left (or with no
+ * input at all if out got full, as more output may be pending). returns the
+ * amount of bytes written to out, or -1 on error. */
+long http_inflate(struct http_resp *h, const char *in, long inlen, char *out, long outsz, long *used);
+
+/* returns the value of header name (case-insensitive, without the colon),
+ * or NULL if the answer did not contain it */
+const char *http_header(const struct http_resp *h, const char *name);
+
+/* returns the reason phrase of the status line ("Not Found"...) */
+const char *http_reason(const struct http_resp *h);
+
+#endif
@@ -0,0 +1,132 @@
+/*
+ * This file is part of the Gopherus project.
+ * Copyright (C) 2013-2022 Mateusz Viste
+ */
+
+#include <stdlib.h>  /* malloc(), free() */
+#include <string.h>  /* memcpy() */
+
+#include "lz.h" /* include self for control */
+
+/* compressed data is a sequence of blocks, each of them made of a token
+ * byte, literals and a match. the high nibble of the token is the amount of
+ * literals, the low nibble the length of the match minus LZ_MINMATCH. a
+ * nibble of 15 is followed by extra length bytes, added up until one is not
+ * 255. the literals follow, then the distance of the match (u16, little
+ * endian). the last block has literals only. */
+#define LZ_MINMATCH 4
+#define LZ_MAXDIST 65535l
+#define LZ_HASHBITS 12
+
+
+static unsigned short lz_hash(const unsigned char *s) {
+  unsigned long v = (unsigned long)s[0] | ((unsigned long)s[1] << 8) | ((unsigned long)s[2] << 16) | ((unsigned long)s[3] << 24);
+  return((unsigned short)(((v * 2654435761ul) & 0xfffffffful) >> (32 - LZ_HASHBITS)));
+}
+
+
+/* writes the extra length bytes of len (if its nibble was 15) */
+static unsigned char *lz_putlen(unsigned char *d, long len) {
+  for (len -= 15; len >= 255; len -= 255) *d++ = 255;
+  *d++ = (unsigned char)len;
+  return(d);
+}
+
+
+/* writes a block of litlen literals and a match of mlen bytes at distance
+ * dist (no match if mlen is 0). returns the new end of dst, or NULL if it
+ * does not fit before dstend. */
+static unsigned char *lz_block(unsigned char *d, const unsigned char *dstend, const unsigned char *lit, long litlen, long dist, long mlen) {
+  long need = 1 + litlen + (litlen / 255) + 1 + ((mlen > 0) ? 2 + (mlen / 255) + 1 : 0);
+  unsigned char *token = d;
+  if (need > dstend - d) return(NULL);
+  *token = (unsigned char)(((litlen < 15) ? litlen : 15) << 4);
+  d++;
+  if (litlen >= 15) d = lz_putlen(d, litlen);
+  memcpy(d, lit, litlen);
+  d += litlen;
+  if (mlen == 0) return(d);
+  *d++ = (unsigned char)(dist & 0xff);
+  *d++ = (unsigned char)(dist >> 8);
+  mlen -= LZ_MINMATCH;
+  *token |= (mlen < 15) ? mlen : 15;
+  if (mlen >= 15) d = lz_putlen(d, mlen);
+  return(d);
+}
+
+
+long lz_compress(const void *src, long srclen, void *dst, long dstsz) {
+  const unsigned char *s = src;
+  unsigned char *d = dst;
+  const unsigned char *dstend = d + dstsz;
+  long *tab, ip = 0, anchor = 0;
+  unsigned short i;
+
+  tab = malloc((1 << LZ_HASHBITS) * sizeof(long));
+  if (tab == NULL) return(-1);
+  for (i = 0; i < (1 << LZ_HASHBITS); i++) tab[i] = -1;
+
+  while (ip + LZ_MINMATCH <= srclen) {
+    unsigned short h = lz_hash(s + ip);
+    long ref = tab[h], mlen;
+    tab[h] = ip;
+    if ((ref < 0) || (ip - ref > LZ_MAXDIST) || (memcmp(s + ref, s + ip, LZ_MINMATCH) != 0)) {
+      ip++;
+      continue;
+    }
+    for (mlen = LZ_MINMATCH; (ip + mlen < srclen) && (s[ref + mlen] == s[ip + mlen]); mlen++);
+    d = lz_block(d, dstend, s + anchor, ip - anchor, ip - ref, mlen);
+    if (d == NULL) break;
+    ip += mlen;
+    anchor = ip;
+  }
+
+  /* trailing literals */
+  if (d != NULL) d = lz_block(d, dstend, s + anchor, srclen - anchor, 0, 0);
+  free(tab);
+  if (d == NULL) return(-1);
+  return((long)(d - (unsigned char *)dst));
+}
+
+
+/* reads the extra length bytes of a nibble, if it was 15. returns -1 if
+ * they run past the end of s. */
+static long lz_getlen(const unsigned char **s, const unsigned char *end, long len) {
+  if (len != 15) return(len);
+  for (;;) {
+    if (*s >= end) return(-1);
+    len += **s;
+    if (*((*s)++) != 255) return(len);
+  }
+}
+
+
+int lz_expand(const void *src, long srclen, void *dst, long dstlen) {
+  const unsigned char *s = src;
+  const unsigned char *end = s + srclen;
+  unsigned char *d = dst;
+  long op = 0;
+
+  while (s < end) {
+    unsigned char token = *s++;
+    long len, dist;
+    /* literals */
+    len = lz_getlen(&s, end, token >> 4);
+    if ((len < 0) || (len > end - s) || (len > dstlen - op)) return(-1);
+    memcpy(d + op, s, len);
+    s += len;
+    op += len;
+    if (s == end) break; /* last block */
+    /* match, that may overlap with the bytes it produces */
+    if (end - s < 2) return(-1);
+    dist = (long)s[0] | ((long)s[1] << 8);
+    s += 2;
+    len = lz_getlen(&s, end, token & 15);
+    if (len < 0) return(-1);
+    len += LZ_MINMATCH;
+    if ((dist == 0) || (dist > op) || (len > dstlen - op)) return(-1);
+    for (; len > 0; len--, op++) d[op] = d[op - dist];
+  }
+  if (op != dstlen) return(-1);
+  return(0);
+}
@@ -0,0 +1,22 @@
+/*
+ * This file is part of the Gopherus project.
+ * Copyright (C) 2013-2022 Mateusz Viste
+ *
+ * A fast LZ77 codec, used to keep cached pages in memory in a compressed
+ * form. It favors speed over ratio: gopher menus and text files still shrink
+ * a few times.
+ */
+
+#ifndef lz_h_sentinel
+#define lz_h_sentinel
+
+/* compresses srclen bytes of src into dst (up to dstsz bytes). returns the
+ * amount of bytes written to dst, or -1 if they do not fit in dstsz bytes
+ * (or if memory is short). */
+long lz_compress(const void *src, long srclen, void *dst, long dstsz);
+
+/* expands srclen bytes of compressed data into the dstlen bytes of dst that
+ * were compressed. returns 0 on success, non-zero if src is corrupted. */
+int lz_expand(const void *src, long srclen, void *dst, long dstlen);
+
+#endif
@@ -0,0 +1,45 @@
+/*
+ * This file is part of the Gopherus project.
+ * Copyright (C) 2013-2022 Mateusz Viste
+ */
+
+#include <stddef.h> /* NULL */
+
+#include "menuline.h" /* include self for control */
+
+
+unsigned short menuline_explode(char *buffer, unsigned short bufferlen, char *itemtype, char **description, char **selector, char **host, char **port) {
+  char *cursor = buffer;
+  int column = 0;
+  if (itemtype != NULL) *itemtype = *cursor;
+  cursor += 1;
+  if (description != NULL) *description = cursor;
+  *selector = NULL;
+  *host = NULL;
+  *port = NULL;
+  for (; cursor < (buffer + bufferlen); cursor++) { /* read the whole line */
+    /* silently ignore CR chars */
+    if (*cursor == '\r') continue;
+
+    /* end of line, I'm done */
+    if (*cursor == '\n') {
+      *cursor = 0; /* put a NULL instead to terminate previous string */
+      cursor += 1;
+      break;
+    }
+
+    /* delimiter */
+    if (*cursor == '\t') { /* delimiter */
+      *cursor = 0; /* put a NULL instead to terminate previous string */
+      if (column == 0) {
+        *selector = cursor + 1;
+      } else if (column == 1) {
+        *host = cursor + 1;
+      } else if (column == 2) {
+        *port = cursor + 1;
+      }
+      if (column < 16) column += 1;
+    }
+  }
+  return(cursor - buffer);
+}
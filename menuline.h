@@ -0,0 +1,14 @@
+/*
+ * This file is part of the Gopherus project.
+ * Copyright (C) 2013-2022 Mateusz Viste
+ */
+
+#ifndef menuline_h_sentinel
+#define menuline_h_sentinel
+
+/* parses a buffer that contains a gopher menu and processes the first menu entry
+ * fills itemtype with the gopher type of the entry and sets description, selector, host and port pointers so they point to the corresponding value in the menu.
+ * returns length of the parsed line */
+unsigned short menuline_explode(char *buffer, unsigned short bufferlen, char *itemtype, char **description, char **selector, char **host, char **port);
+
+#endif
@@ -6,6 +6,11 @@
  * sockets (with a few messy ifdefs to support windows)
  */
 
+#if defined(__linux__) && !defined(DJ64) && !defined(CSOCK)
+  #define _GNU_SOURCE /* splice(), pipe2() */
+  #define NET_SPLICE
+#endif
+
 #include <fcntl.h>   /* fcntl() */
 #include <sys/fcntl.h>
 #include <stdlib.h>  /* NULL */
@@ -21,6 +26,10 @@
 #else
   #include <sys/socket.h> /* socket() */
   #include <sys/select.h> /* select(), fd_set() */
+#if !defined(DJ64) && !defined(CSOCK)
+  #include <netinet/in.h>
+  #include <netinet/tcp.h> /* TCP_NODELAY... */
+#endif
   #include <arpa/inet.h>
   #include <netdb.h>
   #include <unistd.h> /* close() */
@@ -31,37 +40,114 @@
 #endif
 #endif
 
+/* pick the best readiness backend available: epoll on Linux, poll() on other
+ * POSIX systems and the good old select() everywhere else */
+#if defined(__linux__) && !defined(DJ64) && !defined(CSOCK)
+  #define NET_POLL_EPOLL
+  #include <sys/epoll.h>
+#elif !defined(_WIN32) && !defined(DJ64) && !defined(CSOCK)
+  #define NET_POLL_POLL
+  #include <poll.h>
+#endif
+
+#ifdef NET_SPLICE
+  #include <sys/stat.h> /* fstat() */
+
+  /* the pipe net_splice() moves data through. it is always left empty, so
+   * it can be shared by all sockets */
+  static int net_splicepipe[2] = {-1, -1};
+#endif
+
+#ifdef HAVE_OPENSSL
+  #include <strings.h> /* strcasecmp() */
+  #include <openssl/err.h>
+  #include <openssl/ssl.h>
+  #include <openssl/x509v3.h>
+  #define NET_TLS
+#endif
+
+/* Linux >= 4.11 knows this one, even if the libc headers are older */
+#if defined(__linux__) && !defined(DJ64) && !defined(CSOCK) && !defined(TCP_FASTOPEN_CONNECT)
+  #define TCP_FASTOPEN_CONNECT 30
+#endif
+
 #include "net.h" /* include self for control */
 
+/* socket options set through net_settuning() */
+static int net_tuneflags;
+static long net_rcvbuf;
+
+#ifdef NET_TLS
+/* max amount of servers whose TLS session is remembered for resumption */
+#define NET_TLSCACHE 16
+
+struct net_tls {
+  SSL *ssl;
+  unsigned short port;
+  char host[1];
+};
+
+static SSL_CTX *net_tlsctx;
+static int net_tlsverify = 1;
+
+/* latest session of the servers contacted lately: resuming it saves a round
+ * trip (and the certificate check) on the next connection */
+static struct {
+  SSL_SESSION *sess;
+  unsigned long lastuse;
+  unsigned short port;
+  char host[256];
+} net_tlscache[NET_TLSCACHE];
+static unsigned long net_tlsclock; /* ticks on every use of the cache, for LRU */
+#endif
 
-int net_dnsresolve(char *ip, const char *name) {
-  struct addrinfo *r;
-  const char *ntopres;
 
-  /* resolve */
-  if (getaddrinfo(name, NULL, NULL, &r) != 0) return(-1);
+int net_dnsresolve(char ip[][NET_ADDRSTRLEN], int maxaddr, const char *name) {
+  struct addrinfo hints, *r, *a;
+  int res = 0, i, gaires;
 
-  /* convert to string */
-  if (r->ai_family == AF_INET) {
-    struct sockaddr_in *a = (void *)(r->ai_addr);
-    ntopres = inet_ntop(r->ai_family, &(a->sin_addr), ip, INET_ADDRSTRLEN);
+  /* resolve - one entry per address is enough, hence the SOCK_STREAM hint */
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  gaires = getaddrinfo(name, NULL, &hints, &r);
+  if (gaires != 0) {
+#ifdef EAI_NONAME
+    if (gaires == EAI_NONAME) return(NET_DNS_NOHOST);
+#endif
+#ifdef EAI_NODATA
+    if (gaires == EAI_NODATA) return(NET_DNS_NOHOST);
+#endif
+    return(-1);
   }
+
+  /* convert to strings, keeping the order proposed by the resolver */
+  for (a = r; (a != NULL) && (res < maxaddr); a = a->ai_next) {
+    const char *ntopres = NULL;
+    if (a->ai_family == AF_INET) {
+      struct sockaddr_in *sa = (void *)(a->ai_addr);
+      ntopres = inet_ntop(a->ai_family, &(sa->sin_addr), ip[res], NET_ADDRSTRLEN);
+    }
 #if !defined(DJ64) && !defined(CSOCK)
-  else if (r->ai_family == AF_INET6) {
-    struct sockaddr_in6 *a = (void *)(r->ai_addr);
-    ntopres = inet_ntop(r->ai_family, a->sin6_addr.s6_addr, ip, INET6_ADDRSTRLEN);
-  }
+    else if (a->ai_family == AF_INET6) {
+      struct sockaddr_in6 *sa = (void *)(a->ai_addr);
+      ntopres = inet_ntop(a->ai_family, sa->sin6_addr.s6_addr, ip[res], NET_ADDRSTRLEN);
+    }
 #endif
-  else {
-    ntopres = NULL; /* error */
+    if (ntopres == NULL) continue;
+    /* skip duplicates */
+    for (i = 0; i < res; i++) {
+      if (strcmp(ip[i], ip[res]) == 0) break;
+    }
+    if (i == res) res++;
   }
 
   /* free intermediary result */
   freeaddrinfo(r);
 
   /* return exit code */
-  if (ntopres != NULL) return(0);
-  return(-1);
+  if (res == 0) return(-1);
+  return(res);
 }
 
 
@@ -78,7 +164,37 @@ int net_init(void) {
 }
 
 
-struct net_tcpsocket *net_connect(const char *ipaddr, unsigned short port) {
+void net_settuning(int flags, long rcvbuf) {
+  net_tuneflags = flags;
+  net_rcvbuf = rcvbuf;
+}
+
+
+/* applies the tune options to socket s, each of them being kept in s->tune
+ * only if the OS accepted it */
+static void net_tunesock(struct net_tcpsocket *s, int tune) {
+  int one = 1;
+  s->tune = 0;
+#ifdef TCP_NODELAY
+  if ((tune & NET_TUNE_NODELAY) && (setsockopt(s->s, IPPROTO_TCP, TCP_NODELAY, (void *)&one, sizeof(one)) == 0)) s->tune |= NET_TUNE_NODELAY;
+#endif
+#ifdef TCP_QUICKACK
+  if ((tune & NET_TUNE_QUICKACK) && (setsockopt(s->s, IPPROTO_TCP, TCP_QUICKACK, (void *)&one, sizeof(one)) == 0)) s->tune |= NET_TUNE_QUICKACK;
+#endif
+#ifdef TCP_FASTOPEN_CONNECT
+  if ((tune & NET_TUNE_FASTOPEN) && (setsockopt(s->s, IPPROTO_TCP, TCP_FASTOPEN_CONNECT, (void *)&one, sizeof(one)) == 0)) s->tune |= NET_TUNE_FASTOPEN;
+#endif
+  /* must be set before connecting, as the TCP window scale is negotiated
+   * during the handshake */
+  if (net_rcvbuf > 0) {
+    int sz = net_rcvbuf;
+    setsockopt(s->s, SOL_SOCKET, SO_RCVBUF, (void *)&sz, sizeof(sz));
+  }
+  (void)one; /* unused where none of the options above is known */
+}
+
+
+struct net_tcpsocket *net_connect(const char *ipaddr, unsigned short port, int tune) {
   struct sockaddr_in remote4;
 #if !defined(DJ64) && !defined(CSOCK)
   struct sockaddr_in6 remote6;
@@ -115,12 +231,15 @@ struct net_tcpsocket *net_connect(const char *ipaddr, unsigned short port) {
     return(NULL);
   }
 
+  result->tls = NULL;
   result->s = socket(af, SOCK_STREAM, IPPROTO_TCP);
   if (result->s < 0) {
     free(result);
     return(NULL);
   }
 
+  net_tunesock(result, net_tuneflags & tune);
+
   /* set socket non-blocking */
   {
 #if _WIN32
@@ -164,6 +283,208 @@ struct net_tcpsocket *net_connect(const char *ipaddr, unsigned short port) {
 }
 
 
+#ifdef NET_TLS
+
+/* returns the slot of the session cache that host:port uses, or -1 */
+static int net_tlscache_find(const char *host, unsigned short port) {
+  int i;
+  for (i = 0; i < NET_TLSCACHE; i++) {
+    if (net_tlscache[i].sess == NULL) continue;
+    if ((net_tlscache[i].port == port) && (strcasecmp(net_tlscache[i].host, host) == 0)) return(i);
+  }
+  return(-1);
+}
+
+
+static void net_tlscache_drop(int i) {
+  if (net_tlscache[i].sess == NULL) return;
+  SSL_SESSION_free(net_tlscache[i].sess);
+  net_tlscache[i].sess = NULL;
+}
+
+
+/* called by OpenSSL whenever the server hands out a session (TLS 1.3 does
+ * it after the handshake, possibly more than once): the latest one is kept
+ * in place of whatever was known about the server */
+static int net_tlsnewsession(SSL *ssl, SSL_SESSION *sess) {
+  struct net_tls *t = SSL_get_app_data(ssl);
+  int i, j;
+  if ((t == NULL) || (strlen(t->host) >= sizeof(net_tlscache[0].host))) return(0);
+  i = net_tlscache_find(t->host, t->port);
+  if (i < 0) { /* take a free slot, or the least recently used one */
+    i = 0;
+    for (j = 0; j < NET_TLSCACHE; j++) {
+      if (net_tlscache[j].sess == NULL) {
+        i = j;
+        break;
+      }
+      if (net_tlscache[j].lastuse < net_tlscache[i].lastuse) i = j;
+    }
+  }
+  net_tlscache_drop(i);
+  net_tlscache[i].sess = sess;
+  net_tlscache[i].port = t->port;
+  net_tlscache[i].lastuse = ++net_tlsclock;
+  strcpy(net_tlscache[i].host, t->host);
+  return(1); /* the reference to sess is ours now */
+}
+
+
+static int net_tlsinit(void) {
+  if (net_tlsctx != NULL) return(0);
+  net_tlsctx = SSL_CTX_new(TLS_client_method());
+  if (net_tlsctx == NULL) return(-1);
+  SSL_CTX_set_min_proto_version(net_tlsctx, TLS1_2_VERSION);
+  SSL_CTX_set_default_verify_paths(net_tlsctx);
+#ifdef SSL_OP_IGNORE_UNEXPECTED_EOF
+  /* gopher servers mark the end of data by closing the connection, many of
+   * them without bothering about a TLS close_notify */
+  SSL_CTX_set_options(net_tlsctx, SSL_OP_IGNORE_UNEXPECTED_EOF);
+#endif
+  /* sessions are kept by net_tlsnewsession(), per server */
+  SSL_CTX_set_session_cache_mode(net_tlsctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+  SSL_CTX_sess_set_new_cb(net_tlsctx, net_tlsnewsession);
+  return(0);
+}
+
+
+/* frees the TLS state of socket s. the session is closed quietly (no
+ * close_notify is sent) so it stays resumable: a clean TLS shutdown is of
+ * no use to a connection that is over. */
+static void net_tlsfree(struct net_tcpsocket *s) {
+  struct net_tls *t = s->tls;
+  if (t == NULL) return;
+  SSL_set_quiet_shutdown(t->ssl, 1);
+  SSL_shutdown(t->ssl);
+  SSL_free(t->ssl);
+  free(t);
+  s->tls = NULL;
+}
+
+
+/* TLS counterpart of recv(). SSL_read() returns one TLS record at most,
+ * hence the loop: whatever is left decrypted within OpenSSL would not wake
+ * the socket up. returns 0 if nothing is available, -1 on end of
+ * connection. */
+static int net_tlsrecv(struct net_tcpsocket *s, char *buff, long maxlen) {
+  struct net_tls *t = s->tls;
+  int res, len = 0;
+  while (len < maxlen) {
+    ERR_clear_error();
+    res = SSL_read(t->ssl, buff + len, maxlen - len);
+    if (res > 0) {
+      len += res;
+      continue;
+    }
+    res = SSL_get_error(t->ssl, res);
+    if ((res == SSL_ERROR_WANT_READ) || (res == SSL_ERROR_WANT_WRITE)) break;
+    /* end of connection (or error): report it with the next call */
+    if (len > 0) break;
+    return(-1);
+  }
+  return(len);
+}
+
+
+/* returns non-zero if decrypted data is waiting within the TLS layer */
+static int net_tlspending(const struct net_tcpsocket *s) {
+  if (s->tls == NULL) return(0);
+  return(SSL_has_pending(((const struct net_tls *)(s->tls))->ssl));
+}
+
+#endif
+
+
+void net_settls(int verify) {
+#ifdef NET_TLS
+  net_tlsverify = verify;
+#else
+  (void)verify;
+#endif
+}
+
+
+int net_tlsstart(struct net_tcpsocket *s, const char *host, unsigned short port) {
+#ifdef NET_TLS
+  struct net_tls *t;
+  unsigned char addrbin[16];
+  int isaddr, i;
+
+  if (net_tlsinit() != 0) return(-1);
+  t = malloc(sizeof(struct net_tls) + strlen(host));
+  if (t == NULL) return(-1);
+  strcpy(t->host, host);
+  t->port = port;
+  t->ssl = SSL_new(net_tlsctx);
+  if ((t->ssl == NULL) || (SSL_set_fd(t->ssl, s->s) != 1)) {
+    SSL_free(t->ssl);
+    free(t);
+    return(-1);
+  }
+  SSL_set_app_data(t->ssl, t);
+
+  /* SNI is for names only, addresses are checked against IP certificates */
+  isaddr = (inet_pton(AF_INET, host, addrbin) == 1) || (inet_pton(AF_INET6, host, addrbin) == 1);
+  if (!isaddr) SSL_set_tlsext_host_name(t->ssl, host);
+  if (net_tlsverify) {
+    SSL_set_verify(t->ssl, SSL_VERIFY_PEER, NULL);
+    if (isaddr) {
+      X509_VERIFY_PARAM_set1_ip_asc(SSL_get0_param(t->ssl), host);
+    } else {
+      SSL_set1_host(t->ssl, host);
+    }
+  }
+
+  /* resume the previous session with this server, if any */
+  i = net_tlscache_find(host, port);
+  if (i >= 0) {
+    if (SSL_SESSION_is_resumable(net_tlscache[i].sess)) {
+      SSL_set_session(t->ssl, net_tlscache[i].sess);
+      net_tlscache[i].lastuse = ++net_tlsclock;
+    } else {
+      net_tlscache_drop(i);
+    }
+  }
+
+  s->tls = t;
+  return(0);
+#else
+  (void)s;
+  (void)host;
+  (void)port;
+  return(-1);
+#endif
+}
+
+
+int net_tlshandshake(struct net_tcpsocket *s, int *events) {
+#ifdef NET_TLS
+  struct net_tls *t = s->tls;
+  int res, i;
+  if (t == NULL) return(-1);
+  ERR_clear_error();
+  res = SSL_connect(t->ssl);
+  if (res == 1) return(SSL_session_reused(t->ssl) ? 2 : 1);
+  switch (SSL_get_error(t->ssl, res)) {
+    case SSL_ERROR_WANT_READ:
+      *events = NET_EV_READ;
+      return(0);
+    case SSL_ERROR_WANT_WRITE:
+      *events = NET_EV_WRITE;
+      return(0);
+  }
+  /* the stored session may be what the server did not like */
+  i = net_tlscache_find(t->host, t->port);
+  if (i >= 0) net_tlscache_drop(i);
+  return(-1);
+#else
+  (void)s;
+  (void)events;
+  return(-1);
+#endif
+}
+
+
 int net_isconnected(struct net_tcpsocket *s, int waitstate) {
   fd_set set;
   struct timeval t;
@@ -195,6 +516,13 @@ int net_isconnected(struct net_tcpsocket *s, int waitstate) {
    Returns the number of bytes sent on success, and negative value on error */
 int net_send(struct net_tcpsocket *socket, const char *line, long len) {
   int res;
+#ifdef NET_TLS
+  if (socket->tls != NULL) {
+    ERR_clear_error();
+    res = SSL_write(((struct net_tls *)(socket->tls))->ssl, line, len);
+    return((res > 0) ? res : -1);
+  }
+#endif
   res = send(socket->s, line, len, 0);
   return(res);
 }
@@ -204,35 +532,99 @@ int net_send(struct net_tcpsocket *socket, const char *line, long len) {
 Returns the amount of data read (in bytes) on success, or a negative value otherwise. The error code can be translated into a human error message via libtcp_strerr(). */
 int net_recv(struct net_tcpsocket *socket, char *buff, long maxlen) {
   int res;
-  fd_set rfds;
-  struct timeval tv;
-  /* Use select() to wait up to 20ms if nothing awaits on the socket (spares some CPU time) */
-  FD_ZERO(&rfds);
-  FD_SET(socket->s, &rfds);
-  tv.tv_sec = 0;
-  tv.tv_usec = 20000;
-  res = select(socket->s + 1, &rfds, NULL, NULL, &tv);
-  if (res < 0) return(-1);
-  if (res == 0) return(0);
-  /* read the stuff now (if any) */
+
+#ifdef NET_TLS
+  if (socket->tls != NULL) {
+    res = net_tlsrecv(socket, buff, maxlen);
+    if (res <= 0) return(res);
+    goto DONE;
+  }
+#endif
+
+  /* the socket is non-blocking: waiting for data is the business of the
+   * caller's pollset, not of this function */
   res = recv(socket->s, buff, maxlen, 0);
   if (res < 0) {
 #ifdef _WIN32
-    if (WSAGetLastError() == WSAEWOULDBLOCK) return(0);
+    if (WSAGetLastError() != WSAEWOULDBLOCK) return(-1);
 #else
-    if (errno == EAGAIN) return(0);
 #if !defined(CSOCK)
-    if (errno == EWOULDBLOCK) return(0);
+    if ((errno != EAGAIN) && (errno != EWOULDBLOCK)) return(-1);
+#else
+    if (errno != EAGAIN) return(-1);
 #endif
 #endif
+    return(0); /* nothing yet */
   }
   if (res == 0) return(-1); /* the peer performed an orderly shutdown */
+#ifdef NET_TLS
+  DONE:
+#endif
+#ifdef TCP_QUICKACK
+  /* the kernel drops out of quickack mode on its own, it has to be set
+   * again after every read */
+  if (socket->tune & NET_TUNE_QUICKACK) {
+    int one = 1;
+    setsockopt(socket->s, IPPROTO_TCP, TCP_QUICKACK, (void *)&one, sizeof(one));
+  }
+#endif
   return(res);
 }
 
 
+int net_canspliceto(int fd) {
+#ifdef NET_SPLICE
+  struct stat st;
+  /* splice() into anything else than files and pipes is hit-and-miss */
+  if (fstat(fd, &st) != 0) return(0);
+  if (!S_ISREG(st.st_mode) && !S_ISFIFO(st.st_mode)) return(0);
+  if ((net_splicepipe[0] < 0) && (pipe2(net_splicepipe, O_CLOEXEC) != 0)) return(0);
+  return(1);
+#else
+  (void)fd;
+  return(0);
+#endif
+}
+
+
+long net_splice(struct net_tcpsocket *socket, int fd, long maxlen) {
+#ifdef NET_SPLICE
+  ssize_t in, out;
+  char scratch[512];
+
+  /* socket -> pipe (the socket is non-blocking, hence so is this) */
+  if (maxlen > 65536l) maxlen = 65536l; /* default capacity of a pipe */
+  in = splice(socket->s, NULL, net_splicepipe[1], NULL, maxlen, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+  if (in < 0) return(((errno == EAGAIN) || (errno == EWOULDBLOCK)) ? 0 : -1);
+  if (in == 0) return(-1); /* the peer performed an orderly shutdown */
+
+  /* pipe -> fd, until the pipe is empty again */
+  for (maxlen = in; maxlen > 0; maxlen -= out) {
+    out = splice(net_splicepipe[0], NULL, fd, NULL, maxlen, SPLICE_F_MOVE);
+    if (out > 0) continue;
+    /* write failed: drain the pipe so it stays usable for other sockets */
+    while (maxlen > 0) {
+      out = read(net_splicepipe[0], scratch, (maxlen < (long)sizeof(scratch)) ? maxlen : (long)sizeof(scratch));
+      if (out <= 0) break;
+      maxlen -= out;
+    }
+    return(NET_SPLICE_WRERR);
+  }
+  return(in);
+#else
+  (void)socket;
+  (void)fd;
+  (void)maxlen;
+  return(-1);
+#endif
+}
+
+
 /* Close the 'sock' socket. */
 void net_close(struct net_tcpsocket **socket) {
+#ifdef NET_TLS
+  net_tlsfree(*socket);
+#endif
   CLOSESOCK((*socket)->s);
   free(*socket);
   *socket = NULL;
@@ -246,6 +638,12 @@ void net_abort(struct net_tcpsocket **socket) {
 
 
 void net_shut(void) {
+#ifdef NET_TLS
+  int i;
+  for (i = 0; i < NET_TLSCACHE; i++) net_tlscache_drop(i);
+  SSL_CTX_free(net_tlsctx);
+  net_tlsctx = NULL;
+#endif
 #ifdef _WIN32
   WSACleanup();
 #endif
@@ -255,3 +653,321 @@ void net_shut(void) {
 const char *net_engine(void) {
   return("BSD sockets interface");
 }
+
+
+/*** readiness notification ***/
+
+struct net_pollentry {
+  struct net_tcpsocket *sock; /* NULL for a plain descriptor (net_pollset_addfd) */
+  int fd;
+  void *userdata;
+  int events;
+};
+
+struct net_pollset {
+  struct net_pollentry **entry;
+  int count;
+  int alloc;
+#if defined(NET_POLL_EPOLL)
+  int epfd;
+  struct epoll_event *evbuf;
+  int evbufsz;
+#elif defined(NET_POLL_POLL)
+  struct pollfd *pfd;
+#endif
+};
+
+
+/* returns the index of socket s within ps, or -1 if not found */
+static int net_pollset_find(const struct net_pollset *ps, const struct net_tcpsocket *s) {
+  int i;
+  for (i = 0; i < ps->count; i++) {
+    if (ps->entry[i]->sock == s) return(i);
+  }
+  return(-1);
+}
+
+
+#if defined(NET_POLL_EPOLL)
+static unsigned int net_pollset_ev2epoll(int events) {
+  unsigned int res = 0;
+  if (events & NET_EV_READ) res |= EPOLLIN | EPOLLRDHUP;
+  if (events & NET_EV_WRITE) res |= EPOLLOUT;
+  return(res);
+}
+#endif
+
+
+struct net_pollset *net_pollset_new(void) {
+  struct net_pollset *ps;
+  ps = calloc(1, sizeof(struct net_pollset));
+  if (ps == NULL) return(NULL);
+#if defined(NET_POLL_EPOLL)
+  ps->epfd = epoll_create1(EPOLL_CLOEXEC);
+  if (ps->epfd < 0) {
+    free(ps);
+    return(NULL);
+  }
+#endif
+  return(ps);
+}
+
+
+/* appends an entry for socket s (or descriptor fd if s is NULL) to ps */
+static int net_pollset_insert(struct net_pollset *ps, struct net_tcpsocket *s, int fd, int events, void *userdata) {
+  struct net_pollentry *e;
+
+  /* make room for the new entry, if needed */
+  if (ps->count == ps->alloc) {
+    int newalloc = ps->alloc * 2 + 8;
+    void *p;
+    p = realloc(ps->entry, newalloc * sizeof(*ps->entry));
+    if (p == NULL) return(-1);
+    ps->entry = p;
+#if defined(NET_POLL_EPOLL)
+    p = realloc(ps->evbuf, newalloc * sizeof(*ps->evbuf));
+    if (p == NULL) return(-1);
+    ps->evbuf = p;
+    ps->evbufsz = newalloc;
+#elif defined(NET_POLL_POLL)
+    p = realloc(ps->pfd, newalloc * sizeof(*ps->pfd));
+    if (p == NULL) return(-1);
+    ps->pfd = p;
+#endif
+    ps->alloc = newalloc;
+  }
+
+  e = malloc(sizeof(struct net_pollentry));
+  if (e == NULL) return(-1);
+  e->sock = s;
+  e->fd = fd;
+  e->userdata = userdata;
+  e->events = events;
+
+#if defined(NET_POLL_EPOLL)
+  {
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = net_pollset_ev2epoll(events);
+    ev.data.ptr = e;
+    if (epoll_ctl(ps->epfd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+      free(e);
+      return(-1);
+    }
+  }
+#endif
+
+  ps->entry[ps->count++] = e;
+  return(0);
+}
+
+
+int net_pollset_add(struct net_pollset *ps, struct net_tcpsocket *s, int events, void *userdata) {
+  if (net_pollset_find(ps, s) >= 0) return(-1); /* already registered */
+#if !defined(NET_POLL_EPOLL) && !defined(NET_POLL_POLL)
+#ifdef _WIN32
+  if (ps->count >= FD_SETSIZE) return(-1);
+#else
+  if (s->s >= FD_SETSIZE) return(-1);
+#endif
+#endif
+  return(net_pollset_insert(ps, s, s->s, events, userdata));
+}
+
+
+int net_pollset_addfd(struct net_pollset *ps, int fd, void *userdata) {
+#if defined(NET_POLL_EPOLL) || defined(NET_POLL_POLL)
+  if (fd < 0) return(-1);
+  return(net_pollset_insert(ps, NULL, fd, NET_EV_READ, userdata));
+#else
+  /* select() cannot wait on a console under Windows, nor on anything but
+   * sockets with some stacks */
+  (void)ps;
+  (void)fd;
+  (void)userdata;
+  return(-1);
+#endif
+}
+
+
+int net_pollset_fd(const struct net_pollset *ps) {
+#if defined(NET_POLL_EPOLL)
+  return(ps->epfd); /* an epoll descriptor is readable when events are pending */
+#else
+  (void)ps;
+  return(-1);
+#endif
+}
+
+
+int net_pollset_mod(struct net_pollset *ps, struct net_tcpsocket *s, int events) {
+  int i = net_pollset_find(ps, s);
+  if (i < 0) return(-1);
+  if (ps->entry[i]->events == events) return(0); /* nothing changes */
+#if defined(NET_POLL_EPOLL)
+  {
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = net_pollset_ev2epoll(events);
+    ev.data.ptr = ps->entry[i];
+    if (epoll_ctl(ps->epfd, EPOLL_CTL_MOD, s->s, &ev) != 0) return(-1);
+  }
+#endif
+  ps->entry[i]->events = events;
+  return(0);
+}
+
+
+void net_pollset_del(struct net_pollset *ps, struct net_tcpsocket *s) {
+  int i = net_pollset_find(ps, s);
+  if (i < 0) return;
+#if defined(NET_POLL_EPOLL)
+  {
+    struct epoll_event ev; /* pre-2.6.9 kernels require a non-NULL ev */
+    epoll_ctl(ps->epfd, EPOLL_CTL_DEL, s->s, &ev);
+  }
+#endif
+  free(ps->entry[i]);
+  /* move the last entry into the freed slot */
+  ps->count--;
+  ps->entry[i] = ps->entry[ps->count];
+}
+
+
+/* returns non-zero if socket s is among the n first events of ev already */
+static int net_pollset_reported(const struct net_pollevent *ev, int n, const struct net_tcpsocket *s) {
+  int i;
+  if (s == NULL) return(0);
+  for (i = 0; i < n; i++) {
+    if (ev[i].sock == s) return(1);
+  }
+  return(0);
+}
+
+
+int net_pollset_wait(struct net_pollset *ps, struct net_pollevent *ev, int maxev, long timeout) {
+  int i, res, evcount = 0, tlscount;
+
+#ifdef NET_TLS
+  /* data kept decrypted by the TLS layer does not make its socket readable:
+   * report it right away, along with whatever else is ready already (a
+   * descriptor such as the keyboard must not be starved by a busy socket) */
+  for (i = 0; (i < ps->count) && (evcount < maxev); i++) {
+    if ((ps->entry[i]->sock == NULL) || ((ps->entry[i]->events & NET_EV_READ) == 0)) continue;
+    if (net_tlspending(ps->entry[i]->sock) == 0) continue;
+    ev[evcount].sock = ps->entry[i]->sock;
+    ev[evcount].userdata = ps->entry[i]->userdata;
+    ev[evcount].events = NET_EV_READ;
+    evcount++;
+  }
+  if (evcount == maxev) return(evcount);
+  if (evcount > 0) timeout = 0;
+#endif
+  tlscount = evcount;
+
+#if defined(NET_POLL_EPOLL)
+  if (maxev <= 0) return(0);
+  if (ps->evbufsz == 0) { /* empty set: nothing to report, just wait */
+    struct epoll_event dummy;
+    res = epoll_wait(ps->epfd, &dummy, 1, (timeout < 0) ? -1 : (int)timeout);
+    return(((res < 0) && (errno != EINTR)) ? -1 : 0);
+  }
+  if (maxev - evcount > ps->evbufsz) maxev = evcount + ps->evbufsz;
+  res = epoll_wait(ps->epfd, ps->evbuf, maxev - evcount, (timeout < 0) ? -1 : (int)timeout);
+  if (res < 0) return(((errno == EINTR) || (tlscount > 0)) ? tlscount : -1);
+  for (i = 0; i < res; i++) {
+    struct net_pollentry *e = ps->evbuf[i].data.ptr;
+    unsigned int r = ps->evbuf[i].events;
+    if (net_pollset_reported(ev, tlscount, e->sock)) continue;
+    ev[evcount].sock = e->sock;
+    ev[evcount].userdata = e->userdata;
+    ev[evcount].events = 0;
+    if (r & (EPOLLIN | EPOLLRDHUP | EPOLLHUP)) ev[evcount].events |= NET_EV_READ;
+    if (r & EPOLLOUT) ev[evcount].events |= NET_EV_WRITE;
+    if (r & EPOLLERR) ev[evcount].events |= NET_EV_ERR;
+    ev[evcount].events &= e->events | NET_EV_ERR;
+    if (ev[evcount].events != 0) evcount++;
+  }
+
+#elif defined(NET_POLL_POLL)
+  for (i = 0; i < ps->count; i++) {
+    ps->pfd[i].fd = ps->entry[i]->fd;
+    ps->pfd[i].events = 0;
+    ps->pfd[i].revents = 0;
+    if (ps->entry[i]->events & NET_EV_READ) ps->pfd[i].events |= POLLIN;
+    if (ps->entry[i]->events & NET_EV_WRITE) ps->pfd[i].events |= POLLOUT;
+  }
+  res = poll(ps->pfd, ps->count, (timeout < 0) ? -1 : (int)timeout);
+  if (res < 0) return(((errno == EINTR) || (tlscount > 0)) ? tlscount : -1);
+  for (i = 0; (i < ps->count) && (evcount < maxev) && (res > 0); i++) {
+    short r = ps->pfd[i].revents;
+    if (r == 0) continue;
+    res--;
+    if (net_pollset_reported(ev, tlscount, ps->entry[i]->sock)) continue;
+    ev[evcount].sock = ps->entry[i]->sock;
+    ev[evcount].userdata = ps->entry[i]->userdata;
+    ev[evcount].events = 0;
+    if (r & (POLLIN | POLLHUP)) ev[evcount].events |= NET_EV_READ;
+    if (r & POLLOUT) ev[evcount].events |= NET_EV_WRITE;
+    if (r & (POLLERR | POLLNVAL)) ev[evcount].events |= NET_EV_ERR;
+    ev[evcount].events &= ps->entry[i]->events | NET_EV_ERR;
+    if (ev[evcount].events != 0) evcount++;
+  }
+
+#else /* select() */
+  {
+    fd_set rfds, wfds, efds;
+    struct timeval tv;
+    int maxfd = -1;
+#ifdef _WIN32
+    if (ps->count == 0) { /* winsock refuses to select() on nothing */
+      if (timeout > 0) Sleep(timeout);
+      return(0);
+    }
+#endif
+    FD_ZERO(&rfds);
+    FD_ZERO(&wfds);
+    FD_ZERO(&efds);
+    for (i = 0; i < ps->count; i++) {
+      int fd = ps->entry[i]->fd;
+      if (ps->entry[i]->events & NET_EV_READ) FD_SET(fd, &rfds);
+      if (ps->entry[i]->events & NET_EV_WRITE) FD_SET(fd, &wfds);
+      FD_SET(fd, &efds);
+      if (fd > maxfd) maxfd = fd;
+    }
+    tv.tv_sec = timeout / 1000;
+    tv.tv_usec = (timeout % 1000) * 1000;
+    res = select(maxfd + 1, &rfds, &wfds, &efds, (timeout < 0) ? NULL : &tv);
+    if (res < 0) return((tlscount > 0) ? tlscount : -1);
+    for (i = 0; (i < ps->count) && (evcount < maxev) && (res > 0); i++) {
+      int fd = ps->entry[i]->fd;
+      if (net_pollset_reported(ev, tlscount, ps->entry[i]->sock)) continue;
+      ev[evcount].events = 0;
+      if (FD_ISSET(fd, &rfds)) ev[evcount].events |= NET_EV_READ;
+      if (FD_ISSET(fd, &wfds)) ev[evcount].events |= NET_EV_WRITE;
+      if (FD_ISSET(fd, &efds)) ev[evcount].events |= NET_EV_ERR;
+      if (ev[evcount].events == 0) continue;
+      ev[evcount].sock = ps->entry[i]->sock;
+      ev[evcount].userdata = ps->entry[i]->userdata;
+      evcount++;
+    }
+  }
+#endif
+
+  return(evcount);
+}
+
+
+void net_pollset_free(struct net_pollset *ps) {
+  int i;
+  if (ps == NULL) return;
+  for (i = 0; i < ps->count; i++) free(ps->entry[i]);
+  free(ps->entry);
+#if defined(NET_POLL_EPOLL)
+  close(ps->epfd);
+  free(ps->evbuf);
+#elif defined(NET_POLL_POLL)
+  free(ps->pfd);
+#endif
+  free(ps);
+}
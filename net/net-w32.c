@@ -9,6 +9,7 @@
  */
 
 #include <stdlib.h>
+#include <time.h>    /* clock() */
 
 /* Watt32 */
 #include <tcp.h>
@@ -16,14 +17,15 @@
 #include "net.h" /* include self for control */
 
 
-int net_dnsresolve(char *ip, const char *name) {
+int net_dnsresolve(char ip[][NET_ADDRSTRLEN], int maxaddr, const char *name) {
   unsigned long ipnum;
+  if (maxaddr < 1) return(-1);
   ipnum = resolve(name); /* I could use WatTCP's lookup_host() here to do all
                             the job for me, unfortunately lookup_host() issues
                             wild outs() calls putting garbage on screen... */
   if (ipnum == 0) return(-1);
-  _inet_ntoa(ip, ipnum); /* convert to string */
-  return(0);
+  _inet_ntoa(ip[0], ipnum); /* convert to string */
+  return(1); /* Watt-32 knows about a single address per host */
 }
 
 
@@ -41,7 +43,18 @@ int net_init(void) {
 }
 
 
-struct net_tcpsocket *net_connect(const char *ipstr, unsigned short port) {
+/* socket options set through net_settuning(), Watt-32 knows only about
+ * Nagle's algorithm */
+static int net_tuneflags;
+
+
+void net_settuning(int flags, long rcvbuf) {
+  (void)rcvbuf;
+  net_tuneflags = flags;
+}
+
+
+struct net_tcpsocket *net_connect(const char *ipstr, unsigned short port, int tune) {
   struct net_tcpsocket *resultsock;
   unsigned long ipaddr;
 
@@ -66,10 +79,36 @@ struct net_tcpsocket *net_connect(const char *ipstr, unsigned short port) {
     return(NULL);
   }
 
+  if (net_tuneflags & tune & NET_TUNE_NODELAY) {
+    sock_mode(resultsock->sock, TCP_MODE_NONAGLE);
+    resultsock->tune = NET_TUNE_NODELAY;
+  }
+
   return(resultsock);
 }
 
 
+/* there is no TLS library for Watt-32 */
+void net_settls(int verify) {
+  (void)verify;
+}
+
+
+int net_tlsstart(struct net_tcpsocket *s, const char *host, unsigned short port) {
+  (void)s;
+  (void)host;
+  (void)port;
+  return(-1);
+}
+
+
+int net_tlshandshake(struct net_tcpsocket *s, int *events) {
+  (void)s;
+  (void)events;
+  return(-1);
+}
+
+
 int net_isconnected(struct net_tcpsocket *s, int waitstate) {
   waitstate = waitstate; /* gcc warning shut */
   if (tcp_tick(s->sock) == 0) return(-1);
@@ -101,6 +140,21 @@ int net_recv(struct net_tcpsocket *socket, char *buff, long maxlen) {
 }
 
 
+/* Watt-32 has no such thing as zero-copy transfers */
+int net_canspliceto(int fd) {
+  (void)fd;
+  return(0);
+}
+
+
+long net_splice(struct net_tcpsocket *socket, int fd, long maxlen) {
+  (void)socket;
+  (void)fd;
+  (void)maxlen;
+  return(-1);
+}
+
+
 /* Close the 'sock' socket. */
 void net_close(struct net_tcpsocket **socket) {
   /* I could use sock_close() and sock_wait_closed() if I'd want to be
@@ -126,3 +180,115 @@ void net_shut(void) {
 const char *net_engine(void) {
   return(wattcpVersion());
 }
+
+
+/*** readiness notification ***/
+
+/* Watt-32 has no notion of waiting on several sockets at once, so the set is
+ * a plain array polled in a tcp_tick() loop until something happens */
+
+struct net_pollentry {
+  struct net_tcpsocket *sock;
+  void *userdata;
+  int events;
+};
+
+struct net_pollset {
+  struct net_pollentry *entry;
+  int count;
+  int alloc;
+};
+
+
+static int net_pollset_find(const struct net_pollset *ps, const struct net_tcpsocket *s) {
+  int i;
+  for (i = 0; i < ps->count; i++) {
+    if (ps->entry[i].sock == s) return(i);
+  }
+  return(-1);
+}
+
+
+struct net_pollset *net_pollset_new(void) {
+  return(calloc(1, sizeof(struct net_pollset)));
+}
+
+
+int net_pollset_add(struct net_pollset *ps, struct net_tcpsocket *s, int events, void *userdata) {
+  if (net_pollset_find(ps, s) >= 0) return(-1);
+  if (ps->count == ps->alloc) {
+    void *p = realloc(ps->entry, (ps->alloc + 4) * sizeof(struct net_pollentry));
+    if (p == NULL) return(-1);
+    ps->entry = p;
+    ps->alloc += 4;
+  }
+  ps->entry[ps->count].sock = s;
+  ps->entry[ps->count].userdata = userdata;
+  ps->entry[ps->count].events = events;
+  ps->count++;
+  return(0);
+}
+
+
+int net_pollset_mod(struct net_pollset *ps, struct net_tcpsocket *s, int events) {
+  int i = net_pollset_find(ps, s);
+  if (i < 0) return(-1);
+  ps->entry[i].events = events;
+  return(0);
+}
+
+
+void net_pollset_del(struct net_pollset *ps, struct net_tcpsocket *s) {
+  int i = net_pollset_find(ps, s);
+  if (i < 0) return;
+  ps->count--;
+  ps->entry[i] = ps->entry[ps->count];
+}
+
+
+/* Watt-32 has no file descriptors */
+int net_pollset_addfd(struct net_pollset *ps, int fd, void *userdata) {
+  (void)ps;
+  (void)fd;
+  (void)userdata;
+  return(-1);
+}
+
+
+int net_pollset_fd(const struct net_pollset *ps) {
+  (void)ps;
+  return(-1);
+}
+
+
+int net_pollset_wait(struct net_pollset *ps, struct net_pollevent *ev, int maxev, long timeout) {
+  clock_t start = clock();
+  int i, evcount;
+  for (;;) {
+    evcount = 0;
+    for (i = 0; (i < ps->count) && (evcount < maxev); i++) {
+      struct net_pollentry *e = &(ps->entry[i]);
+      int r = 0;
+      if (tcp_tick(e->sock->sock) == 0) {
+        r = NET_EV_ERR | (e->events & NET_EV_READ); /* connection is gone */
+      } else {
+        if ((e->events & NET_EV_READ) && (sock_dataready(e->sock->sock) > 0)) r |= NET_EV_READ;
+        if ((e->events & NET_EV_WRITE) && (sock_established(e->sock->sock) != 0)) r |= NET_EV_WRITE;
+      }
+      if (r == 0) continue;
+      ev[evcount].sock = e->sock;
+      ev[evcount].userdata = e->userdata;
+      ev[evcount].events = r;
+      evcount++;
+    }
+    if (evcount > 0) return(evcount);
+    if ((timeout >= 0) && ((clock() - start) * 1000l / CLOCKS_PER_SEC >= timeout)) return(0);
+  }
+}
+
+
+void net_pollset_free(struct net_pollset *ps) {
+  if (ps == NULL) return;
+  free(ps->entry);
+  free(ps);
+}
@@ -10,19 +10,59 @@
 struct net_tcpsocket {
   int s;       /* used by platforms with BSD-style sockets */
   void *sock;  /* used by other exotic things (like Watt-32) */
+  int tune;    /* NET_TUNE_* options in effect on the socket */
+  void *tls;   /* TLS session state, NULL for plain connections */
   char buffer[1];
 };
 
-/* resolves name and fills resovled addr into ip. returns 0 on success. */
-int net_dnsresolve(char *ip, const char *name);
+/* socket options, see net_settuning() */
+#define NET_TUNE_NODELAY  1  /* disable Nagle's algorithm */
+#define NET_TUNE_QUICKACK 2  /* acknowledge received data right away */
+#define NET_TUNE_FASTOPEN 4  /* TCP Fast Open: first data goes in the SYN */
+
+/* max length of an IP address string (IPv6 included), with its terminator */
+#define NET_ADDRSTRLEN 48
+
+/* returned by net_dnsresolve() when the name is known not to exist */
+#define NET_DNS_NOHOST -2
+
+/* resolves name and fills ip with up to maxaddr of its addresses, in the
+ * order preferred by the system resolver. returns the amount of addresses
+ * found, NET_DNS_NOHOST if name does not exist or -1 on any other error. */
+int net_dnsresolve(char ip[][NET_ADDRSTRLEN], int maxaddr, const char *name);
 
 /* must be called before using libtcp. returns 0 on success, or non-zero if network subsystem is not available. */
 int net_init(void);
 
+/* sets the options of sockets created from now on: NET_TUNE_* flags and
+ * the size (bytes) of their receive buffer (0 leaves it up to the OS).
+ * these are hints: whatever the OS does not support is silently skipped. */
+void net_settuning(int flags, long rcvbuf);
+
 /* initiates a connection to an IP host and returns a socket pointer (or NULL
  * on error) - note that connection is NOT established at this point!
- * use net_isconnected() to know when the connection is connected. */
-struct net_tcpsocket *net_connect(const char *ip, unsigned short port);
+ * use net_isconnected() to know when the connection is connected. tune
+ * masks the options set through net_settuning() (-1 keeps them all).
+ * with NET_TUNE_FASTOPEN in effect the connection looks established right
+ * away, as the handshake is deferred until data is sent. */
+struct net_tcpsocket *net_connect(const char *ip, unsigned short port, int tune);
+
+/* sets up how TLS sessions are established: if verify is non-zero, the
+ * server's certificate must be valid for the host name it is reached by. */
+void net_settls(int verify);
+
+/* starts a TLS session over the connected socket s, host and port being
+ * those of the server (used for SNI, the certificate check and to find an
+ * earlier session with the same server that may be resumed). returns 0 on
+ * success, non-zero if TLS is not available. */
+int net_tlsstart(struct net_tcpsocket *s, const char *host, unsigned short port);
+
+/* makes the TLS handshake of socket s progress without blocking. returns:
+ *  0 = in progress, *events being set to the NET_EV_* flags to wait for,
+ *  1 = secured through a full handshake,
+ *  2 = secured by resuming an earlier session,
+ * -1 = error */
+int net_tlshandshake(struct net_tcpsocket *s, int *events);
 
 /* checks whether or not a socket is connected. returns:
  *  0 = not connected,
@@ -41,6 +81,19 @@ int net_send(struct net_tcpsocket *socket, const char *line, long len);
 Returns the amount of data read (in bytes) on success, or a negative value otherwise. The error code can be translated into a human error message via libtcp_strerr(). */
 int net_recv(struct net_tcpsocket *socket, char *buff, long maxlen);
 
+/* returned by net_splice() when writing to the destination failed */
+#define NET_SPLICE_WRERR -2
+
+/* tells whether net_splice() can write into file descriptor fd (non-zero)
+ * or not (0), in which case net_recv() must be used instead */
+int net_canspliceto(int fd);
+
+/* moves up to maxlen bytes pending on socket straight into file descriptor
+ * fd, without copying them through a userspace buffer (Linux splice()).
+ * returns the amount of bytes moved, 0 if nothing was pending, -1 on end of
+ * connection or NET_SPLICE_WRERR if writing to fd failed. */
+long net_splice(struct net_tcpsocket *socket, int fd, long maxlen);
+
 /* Close the 'sock' socket. */
 void net_close(struct net_tcpsocket **socket);
 
@@ -53,4 +106,56 @@ void net_shut(void);
 /* Returns an info string about the networking engine being used */
 const char *net_engine(void);
 
+
+/*** readiness notification: waiting on many sockets at once ***/
+
+/* event flags used by the net_pollset_*() functions */
+#define NET_EV_READ  1  /* data (or an end of connection) awaits on socket */
+#define NET_EV_WRITE 2  /* socket is writeable (ie. connection established) */
+#define NET_EV_ERR   4  /* socket is in error state */
+
+struct net_pollset; /* opaque, the details are known to the net backend only */
+
+struct net_pollevent {
+  struct net_tcpsocket *sock;
+  void *userdata; /* the pointer provided to net_pollset_add() */
+  int events;     /* NET_EV_* flags that are active on sock */
+};
+
+/* allocates a new (empty) set of sockets to watch, returns NULL on error */
+struct net_pollset *net_pollset_new(void);
+
+/* registers socket s in set ps, watching for events (NET_EV_READ and/or
+ * NET_EV_WRITE). userdata is returned as-is by net_pollset_wait() along with
+ * events of the socket. returns 0 on success, non-zero otherwise. */
+int net_pollset_add(struct net_pollset *ps, struct net_tcpsocket *s, int events, void *userdata);
+
+/* changes the set of events watched on a socket that is already registered */
+int net_pollset_mod(struct net_pollset *ps, struct net_tcpsocket *s, int events);
+
+/* removes socket s from set ps. must be called BEFORE the socket is closed */
+void net_pollset_del(struct net_pollset *ps, struct net_tcpsocket *s);
+
+/* registers file descriptor fd (the terminal, or the one of another set, see
+ * net_pollset_fd()) in set ps, watching it for readability. it is reported by
+ * net_pollset_wait() with sock set to NULL. returns non-zero if the backend
+ * can watch sockets only, in which case the caller has to fall back to
+ * polling whatever fd stands for. */
+int net_pollset_addfd(struct net_pollset *ps, int fd, void *userdata);
+
+/* returns a file descriptor that becomes readable whenever a socket of set ps
+ * is ready, so ps can be waited on as part of another set. data buffered by
+ * the TLS layer does not count, a zero-timeout net_pollset_wait() on ps has
+ * to be done first. returns -1 if the backend provides no such thing. */
+int net_pollset_fd(const struct net_pollset *ps);
+
+/* waits up to timeout ms (forever if timeout is negative) for any socket of
+ * set ps to become ready, and fills ev with at most maxev events. NET_EV_ERR
+ * is always reported, even if not asked for. returns the amount of filled
+ * events, 0 on timeout or a negative value on error. */
+int net_pollset_wait(struct net_pollset *ps, struct net_pollevent *ev, int maxev, long timeout);
+
+/* frees set ps (sockets that are still registered are NOT closed) */
+void net_pollset_free(struct net_pollset *ps);
+
 #endif
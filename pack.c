@@ -0,0 +1,565 @@
+/*
+ * This file is part of the Gopherus project.
+ * Copyright (C) 2013-2022 Mateusz Viste
+ */
+
+#include <stdio.h>
+#include <stdlib.h>  /* malloc(), free(), qsort(), atoi() */
+#include <string.h>  /* memcmp(), strcmp(), strlen() */
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#include "config.h"
+#include "fs/fs.h"
+#include "parseurl.h"
+
+#include "pack.h" /* include self for control */
+
+/* layout of a pack file, all integers being little endian:
+ *
+ *   header  : magic (8), version (u16), reserved (u16), amount of entries
+ *             (u32), offset of the index (u32), offset and length of the
+ *             string table (u32 + u32), root url in the string table (u32)
+ *   blobs   : the resources, one after the other, raw or deflated
+ *   strings : the root url and the keys (see buildurlkey()), each one
+ *             nul-terminated
+ *   index   : one PACK_RECSZ record per resource, sorted by key: key in the
+ *             string table (u32), data offset (u32), stored length (u32),
+ *             actual length (u32), item type (u8), method (u8), reserved (u16)
+ */
+#define PACK_MAGIC "GPHRPACK"
+#define PACK_VERSION 1
+#define PACK_HDRSZ 32
+#define PACK_RECSZ 20
+#define PACK_NOROOT 0xfffffffful
+
+/* highest offset (or length) that fits in the u32 fields of a pack */
+#define PACK_MAX32 0xfffffffful
+
+/* how blobs are stored */
+#define PACK_RAW 0
+#define PACK_DEFLATE 1
+
+/* how much of a blob is read (or written) at a time */
+#define PACK_CHUNK 4096
+
+/* max length of a key */
+#define PACK_MAXKEY (MAXHOSTLEN + MAXSELLEN + 8)
+
+/* max length of a line of a mirror's index */
+#define PACK_MAXLINE (MAXURLLEN + 600)
+
+struct pack {
+  FILE *fd;
+  const unsigned char *map; /* the whole file, NULL if it could not be mapped */
+  unsigned char *tmp;       /* chunks of blobs are read there if not mapped */
+  long size;
+  unsigned long count;
+  unsigned long indexoff;
+  unsigned long stroff;
+  unsigned long strsz;
+  unsigned long rootoff;
+};
+
+/* an entry of a pack being built */
+struct pack_entry {
+  char *key;
+  unsigned long dataoff;
+  unsigned long stored;
+  unsigned long len;
+  char itemtype;
+  unsigned char method;
+};
+
+
+static unsigned long pack_get32(const unsigned char *b) {
+  return((unsigned long)b[0] | ((unsigned long)b[1] << 8) | ((unsigned long)b[2] << 16) | ((unsigned long)b[3] << 24));
+}
+
+
+static void pack_put32(unsigned char *b, unsigned long v) {
+  b[0] = v & 0xff;
+  b[1] = (v >> 8) & 0xff;
+  b[2] = (v >> 16) & 0xff;
+  b[3] = (v >> 24) & 0xff;
+}
+
+
+/* returns a pointer to len bytes found at off in pack p: right into the
+ * mapping if there is one, otherwise they are read into tmp first. returns
+ * NULL if they cannot be read. */
+static const unsigned char *pack_src(const struct pack *p, unsigned long off, long len, unsigned char *tmp) {
+  if ((off > (unsigned long)p->size) || (len > p->size - (long)off)) return(NULL);
+  if (p->map != NULL) return(p->map + off);
+  if (fseek(p->fd, (long)off, SEEK_SET) != 0) return(NULL);
+  if (fread(tmp, 1, len, p->fd) != (size_t)len) return(NULL);
+  return(tmp);
+}
+
+
+struct pack *pack_open(const char *fname) {
+  struct pack *p;
+  unsigned char hdr[PACK_HDRSZ];
+  const unsigned char *h;
+
+  p = calloc(1, sizeof(struct pack));
+  if (p == NULL) return(NULL);
+  p->fd = fopen(fname, "rb");
+  if (p->fd == NULL) goto FAIL;
+  if (fseek(p->fd, 0, SEEK_END) != 0) goto FAIL;
+  p->size = ftell(p->fd);
+  h = pack_src(p, 0, PACK_HDRSZ, hdr);
+  if ((h == NULL) || (memcmp(h, PACK_MAGIC, 8) != 0)) goto FAIL;
+  if ((h[8] | (h[9] << 8)) != PACK_VERSION) goto FAIL;
+  p->count = pack_get32(h + 12);
+  p->indexoff = pack_get32(h + 16);
+  p->stroff = pack_get32(h + 20);
+  p->strsz = pack_get32(h + 24);
+  p->rootoff = pack_get32(h + 28);
+  /* the index and the string table must lie within the file */
+  if ((p->indexoff > (unsigned long)p->size) || (p->count > ((unsigned long)p->size - p->indexoff) / PACK_RECSZ)) goto FAIL;
+  if ((p->stroff > (unsigned long)p->size) || (p->strsz > (unsigned long)p->size - p->stroff)) goto FAIL;
+  p->map = filemap(p->fd, p->size);
+  if (p->map == NULL) {
+    p->tmp = malloc(PACK_CHUNK);
+    if (p->tmp == NULL) goto FAIL;
+  }
+  return(p);
+
+  FAIL:
+  pack_close(p);
+  return(NULL);
+}
+
+
+void pack_close(struct pack *p) {
+  if (p == NULL) return;
+  if (p->map != NULL) fileunmap(p->map, p->size);
+  if (p->fd != NULL) fclose(p->fd);
+  free(p->tmp);
+  free(p);
+}
+
+
+/* copies string at off in the string table of p into s, returns 0 on
+ * success */
+static int pack_str(const struct pack *p, unsigned long off, char *s, size_t ssz) {
+  const unsigned char *src;
+  long len;
+  if (off >= p->strsz) return(-1);
+  len = p->strsz - off;
+  if ((unsigned long)len > ssz) len = ssz;
+  src = pack_src(p, p->stroff + off, len, (unsigned char *)s);
+  if (src == NULL) return(-1);
+  if (src != (unsigned char *)s) memcpy(s, src, len);
+  if (memchr(s, 0, len) == NULL) return(-1); /* too long, or not terminated */
+  return(0);
+}
+
+
+int pack_root(const struct pack *p, char *url, size_t urlsz) {
+  if (p->rootoff == PACK_NOROOT) return(-1);
+  return(pack_str(p, p->rootoff, url, urlsz));
+}
+
+
+long pack_find(const struct pack *p, const char *host, unsigned short port, const char *selector) {
+  char key[PACK_MAXKEY], k[PACK_MAXKEY];
+  unsigned char rec[PACK_RECSZ];
+  unsigned long lo = 0, hi = p->count;
+
+  if ((strlen(host) >= MAXHOSTLEN) || (strlen(selector) >= MAXSELLEN)) return(-1);
+  buildurlkey(key, host, port, selector);
+  while (lo < hi) {
+    unsigned long mid = lo + (hi - lo) / 2;
+    const unsigned char *r = pack_src(p, p->indexoff + mid * PACK_RECSZ, PACK_RECSZ, rec);
+    int cmp;
+    if ((r == NULL) || (pack_str(p, pack_get32(r), k, sizeof(k)) != 0)) return(-1);
+    cmp = strcmp(key, k);
+    if (cmp == 0) return((long)mid);
+    if (cmp < 0) {
+      hi = mid;
+    } else {
+      lo = mid + 1;
+    }
+  }
+  return(-1);
+}
+
+
+long pack_len(struct pack *p, long entry) {
+  unsigned char rec[PACK_RECSZ];
+  const unsigned char *r;
+  if ((entry < 0) || ((unsigned long)entry >= p->count)) return(-1);
+  r = pack_src(p, p->indexoff + entry * PACK_RECSZ, PACK_RECSZ, rec);
+  if (r == NULL) return(-1);
+  return((long)pack_get32(r + 12));
+}
+
+
+long pack_read(struct pack *p, long entry, char *buff, long buffsz, FILE *out) {
+  unsigned char rec[PACK_RECSZ];
+  const unsigned char *r;
+  unsigned long off, stored, len, done;
+  long got = 0;
+
+  if ((entry < 0) || ((unsigned long)entry >= p->count)) return(-1);
+  r = pack_src(p, p->indexoff + entry * PACK_RECSZ, PACK_RECSZ, rec);
+  if (r == NULL) return(-1);
+  off = pack_get32(r + 4);
+  stored = pack_get32(r + 8);
+  len = pack_get32(r + 12);
+
+  if (r[17] == PACK_RAW) {
+    if (stored != len) return(-1);
+    for (done = 0; done < stored;) {
+      long n = stored - done;
+      const unsigned char *src;
+      if (n > PACK_CHUNK) n = PACK_CHUNK;
+      if ((out == NULL) && (n > buffsz - got)) n = buffsz - got;
+      if (n == 0) break;
+      src = pack_src(p, off + done, n, p->tmp);
+      if (src == NULL) return(-1);
+      if (out != NULL) {
+        if (fwrite(src, 1, n, out) != (size_t)n) return(-1);
+      } else {
+        memcpy(buff + got, src, n);
+        got += n;
+      }
+      done += n;
+    }
+    return((out != NULL) ? (long)len : got);
+  }
+
+#ifdef HAVE_ZLIB
+  if (r[17] == PACK_DEFLATE) {
+    z_stream zs;
+    int zr = Z_OK;
+    memset(&zs, 0, sizeof(zs));
+    if (inflateInit(&zs) != Z_OK) return(-1);
+    for (done = 0; zr != Z_STREAM_END;) {
+      if (zs.avail_in == 0) {
+        long n = stored - done;
+        if (n > PACK_CHUNK) n = PACK_CHUNK;
+        if (n == 0) break; /* truncated stream */
+        zs.next_in = (unsigned char *)pack_src(p, off + done, n, p->tmp);
+        if (zs.next_in == NULL) break;
+        zs.avail_in = n;
+        done += n;
+      }
+      if (out != NULL) {
+        zs.next_out = (unsigned char *)buff;
+        zs.avail_out = buffsz;
+      } else {
+        if (got == buffsz) break;
+        zs.next_out = (unsigned char *)buff + got;
+        zs.avail_out = buffsz - got;
+      }
+      zr = inflate(&zs, Z_NO_FLUSH);
+      if ((zr != Z_OK) && (zr != Z_STREAM_END)) break;
+      if (out != NULL) {
+        long n = buffsz - zs.avail_out;
+        if (fwrite(buff, 1, n, out) != (size_t)n) break;
+      } else {
+        got = buffsz - zs.avail_out;
+      }
+    }
+    inflateEnd(&zs);
+    if (out != NULL) return((zr == Z_STREAM_END) ? (long)len : -1);
+    if ((zr != Z_STREAM_END) && (got < buffsz)) return(-1);
+    return(got);
+  }
+#else
+  (void)buff;
+  (void)buffsz;
+  (void)out;
+#endif
+
+  return(-1); /* unknown method, or no zlib to inflate it */
+}
+
+
+/*** building a pack ***/
+
+/* returns the current offset of pack fd being built, or -1 if it is not
+ * known or does not fit in a pack */
+static long pack_tell(FILE *fd) {
+  long off = ftell(fd);
+  if ((off < 0) || ((unsigned long)off > PACK_MAX32)) return(-1);
+  return(off);
+}
+
+
+static int pack_cmpentry(const void *a, const void *b) {
+  return(strcmp(((const struct pack_entry *)a)->key, ((const struct pack_entry *)b)->key));
+}
+
+
+/* appends the content of file fname to pack fd, deflated if PACK_COMPRESS
+ * is set and that makes it smaller. fills the location, sizes and method of
+ * e. returns 0 on success, non-zero on error (*err telling why). */
+static int pack_addblob(FILE *fd, const char *fname, struct pack_entry *e, unsigned char *in, unsigned char *out, const char **err) {
+  FILE *src;
+  long n;
+
+  src = fopen(fname, "rb");
+  if (src == NULL) {
+    *err = "a file of the mirror is missing";
+    return(-1);
+  }
+  n = pack_tell(fd);
+  if (n < 0) {
+    fclose(src);
+    *err = "pack too large";
+    return(-1);
+  }
+  e->dataoff = n;
+  e->len = 0;
+
+#if defined(HAVE_ZLIB) && PACK_COMPRESS
+  {
+    z_stream zs;
+    int zr = Z_OK;
+    const char *why = "write error";
+    memset(&zs, 0, sizeof(zs));
+    if (deflateInit(&zs, Z_DEFAULT_COMPRESSION) != Z_OK) {
+      fclose(src);
+      *err = "out of memory";
+      return(-1);
+    }
+    e->stored = 0;
+    while (zr != Z_STREAM_END) {
+      int flush = Z_NO_FLUSH;
+      if (zs.avail_in == 0) {
+        n = fread(in, 1, PACK_CHUNK, src);
+        if ((unsigned long)n > PACK_MAX32 - e->len) {
+          why = "pack too large";
+          break;
+        }
+        e->len += n;
+        zs.next_in = in;
+        zs.avail_in = n;
+        if (n < PACK_CHUNK) flush = Z_FINISH;
+      } else if (feof(src)) {
+        flush = Z_FINISH;
+      }
+      zs.next_out = out;
+      zs.avail_out = PACK_CHUNK;
+      zr = deflate(&zs, flush);
+      if (zr == Z_STREAM_ERROR) break;
+      n = PACK_CHUNK - zs.avail_out;
+      if ((unsigned long)n > PACK_MAX32 - e->stored) {
+        why = "pack too large";
+        break;
+      }
+      if (fwrite(out, 1, n, fd) != (size_t)n) break;
+      e->stored += n;
+    }
+    deflateEnd(&zs);
+    if (zr != Z_STREAM_END) {
+      fclose(src);
+      *err = why;
+      return(-1);
+    }
+    if (e->stored < e->len) {
+      e->method = PACK_DEFLATE;
+      fclose(src);
+      return(0);
+    }
+    /* not worth it (already compressed data...), store it raw instead */
+    rewind(src);
+    if (fseek(fd, e->dataoff, SEEK_SET) != 0) {
+      fclose(src);
+      *err = "write error";
+      return(-1);
+    }
+  }
+#else
+  (void)out;
+#endif
+
+  e->method = PACK_RAW;
+  e->len = 0;
+  while ((n = fread(in, 1, PACK_CHUNK, src)) > 0) {
+    if ((unsigned long)n > PACK_MAX32 - e->len) {
+      fclose(src);
+      *err = "pack too large";
+      return(-1);
+    }
+    if (fwrite(in, 1, n, fd) != (size_t)n) {
+      fclose(src);
+      *err = "write error";
+      return(-1);
+    }
+    e->len += n;
+  }
+  e->stored = e->len;
+  fclose(src);
+  return(0);
+}
+
+
+long pack_build(const char *mirrordir, const char *packfile, const char **err) {
+  struct pack_entry *entry = NULL;
+  unsigned char hdr[PACK_HDRSZ], rec[PACK_RECSZ];
+  unsigned char *in = NULL, *out = NULL;
+  char *line = NULL, *fname = NULL, root[MAXURLLEN] = "";
+  unsigned long count = 0, alloc = 0, i, j, stroff, strsz, indexoff;
+  FILE *idx = NULL, *fd = NULL;
+  long res = -1, off;
+
+  in = malloc(PACK_CHUNK);
+  out = malloc(PACK_CHUNK);
+  line = malloc(PACK_MAXLINE);
+  fname = malloc(PACK_MAXLINE + strlen(mirrordir));
+  if ((in == NULL) || (out == NULL) || (line == NULL) || (fname == NULL)) {
+    *err = "out of memory";
+    goto DONE;
+  }
+  sprintf(fname, "%s/index.txt", mirrordir);
+  idx = fopen(fname, "rb");
+  if (idx == NULL) {
+    *err = "no mirror index found";
+    goto DONE;
+  }
+  fd = fopen(packfile, "wb");
+  if (fd == NULL) {
+    *err = "cannot create the pack file";
+    goto DONE;
+  }
+  /* the header is written last, once the offsets are known */
+  memset(hdr, 0, sizeof(hdr));
+  if (fwrite(hdr, 1, sizeof(hdr), fd) != sizeof(hdr)) {
+    *err = "write error";
+    goto DONE;
+  }
+
+  /* store every resource listed in the mirror's index */
+  while (fgets(line, PACK_MAXLINE, idx) != NULL) {
+    char host[MAXHOSTLEN], selector[MAXSELLEN], key[PACK_MAXKEY], *f[4], itemtype;
+    unsigned short port;
+    unsigned char protocol;
+
+    line[strcspn(line, "\r\n")] = 0;
+    f[0] = line;
+    for (i = 1; i < 4; i++) {
+      f[i] = strchr(f[i - 1], '\t');
+      if (f[i] == NULL) break;
+      *(f[i]++) = 0;
+    }
+    if (i < 4) continue;
+    if ((atoi(f[0]) == 0) && (root[0] == 0) && (strlen(f[2]) < sizeof(root))) strcpy(root, f[2]);
+    protocol = parsegopherurl(f[2], host, sizeof(host), &port, &itemtype, selector, sizeof(selector));
+    if ((protocol != PARSEURL_PROTO_GOPHER) && (protocol != PARSEURL_PROTO_GOPHERS)) continue;
+    buildurlkey(key, host, port, selector);
+
+    if (count == alloc) {
+      void *p = realloc(entry, (alloc + 64) * sizeof(struct pack_entry));
+      if (p == NULL) {
+        *err = "out of memory";
+        goto DONE;
+      }
+      entry = p;
+      alloc += 64;
+    }
+    entry[count].key = malloc(strlen(key) + 1);
+    if (entry[count].key == NULL) {
+      *err = "out of memory";
+      goto DONE;
+    }
+    strcpy(entry[count].key, key);
+    entry[count].itemtype = itemtype;
+    count++;
+    sprintf(fname, "%s/%s", mirrordir, f[3]);
+    if (pack_addblob(fd, fname, &(entry[count - 1]), in, out, err) != 0) goto DONE;
+  }
+
+  /* sort the entries, dropping duplicates (a mirror resumed by hand...) */
+  if (count > 0) qsort(entry, count, sizeof(struct pack_entry), pack_cmpentry);
+  for (i = 1, j = 1; i < count; i++) {
+    if (strcmp(entry[i].key, entry[j - 1].key) == 0) {
+      free(entry[i].key);
+      continue;
+    }
+    entry[j++] = entry[i];
+  }
+  if (count > 0) count = j;
+
+  /* string table: the root url, then the keys */
+  off = pack_tell(fd);
+  if (off < 0) {
+    *err = "pack too large";
+    goto DONE;
+  }
+  stroff = off;
+  strsz = 0;
+  if (root[0] != 0) {
+    fwrite(root, 1, strlen(root) + 1, fd);
+    strsz = strlen(root) + 1;
+  }
+  for (i = 0; i < count; i++) {
+    size_t l = strlen(entry[i].key) + 1;
+    fwrite(entry[i].key, 1, l, fd);
+    strsz += l;
+  }
+
+  /* index, key offsets follow the order the keys have been written in */
+  off = pack_tell(fd);
+  if (off < 0) {
+    *err = "pack too large";
+    goto DONE;
+  }
+  indexoff = off;
+  for (i = 0, j = (root[0] != 0) ? strlen(root) + 1 : 0; i < count; i++) {
+    pack_put32(rec, j);
+    pack_put32(rec + 4, entry[i].dataoff);
+    pack_put32(rec + 8, entry[i].stored);
+    pack_put32(rec + 12, entry[i].len);
+    rec[16] = entry[i].itemtype;
+    rec[17] = entry[i].method;
+    rec[18] = 0;
+    rec[19] = 0;
+    fwrite(rec, 1, sizeof(rec), fd);
+    j += strlen(entry[i].key) + 1;
+  }
+
+  /* header */
+  memcpy(hdr, PACK_MAGIC, 8);
+  hdr[8] = PACK_VERSION & 0xff;
+  hdr[9] = PACK_VERSION >> 8;
+  pack_put32(hdr + 12, count);
+  pack_put32(hdr + 16, indexoff);
+  pack_put32(hdr + 20, stroff);
+  pack_put32(hdr + 24, strsz);
+  pack_put32(hdr + 28, (root[0] != 0) ? 0 : PACK_NOROOT);
+  off = pack_tell(fd); /* a blob stored raw after a deflate attempt may have left garbage past the end */
+  if (off < 0) {
+    *err = "pack too large";
+    goto DONE;
+  }
+  if ((fseek(fd, 0, SEEK_SET) != 0) || (fwrite(hdr, 1, sizeof(hdr), fd) != sizeof(hdr)) || (ferror(fd) != 0)) {
+    *err = "write error";
+    goto DONE;
+  }
+  if (fclose(fd) != 0) {
+    fd = NULL;
+    *err = "write error";
+    goto DONE;
+  }
+  fd = NULL;
+  filetrunc(packfile, off);
+  res = count;
+
+  DONE:
+  if (fd != NULL) fclose(fd);
+  if (idx != NULL) fclose(idx);
+  for (i = 0; i < count; i++) free(entry[i].key);
+  free(entry);
+  free(in);
+  free(out);
+  free(line);
+  free(fname);
+  return(res);
+}
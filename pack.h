@@ -0,0 +1,47 @@
+/*
+ * This file is part of the Gopherus project.
+ * Copyright (C) 2013-2022 Mateusz Viste
+ *
+ * Offline packs: many gopher resources held in a single file, along with an
+ * index sorted by url so any of them is found with a binary search. Packs
+ * are built out of a mirror (see crawl.h) and browsed read-only, memory
+ * mapped where the platform allows it.
+ */
+
+#ifndef pack_h_sentinel
+#define pack_h_sentinel
+
+#include <stdio.h>
+
+struct pack; /* opaque */
+
+/* opens pack file fname. returns NULL if it cannot be read or is not a
+ * valid pack. */
+struct pack *pack_open(const char *fname);
+
+/* closes pack p */
+void pack_close(struct pack *p);
+
+/* copies the url the pack has been built from (the root of its mirror) into
+ * url. returns 0 on success, non-zero if the pack does not tell. */
+int pack_root(const struct pack *p, char *url, size_t urlsz);
+
+/* looks for a resource in pack p. returns its entry number, or -1 if the
+ * pack does not hold it. */
+long pack_find(const struct pack *p, const char *host, unsigned short port, const char *selector);
+
+/* returns the length of the resource held by entry of pack p, or -1 on
+ * error */
+long pack_len(struct pack *p, long entry);
+
+/* reads entry of pack p into buff (up to buffsz bytes), or writes all of it
+ * to out if out is not NULL (buff serves as a scratch buffer then). returns
+ * the amount of bytes of the resource, or -1 on error. */
+long pack_read(struct pack *p, long entry, char *buff, long buffsz, FILE *out);
+
+/* builds pack file packfile out of the mirror found in directory mirrordir.
+ * returns the amount of resources stored in the pack, or -1 on error (*err
+ * telling why). */
+long pack_build(const char *mirrordir, const char *packfile, const char **err);
+
+#endif
@@ -0,0 +1,324 @@
+/*
+ * This file is part of the Gopherus project.
+ * Copyright (C) 2013-2022 Mateusz Viste
+ *
+ * Entries live in a hash table (for lookups) and in a doubly-linked list
+ * ordered from most to least recently used (for eviction).
+ */
+
+#include <ctype.h>   /* tolower() */
+#include <stdlib.h>  /* malloc(), free() */
+#include <string.h>  /* strcmp(), strlen() */
+
+#include "config.h"
+#include "lz.h"
+#include "parseurl.h"
+
+#include "pagecache.h" /* include self for control */
+
+#define PAGECACHE_BUCKETS 256
+
+struct pagecache_t {
+  struct pagecache_t *hnext;  /* next entry in the same bucket */
+  struct pagecache_t *newer;  /* LRU list neighbours */
+  struct pagecache_t *older;
+  signed char *data;
+  long len;                   /* length of the page */
+  long packlen;               /* length of data if compressed, 0 if not */
+  void *index;                /* see pagecache_setindex() */
+  long indexlen;
+  unsigned int hash;
+  unsigned char internal;     /* internal page of Gopherus (always rebuilt) */
+  unsigned char unseen;       /* put aside, not displayed yet */
+  char url[1];                /* canonical url of the page */
+};
+
+static struct pagecache_t *pagecache_bucket[PAGECACHE_BUCKETS];
+static struct pagecache_t *pagecache_newest;
+static struct pagecache_t *pagecache_oldest;
+static struct pagecache_t *pagecache_cur;   /* the page on screen */
+static unsigned long pagecache_total;       /* memory used by pages */
+
+
+/* FNV-1a */
+static unsigned int pagecache_hash(const char *s) {
+  unsigned long h = 2166136261ul;
+  for (; *s != 0; s++) {
+    h ^= (unsigned char)*s;
+    h *= 16777619ul;
+  }
+  return((unsigned int)(h & (PAGECACHE_BUCKETS - 1)));
+}
+
+
+/* returns the canonical url of a location (host being lowercased), in a
+ * freshly allocated string. returns NULL if memory is short. */
+static char *pagecache_url(unsigned char protocol, const char *host, unsigned short port, char itemtype, const char *selector) {
+  size_t hostlen = strlen(host), urlsz = hostlen + strlen(selector) * 3 + 32; /* unsafe chars of the selector are %-encoded */
+  char *url, *lhost;
+  size_t i;
+  url = malloc(urlsz + hostlen + 1);
+  if (url == NULL) return(NULL);
+  lhost = url + urlsz;
+  for (i = 0; i <= hostlen; i++) lhost[i] = tolower((unsigned char)host[i]);
+  if (buildgopherurl(url, urlsz, protocol, lhost, port, itemtype, selector) < 0) {
+    free(url);
+    return(NULL);
+  }
+  return(url);
+}
+
+
+/* memory used by page e */
+static long pagecache_size(const struct pagecache_t *e) {
+  return(((e->packlen > 0) ? e->packlen : e->len) + e->indexlen);
+}
+
+
+static struct pagecache_t *pagecache_find(const char *url) {
+  struct pagecache_t *e;
+  for (e = pagecache_bucket[pagecache_hash(url)]; e != NULL; e = e->hnext) {
+    if (strcmp(url, e->url) == 0) break;
+  }
+  return(e);
+}
+
+
+/* unlinks entry e from the table and from the LRU list, then frees it */
+static void pagecache_remove(struct pagecache_t *e) {
+  struct pagecache_t **p;
+  for (p = &(pagecache_bucket[e->hash]); *p != e; p = &((*p)->hnext));
+  *p = e->hnext;
+  if (e->newer != NULL) {
+    e->newer->older = e->older;
+  } else {
+    pagecache_newest = e->older;
+  }
+  if (e->older != NULL) {
+    e->older->newer = e->newer;
+  } else {
+    pagecache_oldest = e->newer;
+  }
+  if (e == pagecache_cur) pagecache_cur = NULL;
+  pagecache_total -= pagecache_size(e);
+  free(e->data);
+  free(e->index);
+  free(e);
+}
+
+
+/* puts entry e at the head of the LRU list (e must not be on it) */
+static void pagecache_pushnewest(struct pagecache_t *e) {
+  e->older = pagecache_newest;
+  e->newer = NULL;
+  if (pagecache_newest != NULL) pagecache_newest->newer = e;
+  pagecache_newest = e;
+  if (pagecache_oldest == NULL) pagecache_oldest = e;
+}
+
+
+/* compresses the page of e, unless it is compressed already or does not
+ * get any smaller */
+static void pagecache_pack(struct pagecache_t *e) {
+  signed char *packed, *shrunk;
+  long packlen;
+  if ((e->packlen > 0) || (e->len < 16)) return; /* tiny pages are not worth it */
+  packed = malloc(e->len);
+  if (packed == NULL) return;
+  packlen = lz_compress(e->data, e->len, packed, e->len - 1);
+  if (packlen <= 0) {
+    free(packed);
+    return;
+  }
+  shrunk = realloc(packed, packlen);
+  if (shrunk != NULL) packed = shrunk;
+  free(e->data);
+  e->data = packed;
+  pagecache_total -= e->len - packlen;
+  e->packlen = packlen;
+}
+
+
+/* expands the page of e if it is compressed. returns 0 on success */
+static int pagecache_unpack(struct pagecache_t *e) {
+  signed char *page;
+  if (e->packlen == 0) return(0);
+  page = malloc(e->len);
+  if (page == NULL) return(-1);
+  if (lz_expand(e->data, e->packlen, page, e->len) != 0) {
+    free(page);
+    return(-1);
+  }
+  free(e->data);
+  e->data = page;
+  pagecache_total += e->len - e->packlen;
+  e->packlen = 0;
+  return(0);
+}
+
+
+/* evicts least recently used pages, but the one on screen, until the cache
+ * fits its size */
+static void pagecache_trim(void) {
+  struct pagecache_t *e = pagecache_oldest;
+  while ((pagecache_total > MAXALLOWEDCACHE) && (e != NULL)) {
+    struct pagecache_t *newer = e->newer;
+    if (e != pagecache_cur) pagecache_remove(e);
+    e = newer;
+  }
+}
+
+
+/* makes e the page on screen: the previous one is compressed (or dropped
+ * if it is an internal page), then least recently used pages are evicted
+ * until the cache fits its size. returns 0 on success, non-zero if e could
+ * not be expanded (it is dropped then). */
+static int pagecache_setcur(struct pagecache_t *e) {
+  if ((pagecache_cur != NULL) && (pagecache_cur != e)) {
+    if (pagecache_cur->internal) {
+      pagecache_remove(pagecache_cur);
+    } else {
+      pagecache_pack(pagecache_cur);
+    }
+  }
+  pagecache_cur = e;
+  if (pagecache_unpack(e) != 0) {
+    pagecache_remove(e);
+    return(-1);
+  }
+  /* move it to the head of the LRU list */
+  if (e != pagecache_newest) {
+    e->newer->older = e->older;
+    if (e->older != NULL) {
+      e->older->newer = e->newer;
+    } else {
+      pagecache_oldest = e->newer;
+    }
+    pagecache_pushnewest(e);
+  }
+  pagecache_trim();
+  return(0);
+}
+
+
+signed char *pagecache_get(unsigned char protocol, const char *host, unsigned short port, char itemtype, const char *selector, long *len) {
+  struct pagecache_t *e;
+  char *url = pagecache_url(protocol, host, port, itemtype, selector);
+  if (url == NULL) return(NULL);
+  e = pagecache_find(url);
+  free(url);
+  if ((e == NULL) || (pagecache_setcur(e) != 0)) return(NULL);
+  *len = e->len;
+  return(e->data);
+}
+
+
+/* adds an entry for page data at url (taking both over), as the most
+ * recently used one. returns NULL if memory is short (url and data are
+ * freed then). */
+static struct pagecache_t *pagecache_add(char *url, signed char *data, long len, unsigned char internal) {
+  struct pagecache_t *e = malloc(sizeof(struct pagecache_t) + strlen(url));
+  if (e == NULL) {
+    free(url);
+    free(data);
+    return(NULL);
+  }
+  strcpy(e->url, url);
+  free(url);
+  e->data = data;
+  e->len = len;
+  e->packlen = 0;
+  e->index = NULL;
+  e->indexlen = 0;
+  e->internal = internal;
+  e->unseen = 0;
+  e->hash = pagecache_hash(e->url);
+  e->hnext = pagecache_bucket[e->hash];
+  pagecache_bucket[e->hash] = e;
+  pagecache_pushnewest(e);
+  pagecache_total += len;
+  return(e);
+}
+
+
+int pagecache_put(unsigned char protocol, const char *host, unsigned short port, char itemtype, const char *selector, signed char *data, long len) {
+  struct pagecache_t *e;
+  char *url = pagecache_url(protocol, host, port, itemtype, selector);
+  if (url == NULL) {
+    free(data);
+    return(-1);
+  }
+  e = pagecache_find(url);
+  if (e != NULL) pagecache_remove(e);
+  e = pagecache_add(url, data, len, (host[0] == '#'));
+  if (e == NULL) return(-1);
+  return(pagecache_setcur(e));
+}
+
+
+int pagecache_putaside(unsigned char protocol, const char *host, unsigned short port, char itemtype, const char *selector, signed char *data, long len) {
+  struct pagecache_t *e;
+  char *url = pagecache_url(protocol, host, port, itemtype, selector);
+  if ((url == NULL) || (pagecache_find(url) != NULL)) { /* a cached copy wins */
+    free(url);
+    free(data);
+    return(-1);
+  }
+  e = pagecache_add(url, data, len, (host[0] == '#'));
+  if (e == NULL) return(-1);
+  e->unseen = 1;
+  pagecache_pack(e);
+  pagecache_trim();
+  return(0);
+}
+
+
+int pagecache_has(unsigned char protocol, const char *host, unsigned short port, char itemtype, const char *selector) {
+  struct pagecache_t *e;
+  char *url = pagecache_url(protocol, host, port, itemtype, selector);
+  if (url == NULL) return(0);
+  e = pagecache_find(url);
+  free(url);
+  return(e != NULL);
+}
+
+
+int pagecache_setindex(const signed char *page, void *index, long len) {
+  struct pagecache_t *e = pagecache_cur;
+  if ((e == NULL) || (page == NULL) || (e->data != page)) return(-1);
+  free(e->index);
+  pagecache_total -= e->indexlen;
+  e->index = index;
+  e->indexlen = len;
+  pagecache_total += len;
+  pagecache_trim();
+  return(0);
+}
+
+
+void *pagecache_getindex(const signed char *page) {
+  if ((pagecache_cur == NULL) || (page == NULL) || (pagecache_cur->data != page)) return(NULL);
+  return(pagecache_cur->index);
+}
+
+
+int pagecache_firstview(const signed char *page) {
+  if ((pagecache_cur == NULL) || (page == NULL) || (pagecache_cur->data != page) || (pagecache_cur->unseen == 0)) return(0);
+  pagecache_cur->unseen = 0;
+  return(1);
+}
+
+
+void pagecache_drop(unsigned char protocol, const char *host, unsigned short port, char itemtype, const char *selector) {
+  struct pagecache_t *e;
+  char *url = pagecache_url(protocol, host, port, itemtype, selector);
+  if (url == NULL) return;
+  e = pagecache_find(url);
+  free(url);
+  if (e != NULL) pagecache_remove(e);
+}
+
+
+void pagecache_clear(void) {
+  while (pagecache_newest != NULL) pagecache_remove(pagecache_newest);
+}
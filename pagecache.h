@@ -0,0 +1,54 @@
+/*
+ * This file is part of the Gopherus project.
+ * Copyright (C) 2013-2022 Mateusz Viste
+ *
+ * Memory cache of pages, keyed by their canonical url and shared by all the
+ * history: a page is served from it no matter how it is reached again. Only
+ * the page on screen is kept as is, other ones are kept compressed, and the
+ * least recently used pages are dropped once the cache outgrows
+ * MAXALLOWEDCACHE (compressed) bytes.
+ */
+
+#ifndef pagecache_h_sentinel
+#define pagecache_h_sentinel
+
+/* returns the page cached for the given location (and sets *len to its
+ * length), or NULL if it is not cached. the page becomes the one on screen,
+ * the pointer is valid until the next call to any pagecache function. */
+signed char *pagecache_get(unsigned char protocol, const char *host, unsigned short port, char itemtype, const char *selector, long *len);
+
+/* hands len bytes of page data (allocated with malloc) over to the cache,
+ * replacing any earlier copy of the same location. the page becomes the one
+ * on screen. returns 0 on success, non-zero if memory is short (data is
+ * freed then). */
+int pagecache_put(unsigned char protocol, const char *host, unsigned short port, char itemtype, const char *selector, signed char *data, long len);
+
+/* same as pagecache_put(), but for a page that is not displayed yet (a
+ * prefetched one): the page on screen stays the same, and a copy cached
+ * already is kept instead. returns 0 on success, non-zero otherwise (data
+ * is freed then). */
+int pagecache_putaside(unsigned char protocol, const char *host, unsigned short port, char itemtype, const char *selector, signed char *data, long len);
+
+/* returns non-zero if a page is cached for the given location */
+int pagecache_has(unsigned char protocol, const char *host, unsigned short port, char itemtype, const char *selector);
+
+/* attaches index (len bytes allocated with malloc, typically a parsed form
+ * of the page) to page, that must be the page on screen. the index is kept
+ * along with the page, replacing any earlier one. returns 0 on success,
+ * non-zero if page is not the page on screen (index is not taken then). */
+int pagecache_setindex(const signed char *page, void *index, long len);
+
+/* returns the index attached to page (the page on screen), or NULL */
+void *pagecache_getindex(const signed char *page);
+
+/* returns non-zero if page (the page on screen) has been put aside by
+ * pagecache_putaside() and is displayed for the first time now */
+int pagecache_firstview(const signed char *page);
+
+/* forgets the page cached for the given location, if any */
+void pagecache_drop(unsigned char protocol, const char *host, unsigned short port, char itemtype, const char *selector);
+
+/* forgets all cached pages, freeing memory */
+void pagecache_clear(void);
+
+#endif
@@ -3,8 +3,9 @@
  * Copyright (C) 2013-2022 Mateusz Viste
  */
 
+#include <ctype.h>    /* tolower() */
 #include <stdio.h>    /* snprintf() */
-#include <string.h>   /* strstr() */
+#include <string.h>   /* strstr(), strspn(), strcspn() */
 #include <strings.h>  /* strcasecmp() */
 #include <stdlib.h>   /* atoi() */
 #include "parseurl.h" /* include self for control */
@@ -32,6 +33,8 @@ unsigned char parsegopherurl(char *url, char *host, unsigned short hostlen, unsi
           url += x + 3;
           if (strcasecmp(protostr, "gopher") == 0) {
               protocol = PARSEURL_PROTO_GOPHER;
+            } else if (strcasecmp(protostr, "gophers") == 0) {
+              protocol = PARSEURL_PROTO_GOPHERS;
             } else if (strcasecmp(protostr, "http") == 0) {
               protocol = PARSEURL_PROTO_HTTP;
               *port = 80; /* default port is 80 for HTTP */
@@ -84,7 +87,7 @@ unsigned char parsegopherurl(char *url, char *host, unsigned short hostlen, unsi
         }
         break;
       case 2:  /* reading itemtype */
-        if (protocol == PARSEURL_PROTO_GOPHER) { /* if non-Gopher, skip the itemtype */
+        if ((protocol == PARSEURL_PROTO_GOPHER) || (protocol == PARSEURL_PROTO_GOPHERS)) { /* if non-Gopher, skip the itemtype */
           if (*url != 0) {
               *itemtype = *url;
               parserstate = 3;
@@ -141,7 +144,7 @@ int buildgopherurl(char *res, int maxlen, int protocol, const char *host, unsign
     return(x);
   }
   /* this is a classic gopher location */
-  x = snprintf(res, maxlen, "gopher://%s", host);
+  x = snprintf(res, maxlen, "%s://%s", (protocol == PARSEURL_PROTO_GOPHERS) ? "gophers" : "gopher", host);
   /* if empty host, return only the gopher:// string */
   if (host[0] == 0) return(x);
   /* build the url string */
@@ -165,3 +168,18 @@ int buildgopherurl(char *res, int maxlen, int protocol, const char *host, unsign
   res[x] = 0;
   return(x);
 }
+
+
+void buildurlkey(char *key, const char *host, unsigned short port, const char *selector) {
+  int i;
+  for (i = 0; host[i] != 0; i++) key[i] = tolower((unsigned char)host[i]);
+  i += sprintf(key + i, ":%u", port);
+  for (selector += strspn(selector, "/\\"); *selector != 0; selector += strspn(selector, "/\\")) {
+    size_t complen = strcspn(selector, "/\\");
+    key[i++] = '/';
+    memcpy(key + i, selector, complen);
+    i += complen;
+    selector += complen;
+  }
+  key[i] = 0;
+}
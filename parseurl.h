@@ -9,6 +9,7 @@
   #define PARSEURL_PROTO_GOPHER 1
   #define PARSEURL_PROTO_HTTP 2
   #define PARSEURL_PROTO_TELNET 3
+  #define PARSEURL_PROTO_GOPHERS 4 /* gopher over TLS */
   #define PARSEURL_ERROR 0xff
 
   /* explodes a URL into parts, and return the protocol id, or a negative value on error */
@@ -17,4 +18,11 @@
   /* builds a URL from exploded parts */
   int buildgopherurl(char *res, int maxlen, int protocol, const char *host, unsigned short port, char itemtype, const char *selector);
 
+  /* computes the key identifying a resource ("host:port/selector") into key,
+   * which must have room for MAXHOSTLEN + MAXSELLEN + 8 bytes. the protocol
+   * and item type are left out: they do not change what the server sends
+   * back. neither do the case of host nor empty components of the selector:
+   * "", "/" and "//" are one resource, so are "/a//b" and "a/b". */
+  void buildurlkey(char *key, const char *host, unsigned short port, const char *selector);
+
 #endif
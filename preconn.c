@@ -0,0 +1,256 @@
+/*
+ * This file is part of the Gopherus project.
+ * Copyright (C) 2013-2022 Mateusz Viste
+ */
+
+#include <string.h>  /* strcpy(), strlen() */
+#include <strings.h> /* strcasecmp() */
+
+#include "config.h"
+#include "dnscache.h"
+#include "net/net.h"
+#include "resolver.h"
+#include "timer.h"
+#include "xfer.h"    /* XFER_RESOLVEPOLL */
+
+#include "preconn.h" /* include self for control */
+
+struct preconn_t {
+  struct net_tcpsocket *sock; /* NULL if the slot is free */
+  unsigned long lastuse;      /* timer_ms() of the last selection of the server */
+  unsigned short port;
+  unsigned char connected;
+  char ipaddr[NET_ADDRSTRLEN];
+  char host[MAXHOSTLEN];
+};
+
+static struct preconn_t preconn_slot[PRECONN_MAXSOCKS];
+static struct net_pollset *preconn_ps;
+static unsigned int preconn_maxsocks = PRECONN_SOCKS;
+static unsigned long preconn_idle = PRECONN_IDLE * 1000ul;
+
+/* the server currently selected */
+static struct {
+  struct resolver_query *resq; /* resolution of its name, if not cached */
+  unsigned long since;  /* timer_ms() of the selection */
+  unsigned short port;
+  unsigned char set;    /* something is selected */
+  unsigned char tried;  /* connection started already (or impossible) */
+  char host[MAXHOSTLEN];
+} preconn_sel;
+
+
+/* returns the slot used by host:port, or -1 if none */
+static int preconn_find(const char *host, unsigned short port) {
+  int i;
+  for (i = 0; i < PRECONN_MAXSOCKS; i++) {
+    if (preconn_slot[i].sock == NULL) continue;
+    if ((preconn_slot[i].port == port) && (strcasecmp(preconn_slot[i].host, host) == 0)) return(i);
+  }
+  return(-1);
+}
+
+
+static void preconn_drop(struct preconn_t *p) {
+  if (p->sock == NULL) return;
+  net_pollset_del(preconn_ps, p->sock);
+  net_abort(&(p->sock));
+}
+
+
+/* starts connecting to the selected server at ipaddr, in a free slot or in
+ * place of the least recently selected server */
+static void preconn_open(const char *ipaddr) {
+  struct preconn_t *p = NULL;
+  unsigned int i;
+  for (i = 0; i < preconn_maxsocks; i++) {
+    if (preconn_slot[i].sock == NULL) {
+      p = &(preconn_slot[i]);
+      break;
+    }
+    if ((p == NULL) || (preconn_slot[i].lastuse < p->lastuse)) p = &(preconn_slot[i]);
+  }
+  preconn_drop(p);
+  /* Fast Open would defer the handshake until data is sent, which defeats
+   * the whole purpose */
+  p->sock = net_connect(ipaddr, preconn_sel.port, ~NET_TUNE_FASTOPEN);
+  if (p->sock == NULL) return;
+  if (net_pollset_add(preconn_ps, p->sock, NET_EV_WRITE, p) != 0) {
+    net_abort(&(p->sock));
+    return;
+  }
+  strcpy(p->host, preconn_sel.host);
+  strcpy(p->ipaddr, ipaddr);
+  p->port = preconn_sel.port;
+  p->connected = 0;
+  p->lastuse = timer_ms();
+}
+
+
+/* resolves the name of the selected server and starts connecting to it.
+ * returns non-zero while the resolver is still at work. */
+static int preconn_start(void) {
+  char addr[DNS_MAXADDR][NET_ADDRSTRLEN];
+  int n = 0;
+  if (preconn_sel.resq == NULL) {
+    n = dnscache_ask(addr, DNS_MAXADDR, preconn_sel.host);
+    if (n == 0) {
+      preconn_sel.resq = resolver_start(preconn_sel.host);
+      if (preconn_sel.resq == NULL) n = -1;
+    }
+  }
+  if (preconn_sel.resq != NULL) {
+    n = resolver_result(preconn_sel.resq, addr, DNS_MAXADDR);
+    if (n == 0) return(1); /* still in progress */
+    resolver_free(preconn_sel.resq);
+    preconn_sel.resq = NULL;
+    if (n == NET_DNS_NOHOST) dnscache_add(preconn_sel.host, NULL, 0); /* negative entry */
+    if (n > 0) dnscache_add(preconn_sel.host, addr, n);
+  }
+  preconn_sel.tried = 1;
+  if (n > 0) preconn_open(addr[0]);
+  return(0);
+}
+
+
+void preconn_setlimits(unsigned int maxsocks, long idle) {
+  preconn_flush();
+  if (maxsocks > PRECONN_MAXSOCKS) maxsocks = PRECONN_MAXSOCKS;
+  preconn_maxsocks = maxsocks;
+  preconn_idle = idle * 1000ul;
+}
+
+
+void preconn_select(const char *host, unsigned short port) {
+  int i;
+  if ((host != NULL) && preconn_sel.set && (port == preconn_sel.port) && (strcasecmp(host, preconn_sel.host) == 0)) return; /* no change */
+  resolver_free(preconn_sel.resq);
+  preconn_sel.resq = NULL;
+  preconn_sel.set = 0;
+  if ((host == NULL) || (preconn_maxsocks == 0) || (strlen(host) >= sizeof(preconn_sel.host))) return;
+  strcpy(preconn_sel.host, host);
+  preconn_sel.port = port;
+  preconn_sel.since = timer_ms();
+  preconn_sel.tried = 0;
+  preconn_sel.set = 1;
+  /* connected to this server already: it is of use again, keep it longer */
+  i = preconn_find(host, port);
+  if (i >= 0) {
+    preconn_slot[i].lastuse = preconn_sel.since;
+    preconn_sel.tried = 1;
+  }
+}
+
+
+int preconn_step(long timeout) {
+  struct net_pollevent ev[PRECONN_MAXSOCKS];
+  unsigned long now;
+  int i, evcount, busy = 0;
+
+  if (preconn_maxsocks == 0) return(0);
+  if (preconn_ps == NULL) {
+    preconn_ps = net_pollset_new();
+    if (preconn_ps == NULL) {
+      preconn_sel.tried = 1; /* out of memory, do not insist */
+      return(0);
+    }
+  }
+
+  /* the selection must rest for a moment first */
+  if (preconn_sel.set && (preconn_sel.tried == 0)) {
+    unsigned long elapsed = timer_ms() - preconn_sel.since;
+    if (elapsed < PRECONN_DELAY) {
+      if (timeout > (long)(PRECONN_DELAY - elapsed)) timeout = PRECONN_DELAY - elapsed;
+      busy = 1;
+    } else if (preconn_start() != 0) { /* the resolver is not a socket, it has to be polled */
+      if (timeout > XFER_RESOLVEPOLL) timeout = XFER_RESOLVEPOLL;
+      busy = 1;
+    }
+  }
+
+  /* connections established or failed, idle ones closed by the server */
+  evcount = net_pollset_wait(preconn_ps, ev, PRECONN_MAXSOCKS, timeout);
+  for (i = 0; i < evcount; i++) {
+    struct preconn_t *p = ev[i].userdata;
+    if ((p->connected == 0) && ((ev[i].events & NET_EV_ERR) == 0) && (net_isconnected(p->sock, 0) > 0)) {
+      p->connected = 1;
+      net_pollset_mod(preconn_ps, p->sock, NET_EV_READ);
+      continue;
+    }
+    /* connection failed, or the server closed it while it was idle */
+    preconn_drop(p);
+  }
+
+  /* close those that remained unused for too long */
+  now = timer_ms();
+  for (i = 0; i < PRECONN_MAXSOCKS; i++) {
+    if (preconn_slot[i].sock == NULL) continue;
+    if (now - preconn_slot[i].lastuse > preconn_idle) {
+      preconn_drop(&(preconn_slot[i]));
+    } else {
+      busy = 1;
+    }
+  }
+  return(busy);
+}
+
+
+long preconn_timeout(void) {
+  unsigned long now = timer_ms();
+  long t = -1;
+  int i;
+
+  if (preconn_maxsocks == 0) return(-1);
+  if (preconn_sel.set && (preconn_sel.tried == 0)) {
+    if (preconn_sel.resq != NULL) {
+      t = XFER_RESOLVEPOLL;
+    } else if (now - preconn_sel.since < PRECONN_DELAY) {
+      t = PRECONN_DELAY - (now - preconn_sel.since);
+    } else {
+      return(0);
+    }
+  }
+  /* expiry of idle connections */
+  for (i = 0; i < PRECONN_MAXSOCKS; i++) {
+    long left;
+    if (preconn_slot[i].sock == NULL) continue;
+    left = 1;
+    if (now - preconn_slot[i].lastuse <= preconn_idle) left += preconn_idle - (now - preconn_slot[i].lastuse);
+    if ((t < 0) || (left < t)) t = left;
+  }
+  return(t);
+}
+
+
+struct net_pollset *preconn_pollset(void) {
+  return(preconn_ps);
+}
+
+
+struct net_tcpsocket *preconn_take(const char *host, unsigned short port, char *ipaddr) {
+  struct net_tcpsocket *s;
+  int i = preconn_find(host, port);
+  if ((i < 0) || (preconn_slot[i].connected == 0)) return(NULL);
+  s = preconn_slot[i].sock;
+  net_pollset_del(preconn_ps, s);
+  preconn_slot[i].sock = NULL;
+  strcpy(ipaddr, preconn_slot[i].ipaddr);
+  /* the server will be connected to again if selected once more */
+  if (preconn_sel.set && (port == preconn_sel.port) && (strcasecmp(host, preconn_sel.host) == 0)) {
+    resolver_free(preconn_sel.resq);
+    preconn_sel.resq = NULL;
+    preconn_sel.set = 0;
+  }
+  return(s);
+}
+
+
+void preconn_flush(void) {
+  int i;
+  for (i = 0; i < PRECONN_MAXSOCKS; i++) preconn_drop(&(preconn_slot[i]));
+  resolver_free(preconn_sel.resq);
+  preconn_sel.resq = NULL;
+  preconn_sel.set = 0;
+  net_pollset_free(preconn_ps);
+  preconn_ps = NULL;
+}
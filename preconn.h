@@ -0,0 +1,52 @@
+/*
+ * This file is part of the Gopherus project.
+ * Copyright (C) 2013-2022 Mateusz Viste
+ *
+ * Speculative connections to the server of the menu item the user is
+ * looking at. Gopher servers close the connection after every answer, so
+ * following a link always costs a TCP handshake: a connection opened while
+ * the user reads the menu takes it off the way. Only a few such connections
+ * are kept open (the least recently selected server loses its own first),
+ * and those that remain unused for too long are closed.
+ */
+
+#ifndef preconn_h_sentinel
+#define preconn_h_sentinel
+
+#include "net/net.h"
+
+/* how long (ms) the selection must rest on an item before its server is
+ * connected to */
+#define PRECONN_DELAY 150
+
+/* sets the max amount of speculative connections (0 disables them) and
+ * how long (seconds) an unused one is kept open */
+void preconn_setlimits(unsigned int maxsocks, long idle);
+
+/* tells which server the selected item lives on (host may be NULL if
+ * none) */
+void preconn_select(const char *host, unsigned short port);
+
+/* makes the pending connections progress, waiting at most timeout ms for
+ * network activity. returns non-zero as long as there is something left to
+ * do (connecting, or watching idle connections for expiry). */
+int preconn_step(long timeout);
+
+/* returns how long (ms) the pre-connector may be left alone, unless its
+ * sockets get ready, before preconn_step() must be called again. -1 means
+ * there is nothing to do. */
+long preconn_timeout(void);
+
+/* returns the set the speculative connections are registered in (NULL if
+ * there is none yet) */
+struct net_pollset *preconn_pollset(void);
+
+/* if a connection to host:port is established and unused, hands it over
+ * (the caller owns it from then on) and writes the address it connects to
+ * into ipaddr. returns NULL otherwise. */
+struct net_tcpsocket *preconn_take(const char *host, unsigned short port, char *ipaddr);
+
+/* closes all speculative connections */
+void preconn_flush(void);
+
+#endif
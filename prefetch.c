@@ -0,0 +1,174 @@
+/*
+ * This file is part of the Gopherus project.
+ * Copyright (C) 2013-2022 Mateusz Viste
+ */
+
+#include <stdlib.h>  /* malloc(), free() */
+#include <string.h>  /* strcpy(), strlen(), memcpy() */
+#include <strings.h> /* strcasecmp() */
+
+#include "config.h"
+#include "net/net.h"
+#include "pagecache.h"
+#include "preconn.h"
+#include "timer.h"
+#include "xfer.h"
+
+#include "prefetch.h" /* include self for control */
+
+/* the item currently selected */
+static struct {
+  unsigned long since;  /* timer_ms() of the selection */
+  unsigned short port;
+  unsigned char protocol;
+  char itemtype;
+  unsigned char set;    /* something is selected */
+  unsigned char tried;  /* prefetch has been started already */
+  char host[MAXHOSTLEN];
+  char selector[MAXSELLEN];
+} prefetch_sel;
+
+static struct xfer *prefetch_x;        /* prefetch in progress */
+static struct net_pollset *prefetch_ps;
+static char *prefetch_buff;            /* receive buffer of prefetch_x */
+static long prefetch_maxbytes = PREFETCH_BYTES;
+static unsigned int prefetch_maxconns = PREFETCH_CONNS;
+static unsigned int prefetch_conns;    /* connections opened for the current menu */
+
+
+static int prefetch_issel(unsigned char protocol, const char *host, unsigned short port, const char *selector) {
+  if (prefetch_sel.set == 0) return(0);
+  if ((protocol != prefetch_sel.protocol) || (port != prefetch_sel.port)) return(0);
+  if (strcasecmp(host, prefetch_sel.host) != 0) return(0);
+  return(strcmp(selector, prefetch_sel.selector) == 0);
+}
+
+
+/* hands the resource that has just been prefetched over to the page cache,
+ * where it waits to be displayed */
+static void prefetch_keep(struct xfer *x) {
+  signed char *page = malloc((x->bufflen > 0) ? x->bufflen : 1);
+  if (page == NULL) return;
+  memcpy(page, x->buff, x->bufflen);
+  pagecache_putaside(prefetch_sel.protocol, prefetch_sel.host, prefetch_sel.port, prefetch_sel.itemtype, prefetch_sel.selector, page, x->bufflen);
+}
+
+
+void prefetch_setbudget(long maxbytes, unsigned int maxconns) {
+  prefetch_flush();
+  prefetch_maxbytes = maxbytes;
+  prefetch_maxconns = maxconns;
+}
+
+
+void prefetch_newmenu(void) {
+  prefetch_select(0, NULL, 0, 0, NULL);
+  prefetch_conns = 0;
+}
+
+
+void prefetch_select(unsigned char protocol, const char *host, unsigned short port, char itemtype, const char *selector) {
+  if ((host != NULL) && prefetch_issel(protocol, host, port, selector) && (itemtype == prefetch_sel.itemtype)) return; /* no change */
+  prefetch_cancel();
+  prefetch_sel.set = 0;
+  if ((host == NULL) || (strlen(host) >= sizeof(prefetch_sel.host)) || (strlen(selector) >= sizeof(prefetch_sel.selector))) return;
+  strcpy(prefetch_sel.host, host);
+  strcpy(prefetch_sel.selector, selector);
+  prefetch_sel.protocol = protocol;
+  prefetch_sel.itemtype = itemtype;
+  prefetch_sel.port = port;
+  prefetch_sel.since = timer_ms();
+  prefetch_sel.tried = 0;
+  prefetch_sel.set = 1;
+}
+
+
+int prefetch_step(long timeout) {
+  struct net_pollevent ev;
+  int evcount;
+
+  if (prefetch_x == NULL) {
+    unsigned long elapsed;
+    if ((prefetch_sel.set == 0) || (prefetch_sel.tried != 0)) return(0);
+    if ((prefetch_maxbytes <= 0) || (prefetch_conns >= prefetch_maxconns)) return(0);
+    if (pagecache_has(prefetch_sel.protocol, prefetch_sel.host, prefetch_sel.port, prefetch_sel.itemtype, prefetch_sel.selector)) {
+      prefetch_sel.tried = 1; /* got it already */
+      return(0);
+    }
+    if (prefetch_ps == NULL) prefetch_ps = net_pollset_new();
+    if (prefetch_buff == NULL) prefetch_buff = malloc(prefetch_maxbytes);
+    if ((prefetch_ps == NULL) || (prefetch_buff == NULL)) {
+      prefetch_sel.tried = 1; /* out of memory, do not insist */
+      return(0);
+    }
+    /* the selection must rest for a moment first */
+    elapsed = timer_ms() - prefetch_sel.since;
+    if (elapsed < PREFETCH_DELAY) {
+      if (timeout > (long)(PREFETCH_DELAY - elapsed)) timeout = PREFETCH_DELAY - elapsed;
+      net_pollset_wait(prefetch_ps, &ev, 1, timeout);
+      return(1);
+    }
+    prefetch_sel.tried = 1;
+    prefetch_x = xfer_new(prefetch_sel.protocol, prefetch_sel.host, prefetch_sel.port, prefetch_sel.selector, prefetch_buff, prefetch_maxbytes, NULL, prefetch_ps);
+    if (prefetch_x == NULL) return(0);
+    {
+      char ipaddr[NET_ADDRSTRLEN];
+      xfer_adoptsock(prefetch_x, preconn_take(prefetch_sel.host, prefetch_sel.port, ipaddr), ipaddr);
+    }
+    prefetch_conns++;
+  }
+
+  /* the resolver is not a socket, it has to be polled */
+  if ((prefetch_x->state == XFER_RESOLVE) && (timeout > XFER_RESOLVEPOLL)) timeout = XFER_RESOLVEPOLL;
+  evcount = net_pollset_wait(prefetch_ps, &ev, 1, timeout);
+  xfer_step(prefetch_x, (evcount > 0) ? ev.events : 0);
+
+  if ((prefetch_x->state != XFER_DONE) && (prefetch_x->state != XFER_FAIL)) return(1);
+  /* a resource that does not fit in the budget is not kept */
+  if ((prefetch_x->state == XFER_DONE) && (prefetch_x->truncated == 0)) prefetch_keep(prefetch_x);
+  prefetch_cancel();
+  return(0);
+}
+
+
+long prefetch_timeout(void) {
+  unsigned long elapsed;
+  if (prefetch_x != NULL) return(xfer_timeout(prefetch_x));
+  if ((prefetch_sel.set == 0) || (prefetch_sel.tried != 0)) return(-1);
+  if ((prefetch_maxbytes <= 0) || (prefetch_conns >= prefetch_maxconns)) return(-1);
+  elapsed = timer_ms() - prefetch_sel.since;
+  if (elapsed >= PREFETCH_DELAY) return(0);
+  return(PREFETCH_DELAY - elapsed);
+}
+
+
+struct net_pollset *prefetch_pollset(void) {
+  return(prefetch_ps);
+}
+
+
+void prefetch_cancel(void) {
+  xfer_free(prefetch_x);
+  prefetch_x = NULL;
+}
+
+
+struct xfer *prefetch_adopt(unsigned char protocol, const char *host, unsigned short port, const char *selector, char *buff, long buffsz, struct net_pollset *ps) {
+  struct xfer *x = prefetch_x;
+  if ((x != NULL) && prefetch_issel(protocol, host, port, selector) && (xfer_rehome(x, buff, buffsz, ps) == 0)) {
+    prefetch_x = NULL;
+    return(x);
+  }
+  prefetch_cancel();
+  return(NULL);
+}
+
+
+void prefetch_flush(void) {
+  prefetch_cancel();
+  free(prefetch_buff);
+  prefetch_buff = NULL;
+  net_pollset_free(prefetch_ps);
+  prefetch_ps = NULL;
+  prefetch_sel.set = 0;
+}
@@ -0,0 +1,59 @@
+/*
+ * This file is part of the Gopherus project.
+ * Copyright (C) 2013-2022 Mateusz Viste
+ *
+ * Speculative prefetching of the menu item the user is looking at. The item
+ * is fetched in the background once the selection rested for PREFETCH_DELAY
+ * ms, so following the link afterwards does not have to wait for the
+ * network. Prefetched resources are kept in the page cache, until displayed
+ * or evicted. Prefetching works within a budget: a max size of a single
+ * resource and a max amount of connections opened while browsing a single
+ * menu.
+ */
+
+#ifndef prefetch_h_sentinel
+#define prefetch_h_sentinel
+
+#include "net/net.h"
+#include "xfer.h"
+
+/* how long (ms) the selection must rest on an item before it is prefetched */
+#define PREFETCH_DELAY 300
+
+/* sets the budget of the prefetcher. a maxbytes or maxconns of 0 disables
+ * prefetching altogether. */
+void prefetch_setbudget(long maxbytes, unsigned int maxconns);
+
+/* tells that a menu is being (re)entered: nothing is selected yet, and the
+ * connection budget is renewed */
+void prefetch_newmenu(void);
+
+/* tells the prefetcher which item is selected now (host may be NULL if
+ * none). a prefetch of anything else is cancelled right away. */
+void prefetch_select(unsigned char protocol, const char *host, unsigned short port, char itemtype, const char *selector);
+
+/* makes the prefetcher progress, waiting at most timeout ms for network
+ * activity. returns non-zero as long as there is something left to do. */
+int prefetch_step(long timeout);
+
+/* returns how long (ms) the prefetcher may be left alone, unless its
+ * sockets get ready, before prefetch_step() must be called again. -1 means
+ * there is nothing to do. */
+long prefetch_timeout(void);
+
+/* returns the set the sockets of the prefetcher are registered in (NULL if
+ * there is none yet), so they can be waited on along with other things */
+struct net_pollset *prefetch_pollset(void);
+
+/* cancels the prefetch in progress, if any */
+void prefetch_cancel(void);
+
+/* if the resource is being prefetched right now, hands over its transfer,
+ * moved to buff and ps (see xfer_rehome). returns NULL otherwise, after
+ * having cancelled whatever other prefetch was in progress. */
+struct xfer *prefetch_adopt(unsigned char protocol, const char *host, unsigned short port, const char *selector, char *buff, long buffsz, struct net_pollset *ps);
+
+/* cancels everything and frees the memory of the prefetcher */
+void prefetch_flush(void);
+
+#endif
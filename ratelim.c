@@ -0,0 +1,96 @@
+/*
+ * This file is part of the Gopherus project.
+ * Copyright (C) 2013-2022 Mateusz Viste
+ */
+
+#include "timer.h"
+
+#include "ratelim.h" /* include self for control */
+
+/* min size (bytes) of a bucket, so a throttled transfer is still able to
+ * receive something useful once woken up */
+#define RATELIM_MINBURST 512
+
+static long ratelim_total;       /* all transfers together (bytes/s) */
+static long ratelim_pertransfer; /* every single transfer (bytes/s) */
+static struct ratelim ratelim_global;
+
+
+/* a bucket holds what can be received in a quarter of second */
+static long ratelim_burst(long rate) {
+  if (rate / 4 < RATELIM_MINBURST) return(RATELIM_MINBURST);
+  return(rate / 4);
+}
+
+
+/* adds to bucket r the tokens earned since its last refill */
+static void ratelim_refill(struct ratelim *r, long rate) {
+  unsigned long now = timer_ms();
+  unsigned long elapsed = now - r->refill;
+  long burst = ratelim_burst(rate);
+  long earned;
+  if (elapsed > 1000) elapsed = 1000; /* the bucket is full by then anyway */
+  /* rate * elapsed / 1000, without overflowing */
+  earned = (rate / 1000) * (long)elapsed + ((rate % 1000) * (long)elapsed) / 1000;
+  if (earned == 0) return; /* not a single byte yet, keep counting */
+  r->refill = now;
+  r->tokens += earned;
+  if (r->tokens > burst) r->tokens = burst;
+}
+
+
+void ratelim_set(long total, long pertransfer) {
+  ratelim_total = total;
+  ratelim_pertransfer = pertransfer;
+  ratelim_init(&ratelim_global);
+  ratelim_global.tokens = ratelim_burst(total);
+}
+
+
+void ratelim_init(struct ratelim *r) {
+  r->tokens = ratelim_burst(ratelim_pertransfer);
+  r->refill = timer_ms();
+}
+
+
+long ratelim_allow(struct ratelim *r, long want) {
+  if (ratelim_pertransfer > 0) {
+    ratelim_refill(r, ratelim_pertransfer);
+    if (want > r->tokens) want = r->tokens;
+  }
+  if (ratelim_total > 0) {
+    ratelim_refill(&ratelim_global, ratelim_total);
+    if (want > ratelim_global.tokens) want = ratelim_global.tokens;
+  }
+  if (want < 0) want = 0;
+  return(want);
+}
+
+
+void ratelim_take(struct ratelim *r, long len) {
+  if (ratelim_pertransfer > 0) r->tokens -= len;
+  if (ratelim_total > 0) ratelim_global.tokens -= len;
+}
+
+
+/* time (ms) it takes for bucket r to earn enough tokens for a useful
+ * receive. waiting for a single token only would wake a throttled transfer
+ * up every ms or so, to receive a handful of bytes each time. */
+static long ratelim_wait(struct ratelim *r, long rate) {
+  long need = ratelim_burst(rate);
+  if (need > RATELIM_MINBURST) need = RATELIM_MINBURST;
+  ratelim_refill(r, rate);
+  if (r->tokens >= need) return(0);
+  return(((need - r->tokens) * 1000 + rate - 1) / rate);
+}
+
+
+long ratelim_delay(struct ratelim *r) {
+  long res = 0, d;
+  if (ratelim_pertransfer > 0) res = ratelim_wait(r, ratelim_pertransfer);
+  if (ratelim_total > 0) {
+    d = ratelim_wait(&ratelim_global, ratelim_total);
+    if (d > res) res = d;
+  }
+  return(res);
+}
@@ -0,0 +1,42 @@
+/*
+ * This file is part of the Gopherus project.
+ * Copyright (C) 2013-2022 Mateusz Viste
+ *
+ * Download rate limiter. Every transfer has a token bucket of its own, and
+ * all of them draw from a global bucket as well, so both the throughput of
+ * a single transfer and the total throughput can be capped. Buckets are
+ * only looked at when there is data to receive: an idle link costs nothing.
+ */
+
+#ifndef ratelim_h_sentinel
+#define ratelim_h_sentinel
+
+/* highest limit that may be configured (KiB/s) */
+#define RATELIM_MAX 1000000l
+
+/* token bucket of a single transfer */
+struct ratelim {
+  long tokens;          /* bytes that may be received right now */
+  unsigned long refill; /* timer_ms() of the last refill */
+};
+
+/* sets the max throughput (bytes/s) of all transfers together, and that of
+ * every single transfer. 0 stands for unlimited (the default). */
+void ratelim_set(long total, long pertransfer);
+
+/* prepares the bucket of a new transfer */
+void ratelim_init(struct ratelim *r);
+
+/* returns how many bytes (want at most) the transfer of bucket r is allowed
+ * to receive right now. 0 means it has to wait. */
+long ratelim_allow(struct ratelim *r, long want);
+
+/* accounts len bytes received by the transfer of bucket r */
+void ratelim_take(struct ratelim *r, long len);
+
+/* returns how long (ms) the transfer of bucket r has to wait before it may
+ * receive again (0 if it does not have to). once throttled, a transfer
+ * waits for its buckets to hold a useful amount of bytes first. */
+long ratelim_delay(struct ratelim *r);
+
+#endif
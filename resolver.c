@@ -0,0 +1,188 @@
+/*
+ * This file is part of the Gopherus project.
+ * Copyright (C) 2013-2022 Mateusz Viste
+ */
+
+#include <stdlib.h>  /* calloc(), free() */
+#include <string.h>  /* strcpy(), strlen() */
+#include <strings.h> /* strcasecmp() */
+
+#include "config.h"
+#include "net/net.h"
+
+#include "resolver.h" /* include self for control */
+
+/* worker threads are available on POSIX systems only, everything else
+ * resolves synchronously */
+#if !defined(_WIN32) && !defined(DJ64) && !defined(CSOCK) && !defined(__WATCOMC__) && !defined(__DJGPP__)
+  #define RESOLVER_THREADS
+  #include <pthread.h>
+#endif
+
+#define RESOLVER_QUEUED  0  /* waiting for a free worker */
+#define RESOLVER_RUNNING 1  /* a worker is resolving it right now */
+#define RESOLVER_DONE    2  /* result available */
+
+struct resolver_query {
+  struct resolver_query *next; /* next query on the list */
+  int state;
+  int refcount;      /* amount of callers holding the query */
+  int addrcount;     /* result: amount of addresses, negative on failure */
+  char addr[DNS_MAXADDR][NET_ADDRSTRLEN];
+  char host[1];
+};
+
+
+#ifdef RESOLVER_THREADS
+
+/* all live queries, in submission order. workers pick the oldest queued one.
+ * everything below is protected by resolver_mutex */
+static struct resolver_query *resolver_list;
+static int resolver_idle;    /* workers waiting for something to do */
+static int resolver_workers; /* workers started so far */
+static pthread_mutex_t resolver_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t resolver_cond = PTHREAD_COND_INITIALIZER;
+
+
+/* unlinks q from resolver_list and frees it */
+static void resolver_drop(struct resolver_query *q) {
+  struct resolver_query **p;
+  for (p = &resolver_list; *p != NULL; p = &((*p)->next)) {
+    if (*p != q) continue;
+    *p = q->next;
+    break;
+  }
+  free(q);
+}
+
+
+static void *resolver_worker(void *arg) {
+  struct resolver_query *q;
+  char addr[DNS_MAXADDR][NET_ADDRSTRLEN];
+  int addrcount, i;
+  (void)arg;
+
+  pthread_mutex_lock(&resolver_mutex);
+  for (;;) {
+    for (q = resolver_list; q != NULL; q = q->next) {
+      if (q->state == RESOLVER_QUEUED) break;
+    }
+    if (q == NULL) { /* nothing to do: sleep until a new query comes in */
+      resolver_idle++;
+      pthread_cond_wait(&resolver_cond, &resolver_mutex);
+      resolver_idle--;
+      continue;
+    }
+    q->state = RESOLVER_RUNNING;
+    pthread_mutex_unlock(&resolver_mutex);
+    /* the host string is not modified while the query runs, so it can be
+     * read without holding the lock */
+    addrcount = net_dnsresolve(addr, DNS_MAXADDR, q->host);
+    pthread_mutex_lock(&resolver_mutex);
+    if (q->refcount == 0) { /* nobody is interested anymore */
+      resolver_drop(q);
+      continue;
+    }
+    if (addrcount == 0) addrcount = -1;
+    for (i = 0; i < addrcount; i++) strcpy(q->addr[i], addr[i]);
+    q->addrcount = addrcount;
+    q->state = RESOLVER_DONE;
+  }
+  return(NULL);
+}
+
+
+struct resolver_query *resolver_start(const char *host) {
+  struct resolver_query *q, **last;
+
+  pthread_mutex_lock(&resolver_mutex);
+
+  /* is this host being resolved already? */
+  for (last = &resolver_list; *last != NULL; last = &((*last)->next)) {
+    if (((*last)->state != RESOLVER_DONE) && (strcasecmp((*last)->host, host) == 0)) {
+      q = *last;
+      q->refcount++;
+      pthread_mutex_unlock(&resolver_mutex);
+      return(q);
+    }
+  }
+
+  q = calloc(1, sizeof(struct resolver_query) + strlen(host));
+  if (q == NULL) {
+    pthread_mutex_unlock(&resolver_mutex);
+    return(NULL);
+  }
+  strcpy(q->host, host);
+  q->refcount = 1;
+  q->state = RESOLVER_QUEUED;
+  *last = q;
+
+  /* wake up an idle worker, or hire a new one if all are busy */
+  if (resolver_idle > 0) {
+    pthread_cond_signal(&resolver_cond);
+  } else if (resolver_workers < DNS_RESOLVERS) {
+    pthread_t t;
+    if (pthread_create(&t, NULL, resolver_worker, NULL) == 0) {
+      pthread_detach(t);
+      resolver_workers++;
+    } else if (resolver_workers == 0) { /* no worker at all: give up */
+      resolver_drop(q);
+      q = NULL;
+    }
+  }
+
+  pthread_mutex_unlock(&resolver_mutex);
+  return(q);
+}
+
+
+int resolver_result(struct resolver_query *q, char addr[][NET_ADDRSTRLEN], int maxaddr) {
+  int i, res = 0;
+  pthread_mutex_lock(&resolver_mutex);
+  if (q->state == RESOLVER_DONE) {
+    res = q->addrcount;
+    if (res > maxaddr) res = maxaddr;
+    for (i = 0; i < res; i++) strcpy(addr[i], q->addr[i]);
+  }
+  pthread_mutex_unlock(&resolver_mutex);
+  return(res);
+}
+
+
+void resolver_free(struct resolver_query *q) {
+  if (q == NULL) return;
+  pthread_mutex_lock(&resolver_mutex);
+  q->refcount--;
+  /* a running query is freed by its worker once the resolver returns */
+  if ((q->refcount == 0) && (q->state != RESOLVER_RUNNING)) resolver_drop(q);
+  pthread_mutex_unlock(&resolver_mutex);
+}
+
+#else /* no threads: resolve right away */
+
+struct resolver_query *resolver_start(const char *host) {
+  struct resolver_query *q;
+  q = calloc(1, sizeof(struct resolver_query) + strlen(host));
+  if (q == NULL) return(NULL);
+  strcpy(q->host, host);
+  q->refcount = 1;
+  q->addrcount = net_dnsresolve(q->addr, DNS_MAXADDR, host);
+  if (q->addrcount == 0) q->addrcount = -1;
+  q->state = RESOLVER_DONE;
+  return(q);
+}
+
+
+int resolver_result(struct resolver_query *q, char addr[][NET_ADDRSTRLEN], int maxaddr) {
+  int i, res = q->addrcount;
+  if (res > maxaddr) res = maxaddr;
+  for (i = 0; i < res; i++) strcpy(addr[i], q->addr[i]);
+  return(res);
+}
+
+
+void resolver_free(struct resolver_query *q) {
+  free(q);
+}
+
+#endif
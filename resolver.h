@@ -0,0 +1,31 @@
+/*
+ * This file is part of the Gopherus project.
+ * Copyright (C) 2013-2022 Mateusz Viste
+ *
+ * Asynchronous hostname resolution. Queries are handed to a pool of up to
+ * DNS_RESOLVERS worker threads, so the caller never blocks and may give up
+ * at any time. Platforms without threads resolve synchronously within
+ * resolver_start() and the API behaves the same otherwise.
+ */
+
+#ifndef resolver_h_sentinel
+#define resolver_h_sentinel
+
+#include "net/net.h" /* NET_ADDRSTRLEN */
+
+struct resolver_query;
+
+/* queues the resolution of host. concurrent queries for the same host are
+ * merged into one. returns NULL on out of memory condition. */
+struct resolver_query *resolver_start(const char *host);
+
+/* fetches the outcome of query q: returns 0 while resolution is still in
+ * progress, a negative value if it failed (NET_DNS_NOHOST if the host does
+ * not exist), or the amount of addresses written to addr (at most maxaddr) */
+int resolver_result(struct resolver_query *q, char addr[][NET_ADDRSTRLEN], int maxaddr);
+
+/* releases query q. it is fine to call this while q is still in progress,
+ * the result is then discarded as soon as the resolver returns. */
+void resolver_free(struct resolver_query *q);
+
+#endif
@@ -0,0 +1,117 @@
+/*
+ * This file is part of the Gopherus project
+ * Copyright (C) Mateusz Viste 2013-2022
+ *
+ * checks of the streaming http parser: answers are fed in pieces of every
+ * size from 1 byte up to the whole, so headers and chunk framing get split
+ * at every possible place. whatever follows an answer in the test strings
+ * reads "EXTRA", the parser must not go past it. returns non-zero if any
+ * check fails.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "http.h"
+
+static int failed;
+
+/* feeds answer to a fresh parser in pieces of step bytes and compares the
+ * outcome with what is expected. hdr/val is a header to look up (or NULL) */
+static void check(const char *name, const char *answer, int state, int status, const char *body, int keepalive, const char *hdr, const char *val) {
+  static struct http_resp h;
+  char out[4096], piece[4096];
+  long anslen = (long)strlen(answer), step, i, n, outlen;
+  long end = (strstr(answer, "EXTRA") != NULL) ? strstr(answer, "EXTRA") - answer : anslen;
+
+  for (step = 1; step <= anslen; step++) {
+    http_init(&h);
+    outlen = 0;
+    for (i = 0; (i < anslen) && (h.state != HTTP_DONE) && (h.state != HTTP_ERR); i += step) {
+      n = (anslen - i < step) ? anslen - i : step;
+      memcpy(piece, answer + i, n);
+      n = http_feed(&h, piece, n);
+      if (n < 0) break;
+      memcpy(out + outlen, piece, n);
+      outlen += n;
+    }
+    if (h.state != state) {
+      printf("FAIL: %s (by %ld): state %d instead of %d\n", name, step, h.state, state);
+    } else if (state == HTTP_ERR) {
+      continue;
+    } else if ((step == 1) && (state == HTTP_DONE) && (i != end)) {
+      printf("FAIL: %s: end of answer found at byte %ld instead of %ld\n", name, i, end);
+    } else if (h.status != status) {
+      printf("FAIL: %s (by %ld): status %d instead of %d\n", name, step, h.status, status);
+    } else if ((outlen != (long)strlen(body)) || (memcmp(out, body, outlen) != 0)) {
+      printf("FAIL: %s (by %ld): body \"%.*s\" instead of \"%s\"\n", name, step, (int)outlen, out, body);
+    } else if (h.keepalive != keepalive) {
+      printf("FAIL: %s (by %ld): keepalive %d instead of %d\n", name, step, h.keepalive, keepalive);
+    } else if ((hdr != NULL) && ((http_header(&h, hdr) == NULL) || (strcmp(http_header(&h, hdr), val) != 0))) {
+      printf("FAIL: %s (by %ld): header %s is \"%s\" instead of \"%s\"\n", name, step, hdr, http_header(&h, hdr) ? http_header(&h, hdr) : "(none)", val);
+    } else {
+      continue;
+    }
+    failed = 1;
+    return;
+  }
+}
+
+int main(void) {
+  check("content-length",
+        "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nContent-Length: 5\r\n\r\nhelloEXTRA",
+        HTTP_DONE, 200, "hello", 1, "content-type", "text/plain");
+
+  check("bare lf and connection close",
+        "HTTP/1.1 404 Not Found\nConnection: close\nContent-Length: 3\n\nnop",
+        HTTP_DONE, 404, "nop", 0, "CONNECTION", "close");
+
+  check("no length",
+        "HTTP/1.0 200 OK\r\nServer: x\r\n\r\nuntil the end",
+        HTTP_BODY, 200, "until the end", 0, "server", "x");
+
+  check("empty body",
+        "HTTP/1.1 204 No Content\r\nContent-Length: 10\r\n\r\n",
+        HTTP_DONE, 204, "", 1, NULL, NULL);
+
+  check("interim answer",
+        "HTTP/1.1 100 Continue\r\n\r\nHTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\nok",
+        HTTP_DONE, 200, "ok", 1, "content-length", "2");
+
+  check("chunked",
+        "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n"
+        "5\r\nhello\r\n1A\r\n abcdefghijklmnopqrstuvwxy\r\n0\r\n\r\nEXTRA",
+        HTTP_DONE, 200, "hello abcdefghijklmnopqrstuvwxy", 1, "transfer-encoding", "chunked");
+
+  check("chunk extensions",
+        "HTTP/1.1 200 OK\r\nTransfer-Encoding: gzip, chunked\r\n\r\n"
+        "3;name=val\r\nabc\r\n0;last\r\n\r\n",
+        HTTP_DONE, 200, "abc", 1, NULL, NULL);
+
+  check("chunked takes precedence over length",
+        "HTTP/1.1 200 OK\r\nContent-Length: 100\r\nTransfer-Encoding: chunked\r\n\r\n"
+        "2\r\nab\r\n0\r\n\r\n",
+        HTTP_DONE, 200, "ab", 1, NULL, NULL);
+
+  check("trailers",
+        "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n"
+        "4\r\ndata\r\n0\r\nExpires: never\r\nX-Check: 1\r\n\r\nEXTRA",
+        HTTP_DONE, 200, "data", 1, NULL, NULL);
+
+  check("trailers with bare lf",
+        "HTTP/1.1 200 OK\nTransfer-Encoding: chunked\n\n4\ndata\n0\nX-Check: 1\n\n",
+        HTTP_DONE, 200, "data", 1, NULL, NULL);
+
+  check("chunked, connection cut",
+        "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n8\r\nhalf",
+        HTTP_BODY, 200, "half", 1, NULL, NULL);
+
+  check("not http", "SSH-2.0-OpenSSH\r\n\r\n", HTTP_ERR, 0, "", 0, NULL, NULL);
+  check("no status line", "\r\nHTTP/1.1 200 OK\r\n\r\n", HTTP_ERR, 0, "", 0, NULL, NULL);
+  check("bad length", "HTTP/1.1 200 OK\r\nContent-Length: lots\r\n\r\n", HTTP_ERR, 0, "", 0, NULL, NULL);
+  check("bad chunk size",
+        "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\nfffffffff\r\n",
+        HTTP_ERR, 0, "", 0, NULL, NULL);
+
+  puts(failed ? "httptest: FAILED" : "httptest: ok");
+  return(failed);
+}
@@ -0,0 +1,90 @@
+/*
+ * This file is part of the Gopherus project
+ * Copyright (C) Mateusz Viste 2013-2022
+ *
+ * checks of the lz codec: round trips of compressible, incompressible and
+ * empty data. returns non-zero if any check fails.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lz.h"
+
+#define BUFSZ 65536
+
+static char src[BUFSZ], packed[BUFSZ * 2], res[BUFSZ];
+
+/* compresses len bytes of src into a buffer of packsz bytes and expands
+ * them back. returns the compressed length, or -1 if it did not fit */
+static long roundtrip(const char *name, long len, long packsz, int *failed) {
+  long plen;
+  plen = lz_compress(src, len, packed, packsz);
+  if (plen < 0) return(-1);
+  memset(res, 0xaa, sizeof(res));
+  if ((lz_expand(packed, plen, res, len) != 0) || (memcmp(src, res, len) != 0)) {
+    printf("FAIL: %s: data differs after a round trip\n", name);
+    *failed = 1;
+  }
+  return(plen);
+}
+
+int main(void) {
+  const char *menu = "iWelcome to the test server\tfake\t(NULL)\t0\r\n1Some directory\t/dir\texample.org\t70\r\n";
+  long i, plen;
+  unsigned long seed = 1;
+  int failed = 0;
+
+  /* compressible data: repeated gopher menu lines */
+  for (i = 0; i < BUFSZ; i++) src[i] = menu[i % strlen(menu)];
+  plen = roundtrip("menu", BUFSZ, sizeof(packed), &failed);
+  if ((plen < 0) || (plen >= BUFSZ / 4)) {
+    printf("FAIL: menu: %ld bytes compressed to %ld\n", (long)BUFSZ, plen);
+    failed = 1;
+  }
+
+  /* incompressible data: must round trip when given enough room, and be
+   * refused (not overflow dst) when not */
+  for (i = 0; i < BUFSZ; i++) {
+    seed = seed * 1103515245ul + 12345;
+    src[i] = (char)(seed >> 16);
+  }
+  if (roundtrip("random", BUFSZ, sizeof(packed), &failed) < 0) {
+    puts("FAIL: random: does not fit in twice its size");
+    failed = 1;
+  }
+  memset(packed, 0x55, sizeof(packed));
+  if (lz_compress(src, BUFSZ, packed, BUFSZ / 2) >= 0) {
+    puts("FAIL: random: fits in half its size");
+    failed = 1;
+  }
+  for (i = BUFSZ / 2; i < (long)sizeof(packed); i++) {
+    if (packed[i] != 0x55) {
+      puts("FAIL: random: written past the end of dst");
+      failed = 1;
+      break;
+    }
+  }
+
+  /* short and empty inputs */
+  for (i = 0; i < 16; i++) {
+    char name[16];
+    src[i] = 'a';
+    sprintf(name, "%ld bytes", i);
+    if (roundtrip(name, i, sizeof(packed), &failed) < 0) {
+      printf("FAIL: %s: compression refused\n", name);
+      failed = 1;
+    }
+  }
+
+  /* corrupted data must be reported, not expanded past dst */
+  for (i = 0; i < BUFSZ; i++) src[i] = menu[i % strlen(menu)];
+  plen = lz_compress(src, BUFSZ, packed, sizeof(packed));
+  if ((plen > 0) && (lz_expand(packed, plen, res, BUFSZ / 2) == 0)) {
+    puts("FAIL: corrupted: expanded into a too short buffer");
+    failed = 1;
+  }
+
+  puts(failed ? "lztest: FAILED" : "lztest: ok");
+  return(failed);
+}
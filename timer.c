@@ -0,0 +1,44 @@
+/*
+ * This file is part of the Gopherus project.
+ * Copyright (C) 2013-2022 Mateusz Viste
+ *
+ * Provides a portable millisecond clock. time() has a 1s resolution only,
+ * which is way too coarse for measuring network-related things.
+ */
+
+#ifdef _WIN32
+  #include <windows.h>  /* GetTickCount(), QueryPerformanceCounter() */
+#else
+  #include <time.h>     /* clock_gettime(), clock() */
+#endif
+
+#include "timer.h" /* include self for control */
+
+
+unsigned long timer_ms(void) {
+#if defined(_WIN32)
+  return(GetTickCount());
+#elif defined(__WATCOMC__) || defined(DJ64) || defined(__DJGPP__)
+  /* DOS: clock() is driven by the 18.2 Hz BIOS tick, that's the best we get */
+  return((unsigned long)clock() * 1000ul / CLOCKS_PER_SEC);
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return((unsigned long)ts.tv_sec * 1000ul + (unsigned long)ts.tv_nsec / 1000000ul);
+#endif
+}
+
+
+unsigned long timer_us(void) {
+#if defined(_WIN32)
+  LARGE_INTEGER freq, now;
+  if ((QueryPerformanceFrequency(&freq) == 0) || (QueryPerformanceCounter(&now) == 0)) return(GetTickCount() * 1000ul);
+  return((unsigned long)((now.QuadPart / freq.QuadPart) * 1000000 + ((now.QuadPart % freq.QuadPart) * 1000000) / freq.QuadPart));
+#elif defined(__WATCOMC__) || defined(DJ64) || defined(__DJGPP__)
+  return((unsigned long)clock() * (1000000ul / CLOCKS_PER_SEC));
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return((unsigned long)ts.tv_sec * 1000000ul + (unsigned long)ts.tv_nsec / 1000ul);
+#endif
+}
@@ -0,0 +1,19 @@
+/*
+ * This file is part of the Gopherus project.
+ * Copyright (C) 2013-2022 Mateusz Viste
+ */
+
+#ifndef timer_h_sentinel
+#define timer_h_sentinel
+
+/* returns a monotonic time in milliseconds. the reference point is
+ * undefined, hence only differences between two calls are meaningful. the
+ * counter wraps around, so always compare values through subtraction. */
+unsigned long timer_ms(void);
+
+/* same as timer_ms(), but in microseconds. the actual resolution depends on
+ * the platform (it is as coarse as 55 ms on DOS). wraps around after about
+ * 71 minutes where longs are 32 bits wide. */
+unsigned long timer_us(void);
+
+#endif
@@ -58,7 +58,7 @@ int ui_init(void) {
   raw();
   noecho();
   keypad(stdscr, TRUE); /* capture arrow keys */
-  timeout(100); /* getch blocks for 50ms max */
+  timeout(-1); /* getch blocks: waiting on other things goes through ui_getfd() */
   set_escdelay(50); /* ESC should wait for 50ms max */
   nonl(); /* allow ncurses to detect KEY_ENTER */
   return(0);
@@ -133,12 +133,14 @@ int ui_getkey(void) {
   for (;;) {
     res = wgetch(mywindow);
     if (res == KEY_MOUSE) continue; /* ignore mouse events */
-    if (res != ERR) break;          /* ERR means "no input available yet" */
+    if (res != ERR) break;          /* ERR means "interrupted by a signal" */
   }
 
   /* either ESC or ALT+some key */
   if (res == 27) {
+    timeout(50);
     res = wgetch(mywindow);
+    timeout(-1);
     if (res == ERR) return(27);
     /* else this is an ALT+something combination */
     switch (res) {
@@ -181,13 +183,23 @@ int ui_kbhit(void) {
   int tmp;
   timeout(0);
   tmp = wgetch(mywindow);
-  timeout(100);
+  timeout(-1);
   if (tmp == ERR) return(0);
   ungetch(tmp);
   return(1);
 }
 
 
+int ui_getfd(void) {
+#ifdef _WIN32
+  return(-1); /* the console is not a descriptor that can be polled */
+#else
+  if (mywindow == NULL) return(-1);
+  return(fileno(stdin));
+#endif
+}
+
+
 void ui_cursor_show(void) {
   curs_set(1);
 }
@@ -137,6 +137,11 @@ int ui_kbhit(void) {
 }
 
 
+int ui_getfd(void) {
+  return(-1); /* the keyboard is polled through DOS */
+}
+
+
 void ui_cursor_show(void) {
   if (cursor_start == 0) return;
   cursor_set(cursor_start, cursor_end); /* unhide the cursor */
@@ -39,6 +39,11 @@ int ui_getkey(void);
 /* returns 0 if no key is awaiting in the keyboard buffer, non-zero otherwise */
 int ui_kbhit(void);
 
+/* returns a file descriptor that becomes readable when a key is pressed, so
+ * the keyboard can be waited on along with sockets. -1 if there is no such
+ * thing (the keyboard has to be polled with ui_kbhit() then). */
+int ui_getfd(void);
+
 /* makes the cursor visible */
 void ui_cursor_show(void);
 
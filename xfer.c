@@ -0,0 +1,667 @@
+/*
+ * This file is part of the Gopherus project.
+ * Copyright (C) 2013-2022 Mateusz Viste
+ */
+
+#include <stdio.h>   /* snprintf(), fopen()... */
+#include <stdlib.h>  /* calloc(), malloc(), free() */
+#include <string.h>  /* strlen(), strdup() */
+#include <time.h>    /* time() */
+
+#include "config.h"
+#include "connpool.h"
+#include "dnscache.h"
+#include "fs/fs.h"
+#include "http.h"
+#include "net/net.h"
+#include "parseurl.h"
+#include "ratelim.h"
+#include "resolver.h"
+#include "timer.h"
+
+#include "xfer.h" /* include self for control */
+
+/* how long (seconds) a transfer may stay silent before being aborted */
+#define XFER_TIMEOUT 20
+
+/* delay (ms) between two connection attempts (RFC 8305 recommends 250 ms) */
+#define XFER_RACEDELAY 250
+
+/* how often (ms) the throughput is sampled for its moving average */
+#define XFER_RATEPERIOD 500
+
+/* receive buffer of compressed http bodies, they are inflated from there to
+ * the transfer's buffer */
+#define XFER_ZBUFSZ 4096
+
+/* unregisters and aborts socket *s */
+static void xfer_dropsock(struct xfer *x, struct net_tcpsocket **s) {
+  if (*s == NULL) return;
+  if (x->ps != NULL) net_pollset_del(x->ps, *s);
+  net_abort(s);
+}
+
+
+/* aborts all connection attempts that are still in progress */
+static void xfer_droprace(struct xfer *x) {
+  int i;
+  for (i = 0; i < XFER_MAXRACE; i++) xfer_dropsock(x, &(x->race[i]));
+}
+
+
+/* samples the throughput once in a while, for a moving average that reacts
+ * to changes while not jumping around with every read */
+static void xfer_ratesample(struct xfer *x) {
+  unsigned long now = timer_us();
+  long elapsed = (now - x->ratetime) / 1000;
+  long len = x->totlen - x->ratelen;
+  long inst;
+  if (elapsed < XFER_RATEPERIOD) return;
+  inst = (len / elapsed) * 1000 + ((len % elapsed) * 1000) / elapsed;
+  if (x->rate == 0) {
+    x->rate = inst;
+  } else {
+    x->rate = x->rate - (x->rate / 4) + (inst / 4);
+  }
+  x->ratetime = now;
+  x->ratelen = x->totlen;
+}
+
+
+/* the first bytes of the answer just arrived */
+static void xfer_firstbyte(struct xfer *x) {
+  x->timing.firstbyte = timer_us();
+  x->ratetime = x->timing.firstbyte;
+  x->ratelen = x->totlen;
+}
+
+
+static int xfer_fail(struct xfer *x, const char *errmsg) {
+  x->errmsg = errmsg;
+  x->state = XFER_FAIL;
+  x->timing.end = timer_us();
+  resolver_free(x->resq);
+  x->resq = NULL;
+  xfer_droprace(x);
+  xfer_dropsock(x, &(x->sock));
+  if (x->fd == stdout) {
+    fflush(stdout);
+    x->fd = NULL;
+  } else if (x->fd != NULL) {
+    fclose(x->fd);
+    x->fd = NULL;
+    remove(x->filename);
+  }
+  return(x->state);
+}
+
+
+static int xfer_checktimeout(struct xfer *x) {
+  if (time(NULL) - x->lastactivity > XFER_TIMEOUT) {
+    if (x->state == XFER_RESOLVE) return(xfer_fail(x, "!Timeout while resolving!"));
+    if (x->state == XFER_CONNECT) return(xfer_fail(x, "!Timeout while connecting!"));
+    if (x->state == XFER_HANDSHAKE) return(xfer_fail(x, "!Timeout during TLS handshake!"));
+    return(xfer_fail(x, "!Timeout while waiting for data!"));
+  }
+  return(x->state);
+}
+
+
+/* end of data: close everything and decide whether it was a success */
+static int xfer_finish(struct xfer *x) {
+  if (x->http != NULL) {
+    if (x->http->state == HTTP_HEAD) return(xfer_fail(x, "!Error: Failed to fetch or parse HTTP headers"));
+    /* the server announced how long its answer is, but did not deliver */
+    if ((x->http->state != HTTP_DONE) && (x->truncated == 0) && ((x->http->chunked != 0) || (x->http->contentlen >= 0))) {
+      return(xfer_fail(x, "!Error: connection closed before end of data"));
+    }
+    if ((x->zbuf != NULL) && (x->http->zend == 0) && (x->truncated == 0)) {
+      return(xfer_fail(x, "!Error: connection closed before end of data"));
+    }
+  }
+  /* consider 0-sized results as error (probably selector does not exist) */
+  if (x->totlen == 0) return(xfer_fail(x, "!Error: selector does not exist"));
+  if (x->ps != NULL) net_pollset_del(x->ps, x->sock);
+  if (x->truncated) {
+    net_abort(&(x->sock));
+  } else if ((x->http != NULL) && (x->http->state == HTTP_DONE) && x->http->keepalive) { /* keep it for the next request */
+    connpool_put(x->sock, x->host, x->port);
+    x->sock = NULL;
+  } else {
+    net_close(&(x->sock));
+  }
+  if (x->fd == stdout) {
+    if (fflush(stdout) != 0) return(xfer_fail(x, "!Error while writing data to disk"));
+    x->fd = NULL;
+  } else if (x->fd != NULL) {
+    if (fclose(x->fd) != 0) {
+      x->fd = NULL;
+      return(xfer_fail(x, "!Error while writing data to disk"));
+    }
+    x->fd = NULL;
+  }
+  x->timing.end = timer_us();
+  x->state = XFER_DONE;
+  return(x->state);
+}
+
+
+/* the http headers are complete: anything else than a success is reported
+ * as an error, along with the server's explanation */
+static int xfer_httpstatus(struct xfer *x) {
+  const char *location;
+  if ((x->http->status >= 200) && (x->http->status < 300)) {
+    if (x->http->encoding == HTTP_ENC_UNKNOWN) return(xfer_fail(x, "!Error: unsupported HTTP content encoding"));
+    /* size is known: let the OS reserve the disk space in one go */
+    if ((x->fd != NULL) && (x->http->contentlen > 0) && (x->http->encoding == HTTP_ENC_IDENTITY)) fileprealloc(x->fd, x->http->contentlen);
+    return(x->state);
+  }
+  location = http_header(x->http, "location");
+  if ((x->http->status >= 300) && (x->http->status < 400) && (location != NULL)) {
+    snprintf(x->errbuf, sizeof(x->errbuf), "!Error: HTTP %d, moved to %s", x->http->status, location);
+  } else {
+    snprintf(x->errbuf, sizeof(x->errbuf), "!Error: HTTP %d %s", x->http->status, http_reason(x->http));
+  }
+  return(xfer_fail(x, x->errbuf));
+}
+
+
+/* returns non-zero if the connection failing before anything was received
+ * is worth a second chance: it came from the pool (and the server closed it
+ * meanwhile) or it has been opened with TCP Fast Open (and this went wrong) */
+static int xfer_canretry(const struct xfer *x) {
+  if (x->rawlen != 0) return(0);
+  return(x->reused || (x->sock->tune & NET_TUNE_FASTOPEN));
+}
+
+
+/* the connection turned out to be dead: start over with a new, plain one */
+static int xfer_retry(struct xfer *x) {
+  if (x->sock->tune & NET_TUNE_FASTOPEN) x->nofastopen = 1;
+  xfer_dropsock(x, &(x->sock));
+  x->reused = 0;
+  x->nopool = 1;
+  x->nextaddr = 0;
+  x->state = XFER_RESOLVE;
+  x->lastactivity = time(NULL);
+  return(x->state);
+}
+
+
+/* the rate limiter has no tokens left for this transfer: stop polling its
+ * socket until it gets some back, so waiting costs no wakeups */
+static int xfer_throttle(struct xfer *x) {
+  x->throttled = 1;
+  if (x->ps != NULL) net_pollset_mod(x->ps, x->sock, 0);
+  return(x->state);
+}
+
+
+/* moves received data straight to the output file */
+static int xfer_splice(struct xfer *x) {
+  long r, maxlen = x->buffsz;
+  /* do not eat past the end of the answer */
+  if ((x->http != NULL) && (http_bodyleft(x->http) >= 0) && (maxlen > http_bodyleft(x->http))) maxlen = http_bodyleft(x->http);
+  if (maxlen > 0) {
+    maxlen = ratelim_allow(&(x->rl), maxlen);
+    if (maxlen == 0) return(xfer_throttle(x));
+  }
+  fflush(x->fd); /* whatever stdio still holds must land first */
+  r = net_splice(x->sock, fileno(x->fd), maxlen);
+  if (r == 0) return(xfer_checktimeout(x));
+  if (r == NET_SPLICE_WRERR) return(xfer_fail(x, "!Error while writing data to disk"));
+  if (r < 0) return(xfer_finish(x)); /* end of connection */
+  x->lastactivity = time(NULL);
+  if (x->rawlen == 0) xfer_firstbyte(x);
+  ratelim_take(&(x->rl), r);
+  x->rawlen += r;
+  x->totlen += r;
+  if (x->http != NULL) {
+    http_bodyskipped(x->http, r);
+    if (x->http->state == HTTP_DONE) return(xfer_finish(x));
+  }
+  return(x->state);
+}
+
+
+/* hands over len payload bytes sitting at data: they go to the output file,
+ * or are kept in buff (where they already sit) */
+static int xfer_store(struct xfer *x, const char *data, long len) {
+  x->totlen += len;
+  if (x->fd != NULL) {
+    if ((long)fwrite(data, 1, len, x->fd) != len) return(xfer_fail(x, "!Error while writing data to disk"));
+  } else {
+    x->bufflen += len;
+  }
+  return(x->state);
+}
+
+
+/* inflates the zlen compressed bytes sitting at the start of zbuf into
+ * buff, as many times as needed */
+static int xfer_inflate(struct xfer *x, long zlen) {
+  long n, used, off = 0;
+  for (;;) {
+    char *dst;
+    long room;
+    if (x->fd == NULL) {
+      dst = x->buff + x->bufflen;
+      room = x->buffsz - x->bufflen;
+      if (room <= 0) {
+        x->truncated = 1;
+        return(xfer_finish(x));
+      }
+    } else {
+      dst = x->buff;
+      room = x->buffsz;
+    }
+    n = http_inflate(x->http, x->zbuf + off, zlen - off, dst, room, &used);
+    if (n < 0) return(xfer_fail(x, "!Error: corrupted compressed data"));
+    off += used;
+    if (xfer_store(x, dst, n) == XFER_FAIL) return(x->state);
+    /* out of input, and no more output pending (out was not filled up) */
+    if ((off == zlen) && (n < room)) break;
+    if ((n == 0) && (used == 0)) break; /* no progress possible */
+  }
+  if (x->http->state == HTTP_DONE) return(xfer_finish(x));
+  return(x->state);
+}
+
+
+static int xfer_recv(struct xfer *x) {
+  char *dst;
+  long room;
+  int r;
+
+  /* memory transfers stop when the buffer is full, file transfers reuse the
+   * whole buffer for every chunk. compressed http bodies are received into
+   * zbuf first. */
+  if (x->zbuf != NULL) {
+    dst = x->zbuf;
+    room = XFER_ZBUFSZ;
+  } else if (x->fd == NULL) {
+    dst = x->buff + x->bufflen;
+    room = x->buffsz - x->bufflen;
+    if (room <= 0) {
+      x->truncated = 1;
+      return(xfer_finish(x));
+    }
+  } else {
+    /* http headers and chunked bodies need to go through the parser */
+    if (x->splice && ((x->http == NULL) || ((x->http->state == HTTP_BODY) && (x->http->chunked == 0)))) return(xfer_splice(x));
+    dst = x->buff;
+    room = x->buffsz;
+  }
+  /* whatever follows the http headers must fit in zbuf, in case the body
+   * turns out to be compressed */
+  if ((x->http != NULL) && (x->http->state == HTTP_HEAD) && (room > XFER_ZBUFSZ)) room = XFER_ZBUFSZ;
+  room = ratelim_allow(&(x->rl), room);
+  if (room == 0) return(xfer_throttle(x));
+
+  r = net_recv(x->sock, dst, room);
+  if (r == 0) return(xfer_checktimeout(x));
+  if (r < 0) { /* end of connection */
+    if (xfer_canretry(x)) return(xfer_retry(x));
+    return(xfer_finish(x));
+  }
+  x->lastactivity = time(NULL);
+  if (x->rawlen == 0) xfer_firstbyte(x);
+  ratelim_take(&(x->rl), r);
+  x->rawlen += r;
+
+  if (x->http != NULL) {
+    int inhead = (x->http->state == HTTP_HEAD);
+    r = http_feed(x->http, dst, r);
+    if (r < 0) {
+      if (inhead) return(xfer_fail(x, "!Error: Failed to fetch or parse HTTP headers"));
+      return(xfer_fail(x, "!Error: invalid chunked encoding"));
+    }
+    if (inhead && (x->http->state != HTTP_HEAD)) {
+      if (xfer_httpstatus(x) == XFER_FAIL) return(x->state);
+      if (x->http->encoding != HTTP_ENC_IDENTITY) {
+        x->zbuf = malloc(XFER_ZBUFSZ);
+        if (x->zbuf == NULL) return(xfer_fail(x, "!Out of memory"));
+        memcpy(x->zbuf, dst, r);
+      }
+    }
+    if (x->zbuf != NULL) return(xfer_inflate(x, r));
+  }
+
+  if (xfer_store(x, dst, r) == XFER_FAIL) return(x->state);
+  if ((x->http != NULL) && (x->http->state == HTTP_DONE)) return(xfer_finish(x));
+  return(x->state);
+}
+
+
+/* reorders the addr list so address families alternate, starting with the
+ * family of the first address (RFC 8305, section 4). the relative order of
+ * addresses within a family is preserved. */
+static void xfer_interleave(char addr[][NET_ADDRSTRLEN], int count) {
+  char tmp[DNS_MAXADDR][NET_ADDRSTRLEN];
+  int i, o, nextsame = 0, nextother = 0;
+  int firstv6;
+  if (count < 3) return; /* nothing to interleave */
+  firstv6 = (strchr(addr[0], ':') != NULL);
+  memcpy(tmp, addr, count * NET_ADDRSTRLEN);
+  for (o = 0; o < count; o++) {
+    /* pick the next address of the family that's due, if any left */
+    int wantv6 = firstv6 ^ (o & 1);
+    int *cursor = (wantv6 == firstv6) ? &nextsame : &nextother;
+    for (i = *cursor; i < count; i++) {
+      if ((tmp[i][0] != 0) && ((strchr(tmp[i], ':') != NULL) == wantv6)) break;
+    }
+    if (i == count) { /* family exhausted, take whatever is left */
+      for (i = 0; tmp[i][0] == 0; i++);
+    } else {
+      *cursor = i + 1;
+    }
+    strcpy(addr[o], tmp[i]);
+    tmp[i][0] = 0;
+  }
+}
+
+
+/* connection is established: send the query */
+static int xfer_sendquery(struct xfer *x) {
+  long len;
+  if (x->protocol == PARSEURL_PROTO_HTTP) { /* http */
+    char port[8] = "";
+    if (x->port != 80) snprintf(port, sizeof(port), ":%u", x->port);
+    len = snprintf(x->buff, x->buffsz, "GET /%s HTTP/1.1\r\nHost: %s%s\r\nUser-Agent: Gopherus\r\n%s\r\n", x->selector, x->host, port, HTTP_ACCEPTENC);
+    /* (re)initialize the answer parser */
+    if (x->http == NULL) {
+      x->http = http_new();
+      if (x->http == NULL) return(xfer_fail(x, "!Out of memory"));
+    } else {
+      http_init(x->http);
+    }
+  } else { /* gopher */
+    len = snprintf(x->buff, x->buffsz, "%s\r\n", x->selector);
+  }
+  if ((len < 0) || (len >= x->buffsz)) return(xfer_fail(x, "!Error: selector too long"));
+  x->rawlen = 0;
+  if (net_send(x->sock, x->buff, len) != len) {
+    if (xfer_canretry(x)) return(xfer_retry(x));
+    return(xfer_fail(x, "!send() error!"));
+  }
+  if (x->ps != NULL) net_pollset_mod(x->ps, x->sock, NET_EV_READ);
+  x->lastactivity = time(NULL);
+  x->timing.secured = timer_us();
+  x->state = XFER_RECV;
+  return(x->state);
+}
+
+
+/* makes the TLS handshake progress, the query is sent once it is over */
+static int xfer_handshake(struct xfer *x) {
+  int events = 0, r;
+  r = net_tlshandshake(x->sock, &events);
+  if (r < 0) {
+    if (x->reused) return(xfer_retry(x));
+    return(xfer_fail(x, "!Error: TLS handshake failed"));
+  }
+  if (r == 0) {
+    x->tlsevents = events;
+    if (x->ps != NULL) net_pollset_mod(x->ps, x->sock, events);
+    return(xfer_checktimeout(x));
+  }
+  x->tlsresumed = (r == 2);
+  x->lastactivity = time(NULL);
+  return(xfer_sendquery(x));
+}
+
+
+/* connection is established: secure it first if needed, then send the
+ * query */
+static int xfer_connected(struct xfer *x) {
+  x->timing.connected = timer_us();
+  if (x->protocol != PARSEURL_PROTO_GOPHERS) return(xfer_sendquery(x));
+  if (net_tlsstart(x->sock, x->host, x->port) != 0) return(xfer_fail(x, "!Error: TLS is not available"));
+  x->state = XFER_HANDSHAKE;
+  return(xfer_handshake(x));
+}
+
+
+/* races connection attempts to all addresses of the host, RFC 8305 style:
+ * a new attempt starts every XFER_RACEDELAY ms (or as soon as the previous
+ * one failed), the first socket that gets connected wins and all the others
+ * are closed */
+static int xfer_race(struct xfer *x) {
+  int i, active = 0;
+
+  /* check attempts in progress */
+  for (i = 0; i < XFER_MAXRACE; i++) {
+    int connstate;
+    if (x->race[i] == NULL) continue;
+    connstate = net_isconnected(x->race[i], 0);
+    if (connstate > 0) { /* we have a winner */
+      x->sock = x->race[i];
+      x->race[i] = NULL;
+      strcpy(x->ipaddr, x->addr[x->raceaddr[i]]);
+      xfer_droprace(x);
+      dnscache_setwinner(x->host, x->ipaddr);
+      return(xfer_connected(x));
+    }
+    if (connstate < 0) { /* failed: no need to wait before trying the next address */
+      xfer_dropsock(x, &(x->race[i]));
+      x->lastattempt = timer_ms() - XFER_RACEDELAY;
+      continue;
+    }
+    active++;
+  }
+
+  /* start a new attempt if nothing is running, or if the last one has been
+   * started long enough ago */
+  while ((x->nextaddr < x->addrcount) && (active < XFER_MAXRACE)) {
+    if ((active > 0) && (timer_ms() - x->lastattempt < XFER_RACEDELAY)) break;
+    for (i = 0; x->race[i] != NULL; i++); /* find a free slot */
+    x->raceaddr[i] = x->nextaddr;
+    x->race[i] = net_connect(x->addr[x->nextaddr++], x->port, x->nofastopen ? ~NET_TUNE_FASTOPEN : -1);
+    if (x->race[i] == NULL) continue; /* could not even start, try next one */
+    if ((x->ps != NULL) && (net_pollset_add(x->ps, x->race[i], NET_EV_WRITE, x) != 0)) {
+      net_abort(&(x->race[i]));
+      continue;
+    }
+    x->lastattempt = timer_ms();
+    active++;
+  }
+
+  if (active == 0) {
+    /* cached addresses may be stale (cache is kept across sessions): forget
+     * them and give the resolver a chance before giving up */
+    if (x->fromcache) {
+      dnscache_del(x->host);
+      x->fromcache = 0;
+      x->nextaddr = 0;
+      x->state = XFER_RESOLVE;
+      return(x->state);
+    }
+    return(xfer_fail(x, "!Connection error!"));
+  }
+  return(xfer_checktimeout(x));
+}
+
+
+struct xfer *xfer_new(unsigned char protocol, const char *host, unsigned short port, const char *selector, char *buff, long buffsz, const char *filename, struct net_pollset *ps) {
+  struct xfer *x;
+
+  x = calloc(1, sizeof(struct xfer) + strlen(host));
+  if (x == NULL) return(NULL);
+  strcpy(x->host, host);
+  x->selector = strdup(selector);
+  if (filename != NULL) x->filename = strdup(filename);
+  if ((x->selector == NULL) || ((filename != NULL) && (x->filename == NULL))) {
+    xfer_free(x);
+    return(NULL);
+  }
+  x->protocol = protocol;
+  x->port = port;
+  x->buff = buff;
+  x->buffsz = buffsz;
+  x->ps = ps;
+  x->state = XFER_RESOLVE;
+  x->timing.start = timer_us();
+  ratelim_init(&(x->rl));
+  x->starttime = time(NULL);
+  x->lastactivity = x->starttime;
+
+  if (filename != NULL) {
+    if (strcmp(filename, "-") == 0) {
+      filebinstdout();
+      x->fd = stdout;
+    } else {
+      x->fd = fopen(filename, "wb");
+    }
+    if (x->fd == NULL) {
+      xfer_fail(x, "!Error: could not create the file on disk!");
+    } else if (protocol != PARSEURL_PROTO_GOPHERS) { /* TLS data needs to be decrypted first */
+      x->splice = net_canspliceto(fileno(x->fd));
+    }
+  }
+  return(x);
+}
+
+
+int xfer_adoptsock(struct xfer *x, struct net_tcpsocket *s, const char *ipaddr) {
+  if (s == NULL) return(-1);
+  if ((x->state != XFER_RESOLVE) || (x->sock != NULL) || ((x->ps != NULL) && (net_pollset_add(x->ps, s, NET_EV_WRITE, x) != 0))) {
+    net_abort(&s);
+    return(-1);
+  }
+  x->sock = s;
+  x->reused = 1; /* the server may have closed it meanwhile */
+  strcpy(x->ipaddr, ipaddr);
+  x->timing.resolved = timer_us();
+  xfer_connected(x);
+  return(0);
+}
+
+
+int xfer_step(struct xfer *x, int events) {
+  switch (x->state) {
+
+    case XFER_RESOLVE:
+      /* http: an idle connection to this server may be waiting in the pool */
+      if ((x->protocol == PARSEURL_PROTO_HTTP) && (x->nopool == 0)) {
+        x->nopool = 1; /* one chance only */
+        x->sock = connpool_get(x->host, x->port);
+        if (x->sock != NULL) {
+          x->reused = 1;
+          x->timing.resolved = timer_us();
+          if ((x->ps != NULL) && (net_pollset_add(x->ps, x->sock, NET_EV_WRITE, x) != 0)) return(xfer_fail(x, "!Out of memory"));
+          x->timing.connected = x->timing.resolved;
+          return(xfer_sendquery(x));
+        }
+      }
+      if (x->resq == NULL) {
+        x->addrcount = dnscache_ask(x->addr, DNS_MAXADDR, x->host);
+        if (x->addrcount < 0) return(xfer_fail(x, "!DNS resolution failed!"));
+        if (x->addrcount == 0) { /* not in cache: ask the resolver pool */
+          x->resq = resolver_start(x->host);
+          if (x->resq == NULL) return(xfer_fail(x, "!Out of memory"));
+        } else {
+          x->fromcache = 1;
+        }
+      }
+      if (x->resq != NULL) {
+        x->addrcount = resolver_result(x->resq, x->addr, DNS_MAXADDR);
+        if (x->addrcount == 0) return(xfer_checktimeout(x)); /* still in progress */
+        resolver_free(x->resq);
+        x->resq = NULL;
+        if (x->addrcount == NET_DNS_NOHOST) dnscache_add(x->host, NULL, 0); /* negative entry */
+        if (x->addrcount < 0) return(xfer_fail(x, "!DNS resolution failed!"));
+        dnscache_add(x->host, x->addr, x->addrcount);
+      }
+      xfer_interleave(x->addr, x->addrcount);
+      x->lastactivity = time(NULL);
+      x->timing.resolved = timer_us();
+      x->state = XFER_CONNECT;
+      return(xfer_race(x)); /* start the first connection attempt right away */
+
+    case XFER_CONNECT:
+      return(xfer_race(x));
+
+    case XFER_HANDSHAKE:
+      if (events == 0) return(xfer_checktimeout(x));
+      return(xfer_handshake(x));
+
+    case XFER_RECV:
+      if (x->rawlen > 0) xfer_ratesample(x);
+      if (x->throttled) {
+        if ((ratelim_delay(&(x->rl)) > 0) && ((events & NET_EV_ERR) == 0)) return(x->state);
+        /* tokens are back: data is likely waiting already */
+        x->throttled = 0;
+        x->lastactivity = time(NULL);
+        if (x->ps != NULL) net_pollset_mod(x->ps, x->sock, NET_EV_READ);
+        return(xfer_recv(x));
+      }
+      if ((events & (NET_EV_READ | NET_EV_ERR)) == 0) return(xfer_checktimeout(x));
+      return(xfer_recv(x));
+  }
+  return(x->state);
+}
+
+
+long xfer_bytesleft(const struct xfer *x) {
+  if ((x->http == NULL) || (x->http->state != HTTP_BODY) || (x->http->encoding != HTTP_ENC_IDENTITY)) return(-1);
+  return(http_bodyleft(x->http));
+}
+
+
+long xfer_timeout(struct xfer *x) {
+  long t;
+  if ((x->state == XFER_DONE) || (x->state == XFER_FAIL)) return(-1);
+  /* the resolver is not a socket, it has to be polled */
+  if (x->state == XFER_RESOLVE) return((x->resq == NULL) ? 0 : XFER_RESOLVEPOLL);
+  if (x->throttled) return(ratelim_delay(&(x->rl)));
+  /* xfer_checktimeout() works with whole seconds */
+  t = (XFER_TIMEOUT + 1 - (long)(time(NULL) - x->lastactivity)) * 1000l;
+  if (t < 0) t = 0;
+  /* the next connection attempt of the race */
+  if ((x->state == XFER_CONNECT) && (x->nextaddr < x->addrcount)) {
+    long r = XFER_RACEDELAY - (long)(timer_ms() - x->lastattempt);
+    if (r < 0) r = 0;
+    if (r < t) t = r;
+  }
+  return(t);
+}
+
+
+int xfer_rehome(struct xfer *x, char *buff, long buffsz, struct net_pollset *ps) {
+  int i;
+  if ((x->fd != NULL) || (x->bufflen > buffsz)) return(-1);
+  if ((x->state == XFER_DONE) || (x->state == XFER_FAIL)) return(-1);
+  memcpy(buff, x->buff, x->bufflen);
+  x->buff = buff;
+  x->buffsz = buffsz;
+  /* sockets are registered for write while connecting, for read later */
+  for (i = 0; i < XFER_MAXRACE; i++) {
+    if (x->race[i] == NULL) continue;
+    if (x->ps != NULL) net_pollset_del(x->ps, x->race[i]);
+    if ((ps != NULL) && (net_pollset_add(ps, x->race[i], NET_EV_WRITE, x) != 0)) net_abort(&(x->race[i]));
+  }
+  if (x->sock != NULL) {
+    int events = x->throttled ? 0 : NET_EV_READ;
+    if (x->state == XFER_HANDSHAKE) events = x->tlsevents;
+    if (x->ps != NULL) net_pollset_del(x->ps, x->sock);
+    if ((ps != NULL) && (net_pollset_add(ps, x->sock, events, x) != 0)) {
+      net_abort(&(x->sock));
+      x->ps = ps;
+      xfer_fail(x, "!Out of memory");
+      return(0);
+    }
+  }
+  x->ps = ps;
+  return(0);
+}
+
+
+void xfer_free(struct xfer *x) {
+  if (x == NULL) return;
+  if ((x->state != XFER_DONE) && (x->state != XFER_FAIL)) xfer_fail(x, "!Transfer aborted");
+  http_free(x->http);
+  free(x->zbuf);
+  free(x->selector);
+  free(x->filename);
+  free(x);
+}
@@ -0,0 +1,129 @@
+/*
+ * This file is part of the Gopherus project.
+ * Copyright (C) 2013-2022 Mateusz Viste
+ *
+ * Non-blocking transfer engine: fetches a gopher or http resource into a
+ * memory buffer or a file, one step at a time, so many transfers can be
+ * driven concurrently from a single net_pollset.
+ */
+
+#ifndef xfer_h_sentinel
+#define xfer_h_sentinel
+
+#include <stdio.h>
+#include <time.h>
+
+#include "config.h"
+#include "http.h"
+#include "net/net.h"
+#include "ratelim.h"
+#include "resolver.h"
+
+/* transfer states, in the order they are walked through */
+#define XFER_RESOLVE 0  /* hostname needs to be resolved */
+#define XFER_CONNECT 1  /* waiting for the TCP connection to establish */
+#define XFER_HANDSHAKE 2 /* gophers: TLS handshake in progress */
+#define XFER_RECV    3  /* query sent, receiving the answer */
+#define XFER_DONE    4  /* transfer completed successfully */
+#define XFER_FAIL    5  /* transfer failed, errmsg tells why */
+
+/* how often (ms) a transfer waiting for the resolver should be stepped */
+#define XFER_RESOLVEPOLL 20
+
+/* max amount of connection attempts racing against each other */
+#define XFER_MAXRACE 4
+
+/* when the phases of a transfer ended, as timer_us() values. a phase that
+ * did not take place (pooled connection...) ends when the previous did. */
+struct xfer_timing {
+  unsigned long start;     /* transfer created */
+  unsigned long resolved;  /* addresses of the host known */
+  unsigned long connected; /* connection established */
+  unsigned long secured;   /* TLS session established (if any) and query sent */
+  unsigned long firstbyte; /* first byte of the answer received */
+  unsigned long end;       /* transfer done (or failed) */
+};
+
+struct xfer {
+  struct resolver_query *resq;  /* hostname resolution in progress */
+  struct net_tcpsocket *sock;
+  struct net_tcpsocket *race[XFER_MAXRACE]; /* connection attempts in progress */
+  unsigned char raceaddr[XFER_MAXRACE];     /* index of the address each attempt connects to */
+  unsigned long lastattempt;                /* timer_ms() of the latest connection attempt */
+  int addrcount;
+  int nextaddr;            /* next address to try connecting to */
+  struct net_pollset *ps;  /* set the socket is registered in */
+  FILE *fd;                /* output file (NULL for memory transfers) */
+  char *buff;              /* receive buffer (owned by the caller) */
+  long buffsz;
+  long bufflen;            /* bytes kept in buff (memory transfers only) */
+  long totlen;             /* payload bytes received so far */
+  time_t starttime;
+  time_t lastactivity;
+  const char *errmsg;      /* human error message, set on XFER_FAIL */
+  char *selector;
+  char *filename;
+  unsigned short port;
+  unsigned char protocol;
+  unsigned char state;
+  unsigned char truncated; /* memory buffer got full before end of data */
+  unsigned char fromcache; /* addresses come from dnscache */
+  unsigned char splice;    /* data goes to fd through net_splice() */
+  unsigned char reused;    /* sock was opened beforehand (connection pool, pre-connection) */
+  unsigned char nopool;    /* do not (or no longer) look into the connection pool */
+  unsigned char nofastopen; /* do not (or no longer) use TCP Fast Open */
+  unsigned char throttled; /* waiting for the rate limiter, socket not polled */
+  unsigned char tlsevents; /* NET_EV_* flags the TLS handshake waits for */
+  unsigned char tlsresumed; /* TLS session resumed from an earlier connection */
+  long rawlen;             /* bytes received on the socket so far */
+  struct http_resp *http;  /* http: answer parser */
+  char *zbuf;              /* http: compressed data waiting to be inflated */
+  struct xfer_timing timing;
+  unsigned long ratetime;  /* timer_us() of the last throughput sample */
+  long ratelen;            /* totlen at the last throughput sample */
+  long rate;               /* moving average of the throughput (bytes/s) */
+  struct ratelim rl;       /* rate limiter bucket */
+  char errbuf[80];         /* room for errmsg, when it needs to be composed */
+  char addr[DNS_MAXADDR][NET_ADDRSTRLEN]; /* host's addresses, in the order they are tried */
+  char ipaddr[NET_ADDRSTRLEN]; /* the address that won the connection race */
+  char host[1];
+};
+
+/* prepares a new transfer of selector from host:port. the payload is
+ * written to filename if not NULL (the file is created and will be removed
+ * if the transfer fails, "-" stands for stdout), otherwise it is
+ * accumulated in buff. buff is
+ * required in both cases, it must remain valid until xfer_free() is called.
+ * ps is the set in which the transfer registers its socket, with userdata
+ * pointing to the xfer itself. returns NULL on out of memory condition. */
+struct xfer *xfer_new(unsigned char protocol, const char *host, unsigned short port, const char *selector, char *buff, long buffsz, const char *filename, struct net_pollset *ps);
+
+/* hands over s, a socket connected to the server of x already, so that x
+ * does not have to resolve and connect (x must not have been stepped yet).
+ * ipaddr is the address s is connected to. x owns s from now on, even if
+ * it cannot use it, in which case a non-zero value is returned. */
+int xfer_adoptsock(struct xfer *x, struct net_tcpsocket *s, const char *ipaddr);
+
+/* makes the transfer progress as much as possible without blocking, events
+ * being the NET_EV_* flags reported for its socket (may be 0, for instance
+ * to let the transfer check its timeouts). returns the new state. */
+int xfer_step(struct xfer *x, int events);
+
+/* returns how long (ms) x may wait for events on its sockets before it has
+ * to be stepped anyway (to poll the resolver, check its timeout...), or -1
+ * if it is over */
+long xfer_timeout(struct xfer *x);
+
+/* moves the running memory transfer x over to buffer buff (the data
+ * received so far is copied there) and to set ps, so another part of the
+ * program can take it over. returns non-zero if x cannot be moved, in which
+ * case it is left untouched. */
+int xfer_rehome(struct xfer *x, char *buff, long buffsz, struct net_pollset *ps);
+
+/* returns the amount of payload bytes still expected, or -1 if not known */
+long xfer_bytesleft(const struct xfer *x);
+
+/* aborts the transfer if still running and frees all its resources */
+void xfer_free(struct xfer *x);
+
+#endif